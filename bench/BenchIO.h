@@ -0,0 +1,70 @@
+#ifndef _BenchIO_h
+#define _BenchIO_h
+
+#include <stdio.h>
+#include <ctype.h>
+#include "Image.h"
+#include "FlowFile.h"
+
+//---------------------------------------------------------------------------------------
+// the files read by the benchmarks: 8-bit binary PGM (P5) and PPM (P6) images, and the
+// Middlebury .flo flow files (see FlowFile)
+//---------------------------------------------------------------------------------------
+static int readPNMValue(FILE* file)
+{
+	int c=fgetc(file);
+	while(c=='#' || isspace(c))
+	{
+		if(c=='#')
+			while(c!='\n' && c!=EOF)
+				c=fgetc(file);
+		c=fgetc(file);
+	}
+	int value=0;
+	for(;c>='0' && c<='9';c=fgetc(file))
+		value=value*10+c-'0';
+	return value;
+}
+
+// the values are scaled to [0,1]
+template <class T>
+static bool readPNM(const char* filename,Image<T>& image)
+{
+	FILE* file=fopen(filename,"rb");
+	if(file==NULL)
+		return false;
+	int nChannels=0;
+	if(fgetc(file)=='P')
+	{
+		int type=fgetc(file);
+		nChannels=(type=='5')?1:((type=='6')?3:0);
+	}
+	int width=readPNMValue(file);
+	int height=readPNMValue(file);
+	int maxValue=readPNMValue(file);
+	if(nChannels==0 || width<=0 || height<=0 || maxValue<=0 || maxValue>255)
+	{
+		fclose(file);
+		return false;
+	}
+	image.allocate(width,height,nChannels);
+	unsigned char* pBuffer=new unsigned char[image.nelements()];
+	bool IsRead=(fread(pBuffer,1,image.nelements(),file)==(size_t)image.nelements());
+	fclose(file);
+	for(int i=0;i<image.nelements();i++)
+		image.data()[i]=(T)pBuffer[i]/maxValue;
+	delete []pBuffer;
+	return IsRead;
+}
+
+template <class T>
+static bool readFlo(const char* filename,Image<T>& vx,Image<T>& vy)
+{
+	FlowFile file;
+	if(!file.open(filename))
+		return false;
+	file.split(vx,vy);
+	return true;
+}
+
+#endif
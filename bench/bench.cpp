@@ -0,0 +1,571 @@
+//---------------------------------------------------------------------------------------
+// standalone benchmark of the optical flow, without Torch and Lua
+// The library is compiled in, the same way as celiu.cpp does, and the kernels are timed
+// on synthetic images at several resolutions, or on a pair of PPM/PGM images. For each
+// kernel the time per call, the throughput in megapixels per second and the heap
+// allocations per call (after a first call that allocates the outputs) are reported.
+// The stream kernel is also a check: once its buffers are allocated, the flow of a new
+// frame must not allocate, and the benchmark exits with 1 if it does.
+//
+// build, from the root of the repository (mex.h is only needed for its declarations):
+//		g++ -O3 -DMATLAB_FOUND -I<matlab>/extern/include -Igeneric -pthread bench/bench.cpp -o celiu-bench
+// or configure the rock with -DBUILD_BENCHMARK=ON
+//
+// usage: celiu-bench [options] [image1.ppm image2.ppm]
+//		-s WxH		resolution of the synthetic images (repeatable, default 320x240 640x480 1280x720)
+//		-k name		only run the kernels whose name contains name
+//		-T seconds	minimum time spent on each kernel (default 0.5)
+//		-t n		number of threads of the pool (default 1, 0: all the cores)
+//		-o n		number of outer fixed point iterations of the flow (default 6)
+//		-c n		number of CG iterations of the flow (default 40)
+//		-S solver	cg | pcg | sor | multigrid | fmg (default cg)
+//		-d			double pixels (default float)
+//		-v			print the per-stage profile of the last flow of each resolution
+//---------------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <new>
+
+#include "ThreadPool.cpp"
+#include "GaussianPyramid.cpp"
+#include "MultigridSolver.cpp"
+#include "FlowWorkspace.cpp"
+#include "OpticalFlowCode.cpp"
+#include "OpticalFlowStream.cpp"
+#include "FlowColor.h"
+#include "BenchIO.h"
+
+//---------------------------------------------------------------------------------------
+// counting the heap allocations
+//---------------------------------------------------------------------------------------
+static long nAllocations=0;
+static long nAllocatedBytes=0;
+
+void* operator new(size_t size)
+{
+	__sync_fetch_and_add(&nAllocations,1);
+	__sync_fetch_and_add(&nAllocatedBytes,(long)size);
+	void* p=malloc(size==0?1:size);
+	if(p==NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+// not inlined, so that the compiler does not match free() with the new expressions
+__attribute__((noinline)) void operator delete(void* p) throw()
+{
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	operator delete(p);
+}
+
+// the sized versions, used instead of the ones above since C++14
+void operator delete(void* p,size_t) throw()
+{
+	operator delete(p);
+}
+
+void operator delete[](void* p,size_t) throw()
+{
+	operator delete(p);
+}
+
+//---------------------------------------------------------------------------------------
+// the options of the command line
+//---------------------------------------------------------------------------------------
+class BenchOptions
+{
+public:
+	enum{nMaxSizes=16};
+	int nSizes;
+	int widths[nMaxSizes],heights[nMaxSizes];
+	const char* filter;
+	const char* files[2];
+	double minTime;
+	int nThreads,nOuterFPIterations,nCGIterations;
+	SolverPara para;
+	bool IsDouble,IsVerbose;
+	BenchOptions(void)
+	{
+		nSizes=0;
+		filter=NULL;
+		files[0]=files[1]=NULL;
+		minTime=0.5;
+		nThreads=1;
+		nOuterFPIterations=6;
+		nCGIterations=40;
+		IsDouble=IsVerbose=false;
+	};
+	bool parse(int argc,char** argv);
+	inline bool selected(const char* name) const {return filter==NULL || strstr(name,filter)!=NULL;};
+};
+
+bool BenchOptions::parse(int argc,char** argv)
+{
+	int nFiles=0;
+	for(int i=1;i<argc;i++)
+	{
+		const char* arg=argv[i];
+		bool hasValue=(i+1<argc);
+		if(strcmp(arg,"-d")==0)
+			IsDouble=true;
+		else if(strcmp(arg,"-v")==0)
+			IsVerbose=true;
+		else if(strcmp(arg,"-s")==0 && hasValue && nSizes<nMaxSizes)
+		{
+			if(sscanf(argv[++i],"%dx%d",&widths[nSizes],&heights[nSizes])!=2 || widths[nSizes]<=0 || heights[nSizes]<=0)
+				return false;
+			nSizes++;
+		}
+		else if(strcmp(arg,"-k")==0 && hasValue)
+			filter=argv[++i];
+		else if(strcmp(arg,"-T")==0 && hasValue)
+			minTime=atof(argv[++i]);
+		else if(strcmp(arg,"-t")==0 && hasValue)
+			nThreads=atoi(argv[++i]);
+		else if(strcmp(arg,"-o")==0 && hasValue)
+			nOuterFPIterations=atoi(argv[++i]);
+		else if(strcmp(arg,"-c")==0 && hasValue)
+			nCGIterations=atoi(argv[++i]);
+		else if(strcmp(arg,"-S")==0 && hasValue)
+		{
+			const char* solver=argv[++i];
+			if(strcmp(solver,"pcg")==0)
+				para.solver=SolverPara::PCG;
+			else if(strcmp(solver,"sor")==0)
+				para.solver=SolverPara::SOR;
+			else if(strcmp(solver,"multigrid")==0 || strcmp(solver,"fmg")==0)
+			{
+				para.solver=SolverPara::Multigrid;
+				para.IsFMG=(strcmp(solver,"fmg")==0);
+			}
+			else if(strcmp(solver,"cg")!=0)
+				return false;
+		}
+		else if(arg[0]!='-' && nFiles<2)
+			files[nFiles++]=arg;
+		else
+			return false;
+	}
+	if(nFiles==1)
+		return false;
+	if(nSizes==0)
+	{
+		int defaultWidths[]={320,640,1280},defaultHeights[]={240,480,720};
+		for(nSizes=0;nSizes<3;nSizes++)
+		{
+			widths[nSizes]=defaultWidths[nSizes];
+			heights[nSizes]=defaultHeights[nSizes];
+		}
+	}
+	para.nThreads=nThreads;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------
+// the input images
+//---------------------------------------------------------------------------------------
+// a smooth texture with some noise, translated by (dx,dy)
+template <class T>
+static void syntheticImage(Image<T>& image,int width,int height,int nChannels,double dx,double dy)
+{
+	image.allocate(width,height,nChannels);
+	unsigned int seed=12345;
+	double scale=640.0/width;
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			double x=(j-dx)*scale,y=(i-dy)*scale;
+			for(int k=0;k<nChannels;k++)
+			{
+				seed=seed*1103515245+12345;
+				double noise=((seed>>16)&1023)/1023.0-0.5;
+				image.data()[(i*width+j)*nChannels+k]=0.5+0.2*sin(0.11*x+0.3*k)*cos(0.07*y)+0.15*sin(0.23*x+0.19*y+k)+0.02*noise;
+			}
+		}
+}
+
+//---------------------------------------------------------------------------------------
+// the kernels, each call does the work once on images that are kept across the calls
+//---------------------------------------------------------------------------------------
+template <class T>
+class FilterBench
+{
+public:
+	enum Type{Horizontal,Vertical,Filter2D};
+	Type type;
+	const Image<T>* pInput;
+	Image<T> output;
+	double filter1D[5],filter2D[25];
+	FilterBench(Type _type,const Image<T>& input)
+	{
+		type=_type;
+		pInput=&input;
+		output.allocate(input.width(),input.height(),input.nchannels());
+		ImageProcessing::generate1DGaussian(filter1D,2,1.0);
+		// a 5x5 filter that is not separable, to time the general 2D filtering
+		for(int i=0;i<5;i++)
+			for(int j=0;j<5;j++)
+				filter2D[i*5+j]=filter1D[i]*filter1D[j]+((i==2 || j==2)?0.01:0);
+	};
+	void operator()(void)
+	{
+		const T* pSrc=pInput->data();
+		if(type==Horizontal)
+			ImageProcessing::hfiltering(pSrc,output.data(),pInput->width(),pInput->height(),pInput->nchannels(),filter1D,2);
+		else if(type==Vertical)
+			ImageProcessing::vfiltering(pSrc,output.data(),pInput->width(),pInput->height(),pInput->nchannels(),filter1D,2);
+		else
+			ImageProcessing::filtering(pSrc,output.data(),pInput->width(),pInput->height(),pInput->nchannels(),filter2D,2);
+	};
+};
+
+template <class T>
+class WarpBench
+{
+public:
+	const Image<T>* pInput;
+	Image<T> vx,vy,output;
+	WarpBench(const Image<T>& input)
+	{
+		pInput=&input;
+		int width=input.width(),height=input.height();
+		output.allocate(width,height,input.nchannels());
+		vx.allocate(width,height);
+		vy.allocate(width,height);
+		// a smooth flow of a few pixels, that moves some pixels out of the image
+		for(int i=0;i<height;i++)
+			for(int j=0;j<width;j++)
+			{
+				vx.data()[i*width+j]=3*sin(6.28*i/height)+1.5;
+				vy.data()[i*width+j]=2*cos(6.28*j/width)-0.7;
+			}
+	};
+	void operator()(void)
+	{
+		ImageProcessing::warpImage(output.data(),pInput->data(),pInput->data(),vx.data(),vy.data(),pInput->width(),pInput->height(),pInput->nchannels());
+	};
+};
+
+template <class T>
+class ResizeBench
+{
+public:
+	const Image<T>* pInput;
+	Image<T> output;
+	ResizeBench(const Image<T>& input)
+	{
+		pInput=&input;
+		output.allocate((int)(input.width()*0.75),(int)(input.height()*0.75),input.nchannels());
+	};
+	void operator()(void)
+	{
+		ImageProcessing::ResizeImage(pInput->data(),output.data(),pInput->width(),pInput->height(),pInput->nchannels(),0.75);
+	};
+};
+
+template <class T>
+class LaplacianBench
+{
+public:
+	Image<T> input,weight,output;
+	ThreadPool* pPool;
+	LaplacianBench(const Image<T>& image,ThreadPool& pool)
+	{
+		pPool=&pool;
+		int width=image.width(),height=image.height();
+		input.allocate(width,height);
+		weight.allocate(width,height);
+		output.allocate(width,height);
+		for(int i=0;i<width*height;i++)
+		{
+			input.data()[i]=image.data()[i*image.nchannels()];
+			weight.data()[i]=1/(1+input.data()[i]);
+		}
+	};
+	void operator()(void)
+	{
+		OpticalFlow::Laplacian(output,input,weight,*pPool);
+	};
+};
+
+template <class T>
+class PyramidBench
+{
+public:
+	const Image<T>* pInput;
+	GaussianPyramid<T> pyramid;
+	ThreadPool* pPool;
+	PyramidBench(const Image<T>& input,ThreadPool& pool) {pInput=&input;pPool=&pool;};
+	void operator()(void)
+	{
+		pyramid.ConstructPyramid(*pInput,0.75,30,*pPool);
+	};
+};
+
+// the visualization of the flow of WarpBench, normalized by its largest norm
+template <class T>
+class ColorBench
+{
+public:
+	WarpBench<T> flow;
+	Image<T> rgb,norm,angle;
+	ThreadPool* pPool;
+	ColorBench(const Image<T>& input,ThreadPool& pool):flow(input) {pPool=&pool;};
+	void operator()(void)
+	{
+		FlowColor::colorize(rgb,norm,angle,flow.vx,flow.vy,0,*pPool);
+	};
+};
+
+// one outer and one inner fixed point iteration with nCGIterations CG iterations
+template <class T>
+class SolverBench
+{
+public:
+	const Image<T> *pIm1,*pIm2;
+	Image<T> warpIm2,vx,vy;
+	FlowWorkspace<T> workspace;
+	ThreadPool* pPool;
+	SolverPara para;
+	int nCGIterations;
+	SolverBench(const Image<T>& Im1,const Image<T>& Im2,ThreadPool& pool,int nIterations)
+	{
+		pIm1=&Im1;
+		pIm2=&Im2;
+		pPool=&pool;
+		nCGIterations=nIterations;
+		vx.allocate(Im1.width(),Im1.height());
+		vy.allocate(Im1.width(),Im1.height());
+	};
+	void operator()(void)
+	{
+		warpIm2.copyData(*pIm2);
+		vx.reset();
+		vy.reset();
+		OpticalFlow::SmoothFlowPDE(*pIm1,*pIm2,warpIm2,vx,vy,0.01,1,1,nCGIterations,para,*pPool,workspace);
+	};
+};
+
+template <class T>
+class FlowBench
+{
+public:
+	const Image<T> *pIm1,*pIm2;
+	Image<T> vx,vy,warpI2;
+	const BenchOptions* pOptions;
+	SolverPara para;
+	FlowProfile profile;
+	FlowBench(const Image<T>& Im1,const Image<T>& Im2,const BenchOptions& options)
+	{
+		pIm1=&Im1;
+		pIm2=&Im2;
+		pOptions=&options;
+		para=options.para;
+		para.pProfile=options.IsVerbose?&profile:NULL;
+	};
+	void operator()(void)
+	{
+		profile.clear();
+		OpticalFlow::Coarse2FineFlow(vx,vy,warpI2,*pIm1,*pIm2,0.01,0.75,30,pOptions->nOuterFPIterations,1,pOptions->nCGIterations,para);
+	};
+};
+
+// the flow of a video that alternates the two images, one frame per call
+// the frames are planar, as the bindings pass them, and the first pair is computed by the
+// constructor and by the first call of measure()
+template <class T>
+class StreamBench
+{
+public:
+	Image<T> frames[2];
+	Image<T> vx,vy,warpI2;
+	OpticalFlowStream<T> stream;
+	int nFrames;
+	StreamBench(const Image<T>& Im1,const Image<T>& Im2,const BenchOptions& options)
+		:stream(0.01,0.75,30,options.nOuterFPIterations,1,options.nCGIterations,options.para)
+	{
+		frames[0].copyData(Im1);
+		frames[0].setPlanar(true);
+		frames[1].copyData(Im2);
+		frames[1].setPlanar(true);
+		stream.addFrame(frames[0],vx,vy,warpI2);
+		nFrames=1;
+	};
+	void operator()(void)
+	{
+		stream.addFrame(frames[nFrames%2],vx,vy,warpI2);
+		nFrames++;
+	};
+};
+
+//---------------------------------------------------------------------------------------
+// the time and the allocations per call of a kernel
+// the first call is not counted, it allocates the outputs and warms up the caches
+//---------------------------------------------------------------------------------------
+class BenchResult
+{
+public:
+	double seconds,allocations,bytes;
+	BenchResult(void) {seconds=allocations=bytes=0;};
+	BenchResult operator-(const BenchResult& other) const
+	{
+		BenchResult result;
+		result.seconds=seconds-other.seconds;
+		result.allocations=allocations-other.allocations;
+		result.bytes=bytes-other.bytes;
+		return result;
+	};
+};
+
+template <class Kernel>
+static BenchResult measure(Kernel& kernel,double minTime)
+{
+	kernel();
+	long allocations=nAllocations,bytes=nAllocatedBytes;
+	double start=FlowProfile::now(),elapsed=0;
+	int nCalls=0;
+	do
+	{
+		kernel();
+		nCalls++;
+		elapsed=FlowProfile::now()-start;
+	}while(elapsed<minTime);
+	BenchResult result;
+	result.seconds=elapsed/nCalls;
+	result.allocations=(double)(nAllocations-allocations)/nCalls;
+	result.bytes=(double)(nAllocatedBytes-bytes)/nCalls;
+	return result;
+}
+
+static void report(const char* name,int width,int height,const BenchResult& result)
+{
+	char size[32];
+	sprintf(size,"%dx%d",width,height);
+	printf("%-14s %-10s %12.3f %10.1f %12.1f %12.1f\n",name,size,result.seconds*1000,width*height/result.seconds*1E-6,
+		result.allocations,result.bytes/1024);
+	fflush(stdout);
+}
+
+template <class Kernel>
+static void run(const char* name,Kernel& kernel,int width,int height,const BenchOptions& options)
+{
+	if(options.selected(name))
+		report(name,width,height,measure(kernel,options.minTime));
+}
+
+//---------------------------------------------------------------------------------------
+// all the kernels on one pair of images
+// returns false if a check failed
+//---------------------------------------------------------------------------------------
+template <class T>
+static bool benchmark(const Image<T>& Im1,const Image<T>& Im2,const BenchOptions& options,ThreadPool& pool)
+{
+	bool passed=true;
+	int width=Im1.width(),height=Im1.height();
+
+	FilterBench<T> hfilter(FilterBench<T>::Horizontal,Im1);
+	run("hfiltering",hfilter,width,height,options);
+	FilterBench<T> vfilter(FilterBench<T>::Vertical,Im1);
+	run("vfiltering",vfilter,width,height,options);
+	FilterBench<T> filter(FilterBench<T>::Filter2D,Im1);
+	run("filtering",filter,width,height,options);
+	WarpBench<T> warp(Im1);
+	run("warpImage",warp,width,height,options);
+	ResizeBench<T> resize(Im1);
+	run("ResizeImage",resize,width,height,options);
+	LaplacianBench<T> laplacian(Im1,pool);
+	run("Laplacian",laplacian,width,height,options);
+	PyramidBench<T> pyramid(Im1,pool);
+	run("pyramid",pyramid,width,height,options);
+	ColorBench<T> color(Im1,pool);
+	run("flowColor",color,width,height,options);
+
+	// the cost of one CG iteration is the difference of the solver with and without CG
+	// iterations, divided by their number
+	if(options.selected("cg"))
+	{
+		const int nIterations=20;
+		SolverBench<T> withCG(Im1,Im2,pool,nIterations),withoutCG(Im1,Im2,pool,0);
+		withCG.para=withoutCG.para=options.para;
+		withCG.para.solver=withoutCG.para.solver=SolverPara::CG;
+		BenchResult result=measure(withCG,options.minTime)-measure(withoutCG,options.minTime);
+		result.seconds/=nIterations;
+		result.allocations/=nIterations;
+		result.bytes/=nIterations;
+		report("cg",width,height,result);
+	}
+
+	if(options.selected("flow"))
+	{
+		FlowBench<T> flow(Im1,Im2,options);
+		report("flow",width,height,measure(flow,options.minTime));
+		if(options.IsVerbose)
+			flow.profile.print(cout);
+	}
+
+	if(options.selected("stream"))
+	{
+		StreamBench<T> stream(Im1,Im2,options);
+		BenchResult result=measure(stream,options.minTime);
+		report("stream",width,height,result);
+		if(result.allocations>0)
+		{
+			fprintf(stderr,"stream %dx%d: %.1f allocations per frame, expected none\n",width,height,result.allocations);
+			passed=false;
+		}
+	}
+	return passed;
+}
+
+template <class T>
+static int benchmark(const BenchOptions& options)
+{
+	const char* levels[]={"none","AVX2","AVX-512"};
+	printf("%s pixels, %d thread(s), SIMD %s\n",sizeof(T)==sizeof(float)?"float":"double",options.nThreads,levels[SIMD::level()]);
+	printf("%-14s %-10s %12s %10s %12s %12s\n","kernel","size","ms/call","Mpix/s","allocs/call","KB/call");
+	ThreadPool pool(options.nThreads);
+	if(options.files[0]!=NULL)
+	{
+		Image<T> Im1,Im2;
+		if(!readPNM(options.files[0],Im1) || !readPNM(options.files[1],Im2) || !Im1.matchDimension(Im2))
+		{
+			fprintf(stderr,"cannot read %s and %s as two PGM or PPM images of the same size\n",options.files[0],options.files[1]);
+			return 1;
+		}
+		return benchmark(Im1,Im2,options,pool)?0:1;
+	}
+	bool passed=true;
+	for(int i=0;i<options.nSizes;i++)
+	{
+		Image<T> Im1,Im2;
+		syntheticImage(Im1,options.widths[i],options.heights[i],3,0,0);
+		syntheticImage(Im2,options.widths[i],options.heights[i],3,1.5,-0.7);
+		if(!benchmark(Im1,Im2,options,pool))
+			passed=false;
+	}
+	return passed?0:1;
+}
+
+int main(int argc,char** argv)
+{
+	BenchOptions options;
+	if(!options.parse(argc,argv))
+	{
+		fprintf(stderr,"usage: %s [-s WxH]... [-k name] [-T seconds] [-t threads] [-o outer] [-c cg] [-S solver] [-d] [-v] [image1.ppm image2.ppm]\n",argv[0]);
+		return 1;
+	}
+	if(options.IsDouble)
+		return benchmark<double>(options);
+	return benchmark<float>(options);
+}
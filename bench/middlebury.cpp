@@ -0,0 +1,386 @@
+//---------------------------------------------------------------------------------------
+// accuracy regression test of the optical flow against ground truth flow
+// Coarse2FineFlow is run with several configurations (solver, precision, parameters) on
+// the image pairs of a directory, and the average endpoint error (EPE), the average
+// angular error (AE) and the time per pair of each configuration are reported. The first
+// configuration is the reference: a configuration whose EPE is larger than the one of the
+// reference by more than the tolerance fails, and the exit status is then 1. So a speed
+// optimization is validated for accuracy by adding its configuration.
+//
+// The directory has one subdirectory per sequence, with the two frames frame10 and
+// frame11 (8-bit binary .ppm or .pgm) and the flow between them flow10.flo, i.e. the
+// layout of the Middlebury training set with the frames converted from PNG to PPM.
+//
+// build, from the root of the repository (mex.h is only needed for its declarations):
+//		g++ -O3 -DMATLAB_FOUND -I<matlab>/extern/include -Igeneric -pthread bench/middlebury.cpp -o celiu-middlebury
+//
+// usage: celiu-middlebury [options] directory
+//		-c config	a configuration (repeatable, the first one is the reference)
+//		-e pixels	allowed increase of the EPE over the reference, in pixels (default 0.01)
+//		-p percent	allowed increase of the EPE over the reference, in percent (default 2)
+//		-t n		number of threads of each flow (default 1, 0: all the cores)
+//		-v			the results of each sequence
+// A configuration is a list of key=value separated by commas, e.g. "name=fast,solver=pcg",
+// with the keys name, type (float | double), solver (cg | pcg | sor | multigrid | fmg),
+// alpha, ratio, minWidth, outer, inner, cg, tolerance, cycles, sor, omega, outerTol,
+// innerTol and adaptive (0 | 1). The keys that are not given have the defaults of
+// libceliu.infer, with double pixels. Without -c the configurations of defaultConfigs
+// are run.
+//---------------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "ThreadPool.cpp"
+#include "GaussianPyramid.cpp"
+#include "MultigridSolver.cpp"
+#include "FlowWorkspace.cpp"
+#include "OpticalFlowCode.cpp"
+#include "BenchIO.h"
+
+// the reference, then the solvers and the speed options
+static const char* defaultConfigs[]={
+	"name=reference",
+	"name=float,type=float",
+	"name=pcg,solver=pcg",
+	"name=multigrid,solver=multigrid",
+	"name=fmg,solver=fmg",
+	"name=sor,solver=sor",
+	"name=cg-tolerance,tolerance=0.001",
+	"name=early-stop,outerTol=0.01,innerTol=0.01,adaptive=1",
+	"name=fast,type=float,solver=pcg,tolerance=0.001,outerTol=0.01,adaptive=1"
+};
+
+//---------------------------------------------------------------------------------------
+// the parameters of one configuration
+//---------------------------------------------------------------------------------------
+class FlowConfig
+{
+public:
+	char name[64];
+	bool IsDouble;
+	double alpha,ratio;
+	int minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations;
+	SolverPara para;
+	FlowConfig(void)
+	{
+		name[0]=0;
+		IsDouble=true;
+		alpha=0.01;
+		ratio=0.75;
+		minWidth=30;
+		nOuterFPIterations=15;
+		nInnerFPIterations=1;
+		nCGIterations=40;
+	};
+	bool parse(const char* config);
+private:
+	bool set(const char* key,const char* value);
+};
+
+bool FlowConfig::parse(const char* config)
+{
+	char buffer[1024];
+	strncpy(buffer,config,sizeof(buffer)-1);
+	buffer[sizeof(buffer)-1]=0;
+	for(char* item=strtok(buffer,",");item!=NULL;item=strtok(NULL,","))
+	{
+		char* value=strchr(item,'=');
+		if(value==NULL)
+			return false;
+		*value++=0;
+		if(!set(item,value))
+			return false;
+	}
+	if(name[0]==0)
+	{
+		strncpy(name,config,sizeof(name)-1);
+		name[sizeof(name)-1]=0;
+	}
+	return true;
+}
+
+bool FlowConfig::set(const char* key,const char* value)
+{
+	if(strcmp(key,"name")==0)
+	{
+		strncpy(name,value,sizeof(name)-1);
+		name[sizeof(name)-1]=0;
+	}
+	else if(strcmp(key,"type")==0)
+	{
+		if(strcmp(value,"float")!=0 && strcmp(value,"double")!=0)
+			return false;
+		IsDouble=(strcmp(value,"double")==0);
+	}
+	else if(strcmp(key,"solver")==0)
+	{
+		para.IsFMG=false;
+		if(strcmp(value,"cg")==0)
+			para.solver=SolverPara::CG;
+		else if(strcmp(value,"pcg")==0)
+			para.solver=SolverPara::PCG;
+		else if(strcmp(value,"sor")==0)
+			para.solver=SolverPara::SOR;
+		else if(strcmp(value,"multigrid")==0 || strcmp(value,"fmg")==0)
+		{
+			para.solver=SolverPara::Multigrid;
+			para.IsFMG=(strcmp(value,"fmg")==0);
+		}
+		else
+			return false;
+	}
+	else if(strcmp(key,"alpha")==0)
+		alpha=atof(value);
+	else if(strcmp(key,"ratio")==0)
+		ratio=atof(value);
+	else if(strcmp(key,"minWidth")==0)
+		minWidth=atoi(value);
+	else if(strcmp(key,"outer")==0)
+		nOuterFPIterations=atoi(value);
+	else if(strcmp(key,"inner")==0)
+		nInnerFPIterations=atoi(value);
+	else if(strcmp(key,"cg")==0)
+		nCGIterations=atoi(value);
+	else if(strcmp(key,"tolerance")==0)
+		para.tolerance=atof(value);
+	else if(strcmp(key,"cycles")==0)
+		para.nCycles=atoi(value);
+	else if(strcmp(key,"sor")==0)
+		para.nSORIterations=atoi(value);
+	else if(strcmp(key,"omega")==0)
+		para.omega=atof(value);
+	else if(strcmp(key,"outerTol")==0)
+		para.outerTolerance=atof(value);
+	else if(strcmp(key,"innerTol")==0)
+		para.innerTolerance=atof(value);
+	else if(strcmp(key,"adaptive")==0)
+		para.IsAdaptiveBudget=(atoi(value)!=0);
+	else
+		return false;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------
+// the sequences of the directory
+//---------------------------------------------------------------------------------------
+class Sequence
+{
+public:
+	char name[256];
+	char frame1[2048],frame2[2048],flow[2048];
+};
+
+static bool fileExists(const char* filename)
+{
+	struct stat info;
+	return stat(filename,&info)==0 && S_ISREG(info.st_mode);
+}
+
+// the frame path/base.ppm or .pgm, filename has 2048 characters
+static bool findFrame(char* filename,const char* path,const char* base)
+{
+	const char* extensions[]={"ppm","pgm"};
+	for(int i=0;i<2;i++)
+	{
+		snprintf(filename,2048,"%s/%s.%s",path,base,extensions[i]);
+		if(fileExists(filename))
+			return true;
+	}
+	return false;
+}
+
+static int compareSequences(const void* a,const void* b)
+{
+	return strcmp(((const Sequence*)a)->name,((const Sequence*)b)->name);
+}
+
+// the sequences are sorted by name, the subdirectories without the three files are skipped
+static int findSequences(const char* directory,Sequence*& pSequences)
+{
+	pSequences=NULL;
+	DIR* dir=opendir(directory);
+	if(dir==NULL)
+		return 0;
+	int nSequences=0,nAllocated=0;
+	for(dirent* entry=readdir(dir);entry!=NULL;entry=readdir(dir))
+	{
+		if(entry->d_name[0]=='.' || strlen(entry->d_name)>=sizeof(pSequences->name))
+			continue;
+		char path[1024];
+		snprintf(path,sizeof(path),"%s/%s",directory,entry->d_name);
+		Sequence sequence;
+		strcpy(sequence.name,entry->d_name);
+		snprintf(sequence.flow,sizeof(sequence.flow),"%s/flow10.flo",path);
+		if(!findFrame(sequence.frame1,path,"frame10") || !findFrame(sequence.frame2,path,"frame11") || !fileExists(sequence.flow))
+			continue;
+		if(nSequences==nAllocated)
+		{
+			nAllocated=__max(nAllocated*2,8);
+			Sequence* pNewSequences=new Sequence[nAllocated];
+			for(int i=0;i<nSequences;i++)
+				pNewSequences[i]=pSequences[i];
+			if(pSequences!=NULL)
+				delete []pSequences;
+			pSequences=pNewSequences;
+		}
+		pSequences[nSequences++]=sequence;
+	}
+	closedir(dir);
+	qsort(pSequences,nSequences,sizeof(Sequence),compareSequences);
+	return nSequences;
+}
+
+//---------------------------------------------------------------------------------------
+// the errors of a flow field, over the pixels whose ground truth is known
+// the angular error is the angle between (u,v,1) and (u_gt,v_gt,1), in degrees
+//---------------------------------------------------------------------------------------
+class FlowError
+{
+public:
+	double EPE,AE,seconds;
+	FlowError(void) {EPE=AE=seconds=0;};
+};
+
+template <class T>
+static FlowError flowError(const Image<T>& vx,const Image<T>& vy,const Image<float>& gtVx,const Image<float>& gtVy)
+{
+	FlowError error;
+	int nKnown=0;
+	for(int i=0;i<gtVx.npixels();i++)
+	{
+		double gu=gtVx.data()[i],gv=gtVy.data()[i];
+		if(!(fabs(gu)<1E9 && fabs(gv)<1E9))
+			continue;
+		double u=vx.data()[i],v=vy.data()[i];
+		error.EPE+=sqrt((u-gu)*(u-gu)+(v-gv)*(v-gv));
+		double cosine=(1+u*gu+v*gv)/sqrt((1+u*u+v*v)*(1+gu*gu+gv*gv));
+		error.AE+=acos(__max(__min(cosine,1),-1))*180/M_PI;
+		nKnown++;
+	}
+	if(nKnown>0)
+	{
+		error.EPE/=nKnown;
+		error.AE/=nKnown;
+	}
+	return error;
+}
+
+//---------------------------------------------------------------------------------------
+// one configuration on all the sequences, the errors are averaged over the sequences
+//---------------------------------------------------------------------------------------
+template <class T>
+static bool runConfig(const FlowConfig& config,const Sequence* pSequences,int nSequences,int nThreads,bool IsVerbose,FlowError& average)
+{
+	SolverPara para=config.para;
+	para.nThreads=nThreads;
+	average=FlowError();
+	for(int i=0;i<nSequences;i++)
+	{
+		const Sequence& sequence=pSequences[i];
+		Image<T> Im1,Im2,vx,vy,warpI2;
+		Image<float> gtVx,gtVy;
+		if(!readPNM(sequence.frame1,Im1) || !readPNM(sequence.frame2,Im2) || !readFlo(sequence.flow,gtVx,gtVy) ||
+			!Im1.matchDimension(Im2) || Im1.width()!=gtVx.width() || Im1.height()!=gtVx.height())
+		{
+			fprintf(stderr,"%s: cannot read the frames and the flow, or their sizes differ\n",sequence.name);
+			return false;
+		}
+		double start=FlowProfile::now();
+		OpticalFlow::Coarse2FineFlow(vx,vy,warpI2,Im1,Im2,config.alpha,config.ratio,config.minWidth,
+												  config.nOuterFPIterations,config.nInnerFPIterations,config.nCGIterations,para);
+		FlowError error=flowError(vx,vy,gtVx,gtVy);
+		error.seconds=FlowProfile::now()-start;
+		if(IsVerbose)
+			printf("  %-16s %8.4f %8.3f %8.3f\n",sequence.name,error.EPE,error.AE,error.seconds);
+		average.EPE+=error.EPE/nSequences;
+		average.AE+=error.AE/nSequences;
+		average.seconds+=error.seconds/nSequences;
+	}
+	return true;
+}
+
+int main(int argc,char** argv)
+{
+	const char* directory=NULL;
+	FlowConfig configs[64];
+	int nConfigs=0,nThreads=1;
+	double maxIncrease=0.01,maxPercent=2;
+	bool IsVerbose=false,IsValid=true;
+	for(int i=1;i<argc && IsValid;i++)
+	{
+		bool hasValue=(i+1<argc);
+		if(strcmp(argv[i],"-c")==0 && hasValue && nConfigs<64)
+			IsValid=configs[nConfigs++].parse(argv[++i]);
+		else if(strcmp(argv[i],"-e")==0 && hasValue)
+			maxIncrease=atof(argv[++i]);
+		else if(strcmp(argv[i],"-p")==0 && hasValue)
+			maxPercent=atof(argv[++i]);
+		else if(strcmp(argv[i],"-t")==0 && hasValue)
+			nThreads=atoi(argv[++i]);
+		else if(strcmp(argv[i],"-v")==0)
+			IsVerbose=true;
+		else if(argv[i][0]!='-' && directory==NULL)
+			directory=argv[i];
+		else
+			IsValid=false;
+	}
+	if(!IsValid || directory==NULL)
+	{
+		fprintf(stderr,"usage: %s [-c config]... [-e pixels] [-p percent] [-t threads] [-v] directory\n",argv[0]);
+		return 2;
+	}
+	if(nConfigs==0)
+		for(;nConfigs<(int)(sizeof(defaultConfigs)/sizeof(defaultConfigs[0]));nConfigs++)
+			configs[nConfigs].parse(defaultConfigs[nConfigs]);
+
+	Sequence* pSequences;
+	int nSequences=findSequences(directory,pSequences);
+	if(nSequences==0)
+	{
+		fprintf(stderr,"no sequence with frame10, frame11 and flow10.flo in %s\n",directory);
+		return 2;
+	}
+	printf("%d sequences, %d configurations, %d thread(s)\n",nSequences,nConfigs,nThreads);
+	printf("%-16s %8s %8s %8s %8s\n","config","EPE","AE","s/pair","speedup");
+
+	int nFailures=0;
+	FlowError reference;
+	for(int k=0;k<nConfigs;k++)
+	{
+		const FlowConfig& config=configs[k];
+		FlowError average;
+		if(IsVerbose)
+			printf("%s\n",config.name);
+		bool IsRun=config.IsDouble?runConfig<double>(config,pSequences,nSequences,nThreads,IsVerbose,average):
+										runConfig<float>(config,pSequences,nSequences,nThreads,IsVerbose,average);
+		if(!IsRun)
+		{
+			delete []pSequences;
+			return 2;
+		}
+		if(k==0)
+			reference=average;
+		printf("%-16s %8.4f %8.3f %8.3f %7.2fx",config.name,average.EPE,average.AE,average.seconds,reference.seconds/average.seconds);
+		if(k>0)
+		{
+			double allowed=reference.EPE*(1+maxPercent/100)+maxIncrease;
+			bool IsPassed=(average.EPE<=allowed);
+			printf("  %+.4f %s",average.EPE-reference.EPE,IsPassed?"ok":"FAIL");
+			if(!IsPassed)
+				nFailures++;
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+	delete []pSequences;
+	if(nFailures>0)
+	{
+		printf("%d configuration(s) degrade the EPE of %s beyond the tolerance\n",nFailures,configs[0].name);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,135 @@
+//---------------------------------------------------------------------------------------
+// regression test of the full multigrid solver on a reused hierarchy
+// A MultigridSolver is solved with full multigrid on a system of one size, then on a
+// system of another size with the same number of levels, as the workspace of a stream
+// does when the size of the frames changes. Before each solve, the right hand side
+// restricted to the levels must have the sizes of the levels and not be zero; the first
+// solve must be the same when repeated, and the second one the same as with a new solver.
+// ncycles() must count the V-cycles that Solve() ran, also when the tolerance stops it early.
+// The exit status is 1 if a check fails.
+//
+// build, from the root of the repository (mex.h is only needed for its declarations):
+//		g++ -O3 -DMATLAB_FOUND -I<matlab>/extern/include -Igeneric bench/multigrid.cpp -o celiu-multigrid
+//---------------------------------------------------------------------------------------
+#include <stdio.h>
+#include <math.h>
+
+#include "MultigridSolver.cpp"
+
+// a smooth system, as the ones of SmoothFlowPDE
+static void makeSystem(DImage& A11,DImage& A12,DImage& A22,DImage& phi,DImage& b1,DImage& b2,int width,int height)
+{
+	DImage* images[6]={&A11,&A12,&A22,&phi,&b1,&b2};
+	for(int l=0;l<6;l++)
+		images[l]->allocate(width,height);
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double x=0.13*j,y=0.17*i;
+			A11.data()[offset]=0.02+0.01*sin(x)*sin(x);
+			A12.data()[offset]=0.005*sin(x+y);
+			A22.data()[offset]=0.02+0.01*cos(y)*cos(y);
+			phi.data()[offset]=1/(1+0.5*sin(x-y)*sin(x-y));
+			b1.data()[offset]=0.1*sin(0.05*j)*cos(0.07*i);
+			b2.data()[offset]=0.1*cos(0.06*j+0.03*i);
+		}
+}
+
+// the restricted right hand sides of the levels have the sizes of the levels and are not zero
+static bool checkLevels(const MultigridSolver<double>& solver,int width,int height)
+{
+	bool IsPassed=true;
+	for(int k=0;k<solver.nlevels();k++)
+	{
+		if(solver.rhs1(k).width()!=width || solver.rhs1(k).height()!=height || !solver.rhs2(k).matchDimension(solver.rhs1(k)))
+		{
+			printf("  level %d: right hand side of %dx%d instead of %dx%d\n",k,solver.rhs1(k).width(),solver.rhs1(k).height(),width,height);
+			IsPassed=false;
+		}
+		else if(solver.rhs1(k).norm2()==0 || solver.rhs2(k).norm2()==0)
+		{
+			printf("  level %d: zero right hand side\n",k);
+			IsPassed=false;
+		}
+		width=(width+1)/2;
+		height=(height+1)/2;
+	}
+	return IsPassed;
+}
+
+static bool solve(MultigridSolver<double>& solver,DImage& du,DImage& dv,int width,int height)
+{
+	DImage A11,A12,A22,phi,b1,b2;
+	makeSystem(A11,A12,A22,phi,b1,b2,width,height);
+	solver.ConstructHierarchy(A11,A12,A22,phi,0.01);
+	solver.RestrictRightHandSide(b1,b2,solver.nlevels());
+	bool IsPassed=checkLevels(solver,width,height);
+	double rou0=b1.norm2()+b2.norm2();
+	double rou=solver.Solve(du,dv,b1,b2,2,2,2,true);
+	printf("%dx%d, %d levels: residual %g of %g\n",width,height,solver.nlevels(),rou,rou0);
+	if(!(rou<rou0*1e-2))
+	{
+		printf("  the residual did not decrease\n");
+		IsPassed=false;
+	}
+	return IsPassed;
+}
+
+// with a tolerance the cycles stop before the maximum, and ncycles() is the number run
+static bool checkCycles(int width,int height)
+{
+	DImage A11,A12,A22,phi,b1,b2,du,dv;
+	makeSystem(A11,A12,A22,phi,b1,b2,width,height);
+	MultigridSolver<double> solver;
+	solver.ConstructHierarchy(A11,A12,A22,phi,0.01);
+	const int nMaxCycles=50;
+	const double tolerance=1e-4;
+	double rou0=b1.norm2()+b2.norm2();
+	double rou=solver.Solve(du,dv,b1,b2,nMaxCycles,2,2,false,tolerance);
+	int nCycles=solver.ncycles();
+	printf("%dx%d, tolerance %g: %d of %d V-cycles, residual %g of %g\n",width,height,tolerance,nCycles,nMaxCycles,rou,rou0);
+	// one cycle less must not reach the tolerance
+	double rouLess=solver.Solve(du,dv,b1,b2,nCycles-1,2,2,false,tolerance);
+	if(nCycles<=1 || nCycles>=nMaxCycles || rou>=tolerance*tolerance*rou0 || rouLess<tolerance*tolerance*rou0 || solver.ncycles()!=nCycles-1)
+	{
+		printf("  the V-cycles run are not counted\n");
+		return false;
+	}
+	return true;
+}
+
+static bool same(const DImage& du,const DImage& dv,const DImage& otherDu,const DImage& otherDv)
+{
+	bool IsSame=du.matchDimension(otherDu);
+	for(int i=0;i<du.npixels() && IsSame;i++)
+		IsSame=(du.data()[i]==otherDu.data()[i] && dv.data()[i]==otherDv.data()[i]);
+	return IsSame;
+}
+
+int main(void)
+{
+	// 64x48 and 40x72 both have 4 levels, the second one is wider on the coarse levels
+	MultigridSolver<double> solver;
+	DImage du,dv,firstDu,firstDv;
+	bool IsPassed=solve(solver,firstDu,firstDv,64,48);
+	IsPassed=solve(solver,du,dv,64,48) && IsPassed;
+	if(!same(du,dv,firstDu,firstDv))
+	{
+		printf("the first solve differs from the second one\n");
+		IsPassed=false;
+	}
+	IsPassed=solve(solver,du,dv,40,72) && IsPassed;
+
+	MultigridSolver<double> newSolver;
+	DImage newDu,newDv;
+	IsPassed=solve(newSolver,newDu,newDv,40,72) && IsPassed;
+	if(!same(du,dv,newDu,newDv))
+	{
+		printf("the reused solver differs from a new one\n");
+		IsPassed=false;
+	}
+	IsPassed=checkCycles(64,48) && IsPassed;
+	printf(IsPassed?"passed\n":"FAILED\n");
+	return IsPassed?0:1;
+}
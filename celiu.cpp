@@ -5,13 +5,18 @@
 #define torch_(NAME) TH_CONCAT_3(torch_, Real, NAME)
 #define torch_string_(NAME) TH_CONCAT_STRING_3(torch., Real, NAME)
 #define libceliu_(NAME) TH_CONCAT_3(libceliu_, Real, NAME)
+#define libceliu_string_(NAME) TH_CONCAT_STRING_3(libceliu., Real, NAME)
 
 static const void* torch_FloatTensor_id = NULL;
 static const void* torch_DoubleTensor_id = NULL;
 
 
+#include "generic/ThreadPool.cpp"
 #include "generic/GaussianPyramid.cpp"
+#include "generic/MultigridSolver.cpp"
+#include "generic/FlowWorkspace.cpp"
 #include "generic/OpticalFlowCode.cpp"
+#include "generic/OpticalFlowStream.cpp"
 #include "generic/celiu.cpp"
 #include "THGenerateFloatTypes.h"
 
@@ -0,0 +1,270 @@
+#ifndef _FlowColor_h
+#define _FlowColor_h
+
+#include <math.h>
+#include "Image.h"
+#include "ThreadPool.h"
+
+//---------------------------------------------------------------------------------------
+// the color coding of a flow field, as opticalflow.field2rgb() of the Lua module: the hue
+// is the direction of the flow and the saturation its length, from white for no motion
+// to the pure colors for the largest motion
+// colorize() computes the norm, the angle (in degrees, in [0,360)) and the RGB image of
+// the flow in one pass over the pixels, band by band on the thread pool. The saturation is
+// norm/max, where max is the largest norm, or tanh(norm/maxFlow) if maxFlow>0 is given.
+// The RGB image is planar (the red, green and blue planes one after another), and is not
+// computed if pRGB is NULL. If pVx and pVy are NULL, the RGB image is computed from the
+// norm and the angle instead.
+// atan() and tanh() are polynomial approximations (from Cephes, within an ulp of the C
+// library), so that the vectorized code of ImageProcessingSIMD computes the same values.
+//---------------------------------------------------------------------------------------
+class FlowColor
+{
+public:
+	template <class T>
+	static void colorize(T* pNorm,T* pAngle,T* pRGB,const T* pVx,const T* pVy,int width,int height,double maxFlow,ThreadPool& pool);
+	template <class T>
+	static void colorize(Image<T>& rgb,Image<T>& norm,Image<T>& angle,const Image<T>& vx,const Image<T>& vy,double maxFlow,ThreadPool& pool);
+
+	// the norm and the angle of the flow of one pixel, and its color if pR is not NULL
+	template <class T>
+	static inline void colorPixel(T* pNorm,T* pAngle,T* pR,T* pG,T* pB,T vx,T vy,double maxFlow,bool IsSaturated);
+	// the color of one pixel from its norm and angle
+	template <class T>
+	static inline void colorPixel(T* pR,T* pG,T* pB,T norm,T angle,double maxFlow,bool IsSaturated);
+
+	static inline double atan(double t);
+	static inline double exp(double x);
+	// for x>=0
+	static inline double tanh(double x);
+	// a channel of image.hsl2rgb() of the Torch image package
+	static inline double hue2rgb(double p,double q,double t);
+private:
+	template <class T>
+	class MaxNormKernel;
+	template <class T>
+	class ColorKernel;
+};
+
+//---------------------------------------------------------------------------------------
+// the branches of opticalflow.computeAngle(), from h=atan(|vy/vx|)
+//---------------------------------------------------------------------------------------
+template <class T>
+inline void FlowColor::colorPixel(T* pNorm,T* pAngle,T* pR,T* pG,T* pB,T vx,T vy,double maxFlow,bool IsSaturated)
+{
+	double x=vx,y=vy;
+	T norm=sqrt(y*y+x*x);
+	double h=atan(fabs(y)/fabs(x))*(180/M_PI);
+	double angle;
+	if(x==0)
+		angle=(y>=0)?90:270;
+	else if(x>0)
+		angle=(y>=0)?h:360-h;
+	else
+		angle=(y>=0)?180-h:180+h;
+	*pNorm=norm;
+	*pAngle=angle;
+	if(pR!=NULL)
+		colorPixel(pR,pG,pB,norm,(T)angle,maxFlow,IsSaturated);
+}
+
+//---------------------------------------------------------------------------------------
+// HSL to RGB, where the lightness 1-s/2 is never below 1/2
+//---------------------------------------------------------------------------------------
+template <class T>
+inline void FlowColor::colorPixel(T* pR,T* pG,T* pB,T norm,T angle,double maxFlow,bool IsSaturated)
+{
+	double s=norm/maxFlow;
+	if(IsSaturated)
+		s=tanh(s);
+	double l=s*-0.5+1;
+	double q=l+s-l*s;
+	double p=2*l-q;
+	double hue=(double)angle/360;
+	*pR=hue2rgb(p,q,hue+1./3);
+	*pG=hue2rgb(p,q,hue);
+	*pB=hue2rgb(p,q,hue-1./3);
+}
+
+inline double FlowColor::atan(double t)
+{
+	// t=tan(y0+atan(x))
+	double y0=0,more=0,x=t;
+	if(t>2.41421356237309504880)
+	{
+		y0=M_PI_2;
+		more=6.123233995736765886130E-17;
+		x=-1/t;
+	}
+	else if(t>0.66)
+	{
+		y0=M_PI_4;
+		more=0.5*6.123233995736765886130E-17;
+		x=(t-1)/(t+1);
+	}
+	double z=x*x;
+	double num=(((-8.750608600031904122785E-1*z-1.615753718733365076637E1)*z-7.500855792314704667340E1)*z-1.228866684490136173410E2)*z-6.485021904942025371773E1;
+	double den=((((z+2.485846490142306297962E1)*z+1.650270098316988542046E2)*z+4.328810604912902668951E2)*z+4.853903996359136964868E2)*z+1.945506571482613964425E2;
+	z=z*num/den;
+	z=x*z+x;
+	z=z+more;
+	return y0+z;
+}
+
+inline double FlowColor::exp(double x)
+{
+	// x=n*log(2)+r, exp(r) from a rational approximation
+	double n=floor(1.4426950408889634073599*x+0.5);
+	x=x-n*6.93145751953125E-1;
+	x=x-n*1.42860682030941723212E-6;
+	double xx=x*x;
+	double p=x*((1.26177193074810590878E-4*xx+3.02994407707441961300E-2)*xx+9.99999999999999999910E-1);
+	double q=((3.00198505138664455042E-6*xx+2.52448340349684104192E-3)*xx+2.27265548208155028766E-1)*xx+2.00000000000000000009E0;
+	x=p/(q-p);
+	x=1+2*x;
+	return ldexp(x,(int)n);
+}
+
+inline double FlowColor::tanh(double x)
+{
+	// tanh(20) is 1 in double
+	double e=exp(-2*(x<20?x:20));
+	return (1-e)/(1+e);
+}
+
+inline double FlowColor::hue2rgb(double p,double q,double t)
+{
+	if(t<0)
+		t+=1;
+	if(t>1)
+		t-=1;
+	if(t<1./6)
+		return p+(q-p)*6*t;
+	if(t<1./2)
+		return q;
+	if(t<2./3)
+		return p+(q-p)*(2./3-t)*6;
+	return p;
+}
+
+//---------------------------------------------------------------------------------------
+// the largest squared norm of the flow of each band, or the largest norm
+//---------------------------------------------------------------------------------------
+template <class T>
+class FlowColor::MaxNormKernel
+{
+public:
+	const T *pNorm,*pVx,*pVy;
+	int width;
+	double* pBandMax;
+	void operator()(int rowStart,int rowEnd,int band)
+	{
+		double value=0;
+		if(pVx==NULL)
+		{
+			for(int i=rowStart*width;i<rowEnd*width;i++)
+				if(pNorm[i]>value)
+					value=pNorm[i];
+			pBandMax[band]=value;
+			return;
+		}
+		for(int i=rowStart*width;i<rowEnd*width;i++)
+		{
+			double x=pVx[i],y=pVy[i];
+			double norm2=y*y+x*x;
+			if(norm2>value)
+				value=norm2;
+		}
+		pBandMax[band]=value;
+	}
+};
+
+template <class T>
+class FlowColor::ColorKernel
+{
+public:
+	T *pNorm,*pAngle,*pRGB;
+	const T *pVx,*pVy;
+	int width,nPixels;
+	double maxFlow;
+	bool IsSaturated;
+	void operator()(int rowStart,int rowEnd,int)
+	{
+		int offset=rowStart*width;
+		int n=(rowEnd-rowStart)*width;
+		T *pR=NULL,*pG=NULL,*pB=NULL;
+		if(pRGB!=NULL)
+		{
+			pR=pRGB+offset;
+			pG=pR+nPixels;
+			pB=pG+nPixels;
+		}
+		const T *pX=NULL,*pY=NULL;
+		if(pVx!=NULL)
+		{
+			pX=pVx+offset;
+			pY=pVy+offset;
+		}
+		int i=ImageProcessingSIMD::flowColor(pNorm+offset,pAngle+offset,pR,pG,pB,pX,pY,n,maxFlow,IsSaturated);
+		for(;i<n;i++)
+		{
+			int k=offset+i;
+			if(pVx==NULL)
+				colorPixel(pR+i,pG+i,pB+i,pNorm[k],pAngle[k],maxFlow,IsSaturated);
+			else if(pR!=NULL)
+				colorPixel(pNorm+k,pAngle+k,pR+i,pG+i,pB+i,pVx[k],pVy[k],maxFlow,IsSaturated);
+			else
+				colorPixel(pNorm+k,pAngle+k,pR,pG,pB,pVx[k],pVy[k],maxFlow,IsSaturated);
+		}
+	}
+};
+
+template <class T>
+void FlowColor::colorize(T* pNorm,T* pAngle,T* pRGB,const T* pVx,const T* pVy,int width,int height,double maxFlow,ThreadPool& pool)
+{
+	ColorKernel<T> kernel;
+	kernel.IsSaturated=(maxFlow>0);
+	if(!kernel.IsSaturated && pRGB!=NULL)
+	{
+		// the largest norm, rounded to T as the norms are
+		int bands=ThreadPool::nbands(height);
+		double* pBandMax=new double[bands];
+		MaxNormKernel<T> maxKernel;
+		maxKernel.pNorm=pNorm;
+		maxKernel.pVx=pVx;
+		maxKernel.pVy=pVy;
+		maxKernel.width=width;
+		maxKernel.pBandMax=pBandMax;
+		pool.run(maxKernel,height);
+		double value=0;
+		for(int i=0;i<bands;i++)
+			if(pBandMax[i]>value)
+				value=pBandMax[i];
+		delete []pBandMax;
+		maxFlow=(pVx!=NULL)?(T)sqrt(value):value;
+	}
+	kernel.maxFlow=__max(maxFlow,1e-2);
+	kernel.pNorm=pNorm;
+	kernel.pAngle=pAngle;
+	kernel.pRGB=pRGB;
+	kernel.pVx=pVx;
+	kernel.pVy=pVy;
+	kernel.width=width;
+	kernel.nPixels=width*height;
+	pool.run(kernel,height);
+}
+
+template <class T>
+void FlowColor::colorize(Image<T>& rgb,Image<T>& norm,Image<T>& angle,const Image<T>& vx,const Image<T>& vy,double maxFlow,ThreadPool& pool)
+{
+	rgb.setPlanar();
+	if(rgb.width()!=vx.width() || rgb.height()!=vx.height() || rgb.nchannels()!=3)
+		rgb.allocate(vx.width(),vx.height(),3);
+	if(norm.matchDimension(vx)==false)
+		norm.allocate(vx.width(),vx.height());
+	if(angle.matchDimension(vx)==false)
+		angle.allocate(vx.width(),vx.height());
+	colorize(norm.data(),angle.data(),rgb.data(),vx.data(),vy.data(),vx.width(),vx.height(),maxFlow,pool);
+}
+
+#endif
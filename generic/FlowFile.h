@@ -0,0 +1,158 @@
+#ifndef _FlowFile_h
+#define _FlowFile_h
+
+#include <stdio.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Image.h"
+
+//---------------------------------------------------------------------------------------
+// the .flo files of the Middlebury benchmark: the tag 202021.25, the width and the height,
+// then the (u,v) of the pixels row by row, all 32-bit and little endian
+// open() maps the file, so data() is a view of the flow without any copy, valid until
+// close(); split() copies it to the two components, optionally setting the out of band
+// pixels to zero (the unknown flow of the ground truth is 1e10). write() streams the two
+// components to the file through a small buffer.
+//---------------------------------------------------------------------------------------
+class FlowFile
+{
+private:
+	void* pMapping;
+	size_t nBytes;
+	int Width,Height;
+	// not copyable
+	FlowFile(const FlowFile& other);
+	FlowFile& operator=(const FlowFile& other);
+public:
+	inline FlowFile(void) {pMapping=NULL;nBytes=0;Width=Height=0;};
+	inline ~FlowFile(void) {close();};
+	static inline float tag(void) {return 202021.25f;};
+
+	// false if the file cannot be mapped or is not a .flo file
+	inline bool open(const char* filename);
+	inline void close(void);
+	inline bool isOpen(void) const {return pMapping!=NULL;};
+	inline int width(void) const {return Width;};
+	inline int height(void) const {return Height;};
+	// the interleaved (u,v) of the pixels
+	inline const float* data(void) const {return (const float*)pMapping+3;};
+
+	// the flow to vx and vy, the pixels where |u| or |v| is larger than maxFlow (or NaN) are
+	// set to zero if maxFlow>0
+	template <class T>
+	void split(T* pVx,T* pVy,double maxFlow=0) const;
+	template <class T>
+	void split(Image<T>& vx,Image<T>& vy,double maxFlow=0) const;
+
+	template <class T>
+	static bool write(const char* filename,const T* pVx,const T* pVy,int width,int height);
+	template <class T>
+	static bool write(const char* filename,const Image<T>& vx,const Image<T>& vy);
+};
+
+inline bool FlowFile::open(const char* filename)
+{
+	close();
+	int file=::open(filename,O_RDONLY);
+	if(file<0)
+		return false;
+	struct stat info;
+	if(fstat(file,&info)!=0 || info.st_size<12)
+	{
+		::close(file);
+		return false;
+	}
+	nBytes=info.st_size;
+	// the whole file is read, so the pages are mapped at once where possible
+	int flags=MAP_PRIVATE;
+#ifdef MAP_POPULATE
+	flags|=MAP_POPULATE;
+#endif
+	void* pMap=mmap(NULL,nBytes,PROT_READ,flags,file,0);
+	::close(file);
+	if(pMap==MAP_FAILED)
+		return false;
+	const float* pHeader=(const float*)pMap;
+	const int* pSize=(const int*)pMap+1;
+	// the flow must fit in the file
+	if(pHeader[0]!=tag() || pSize[0]<=0 || pSize[1]<=0 || (nBytes-12)/8/pSize[0]<(size_t)pSize[1])
+	{
+		munmap(pMap,nBytes);
+		return false;
+	}
+	pMapping=pMap;
+	Width=pSize[0];
+	Height=pSize[1];
+	return true;
+}
+
+inline void FlowFile::close(void)
+{
+	if(pMapping!=NULL)
+		munmap(pMapping,nBytes);
+	pMapping=NULL;
+	nBytes=0;
+	Width=Height=0;
+}
+
+template <class T>
+void FlowFile::split(T* pVx,T* pVy,double maxFlow) const
+{
+	int nPixels=Width*Height;
+	const float* pFlow=data();
+	int i=ImageProcessingSIMD::splitFlow(pFlow,pVx,pVy,nPixels,maxFlow);
+	for(;i<nPixels;i++)
+	{
+		float u=pFlow[i*2],v=pFlow[i*2+1];
+		if(maxFlow>0 && !(fabs(u)<=maxFlow && fabs(v)<=maxFlow))
+			u=v=0;
+		pVx[i]=u;
+		pVy[i]=v;
+	}
+}
+
+template <class T>
+void FlowFile::split(Image<T>& vx,Image<T>& vy,double maxFlow) const
+{
+	vx.allocate(Width,Height);
+	vy.allocate(Width,Height);
+	split(vx.data(),vy.data(),maxFlow);
+}
+
+template <class T>
+bool FlowFile::write(const char* filename,const T* pVx,const T* pVy,int width,int height)
+{
+	FILE* file=fopen(filename,"wb");
+	if(file==NULL)
+		return false;
+	float header=tag();
+	int size[2]={width,height};
+	bool IsWritten=(fwrite(&header,sizeof(float),1,file)==1 && fwrite(size,sizeof(int),2,file)==2);
+	// interleave the pixels by chunks
+	const int nChunkPixels=4096;
+	float* pBuffer=new float[nChunkPixels*2];
+	int nPixels=width*height;
+	for(int start=0;start<nPixels && IsWritten;start+=nChunkPixels)
+	{
+		int n=__min(nChunkPixels,nPixels-start);
+		for(int i=0;i<n;i++)
+		{
+			pBuffer[i*2]=pVx[start+i];
+			pBuffer[i*2+1]=pVy[start+i];
+		}
+		IsWritten=(fwrite(pBuffer,sizeof(float),n*2,file)==(size_t)n*2);
+	}
+	delete []pBuffer;
+	return fclose(file)==0 && IsWritten;
+}
+
+template <class T>
+bool FlowFile::write(const char* filename,const Image<T>& vx,const Image<T>& vy)
+{
+	return write(filename,vx.data(),vy.data(),vx.width(),vx.height());
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef _FlowProfile_h
+#define _FlowProfile_h
+
+#include <time.h>
+#include <iostream>
+#include <iomanip>
+
+//---------------------------------------------------------------------------------------
+// wall time and call counts of the stages of OpticalFlow::Coarse2FineFlow(), per level of
+// the pyramids
+// A profile is recorded when SolverPara::pProfile points to it. The times add up across
+// the calls, so a profile kept by the caller (e.g. over the frames of a video) sums them
+// until clear() is called. The pyramids and the features of all the levels are built
+// together, so they are recorded once per call in setup(), not per level.
+// Define NO_FLOW_PROFILE to compile the probes out of the solver.
+//---------------------------------------------------------------------------------------
+class FlowProfile
+{
+public:
+	enum Stage{Pyramid,Features,Upsampling,Derivatives,Weights,Smoothing,System,Solver,Warping,nStages};
+
+	class Record
+	{
+	public:
+		double time[nStages];			// seconds
+		int calls[nStages];
+		int width,height;
+		int nOuterIterations;			// outer fixed point iterations that were run
+		int nInnerIterations;			// inner fixed point iterations, i.e. linear systems
+		int nSolverIterations;			// CG iterations, V-cycles or SOR sweeps
+		double residual;				// norm of the residual at the end of the last linear solve (-1: unknown)
+		inline Record(void) {clear();};
+		inline void clear(void)
+		{
+			for(int i=0;i<nStages;i++)
+			{
+				time[i]=0;
+				calls[i]=0;
+			}
+			width=height=0;
+			nOuterIterations=nInnerIterations=nSolverIterations=0;
+			residual=-1;
+		};
+		inline double totalTime(void) const
+		{
+			double total=0;
+			for(int i=0;i<nStages;i++)
+				total+=time[i];
+			return total;
+		};
+	};
+private:
+	Record Setup;
+	Record* pLevels;
+	int nLevels,current;
+	// not copyable
+	FlowProfile(const FlowProfile& other);
+	FlowProfile& operator=(const FlowProfile& other);
+public:
+	inline FlowProfile(void) {pLevels=NULL;nLevels=current=0;};
+	inline ~FlowProfile(void) {if(pLevels!=NULL) delete []pLevels;};
+	inline void clear(void);
+	// the stages that follow are recorded in the level k, of size width x height
+	inline void beginLevel(int k,int width,int height);
+	inline void add(Stage stage,double seconds);
+	inline Record& record(void) {return level(current);};
+
+	inline int nlevels(void) const {return nLevels;};
+	inline Record& level(int k);
+	inline const Record& level(int k) const {return pLevels[k];};
+	inline const Record& setup(void) const {return Setup;};
+	inline double totalTime(void) const;
+	inline void print(std::ostream& out=std::cout) const;
+
+	static inline const char* stageName(Stage stage);
+	static inline double now(void);
+};
+
+inline void FlowProfile::clear(void)
+{
+	Setup.clear();
+	for(int k=0;k<nLevels;k++)
+		pLevels[k].clear();
+	current=0;
+}
+
+inline void FlowProfile::beginLevel(int k,int width,int height)
+{
+	current=k;
+	Record& rec=level(k);
+	rec.width=width;
+	rec.height=height;
+}
+
+inline void FlowProfile::add(Stage stage,double seconds)
+{
+	Record& rec=(stage==Pyramid || stage==Features)?Setup:record();
+	rec.time[stage]+=seconds;
+	rec.calls[stage]++;
+}
+
+//---------------------------------------------------------------------------------------
+// the records grow with the number of levels that have been seen
+//---------------------------------------------------------------------------------------
+inline FlowProfile::Record& FlowProfile::level(int k)
+{
+	if(k>=nLevels)
+	{
+		Record* pNewLevels=new Record[k+1];
+		for(int i=0;i<nLevels;i++)
+			pNewLevels[i]=pLevels[i];
+		if(pLevels!=NULL)
+			delete []pLevels;
+		pLevels=pNewLevels;
+		nLevels=k+1;
+	}
+	return pLevels[k];
+}
+
+inline double FlowProfile::totalTime(void) const
+{
+	double total=Setup.totalTime();
+	for(int k=0;k<nLevels;k++)
+		total+=pLevels[k].totalTime();
+	return total;
+}
+
+//---------------------------------------------------------------------------------------
+// one line per level, from the coarsest to the finest, with the time of each stage in ms
+//---------------------------------------------------------------------------------------
+inline void FlowProfile::print(std::ostream& out) const
+{
+	std::ios::fmtflags flags=out.flags();
+	std::streamsize precision=out.precision();
+	out<<std::fixed<<std::setprecision(2);
+	out<<"setup:";
+	for(int i=0;i<nStages;i++)
+		if(Setup.calls[i]>0)
+			out<<" "<<stageName((Stage)i)<<" "<<Setup.time[i]*1000<<"ms";
+	out<<std::endl;
+	for(int k=nLevels-1;k>=0;k--)
+	{
+		const Record& rec=pLevels[k];
+		if(rec.calls[Derivatives]==0)
+			continue;
+		out<<"level "<<k<<" ("<<rec.width<<"x"<<rec.height<<"): "<<rec.totalTime()*1000<<"ms, outer "<<rec.nOuterIterations
+			<<", inner "<<rec.nInnerIterations<<", solver "<<rec.nSolverIterations;
+		if(rec.residual>=0)
+			out<<", residual "<<std::scientific<<rec.residual<<std::fixed;
+		out<<std::endl<<"  ";
+		for(int i=0;i<nStages;i++)
+			if(rec.calls[i]>0)
+				out<<" "<<stageName((Stage)i)<<" "<<rec.time[i]*1000<<"ms/"<<rec.calls[i];
+		out<<std::endl;
+	}
+	out<<"total: "<<totalTime()*1000<<"ms"<<std::endl;
+	out.flags(flags);
+	out.precision(precision);
+}
+
+inline const char* FlowProfile::stageName(Stage stage)
+{
+	static const char* names[nStages]={"pyramid","features","upsampling","derivatives","weights","smoothing","system","solver","warping"};
+	return names[stage];
+}
+
+inline double FlowProfile::now(void)
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec+ts.tv_nsec*1E-9;
+}
+
+//---------------------------------------------------------------------------------------
+// the probe of a stage: start() ... stop(stage) adds the time in between to the profile
+// Without a profile the probe only tests a pointer, and with NO_FLOW_PROFILE enabled()
+// is constant and the probes are removed by the compiler.
+//---------------------------------------------------------------------------------------
+class FlowProbe
+{
+private:
+	FlowProfile* pProfile;
+	double Start;
+public:
+	inline FlowProbe(FlowProfile* profile) {pProfile=profile;Start=0;};
+	inline bool enabled(void) const
+	{
+#ifdef NO_FLOW_PROFILE
+		return false;
+#else
+		return pProfile!=NULL;
+#endif
+	};
+	inline FlowProfile& profile(void) {return *pProfile;};
+	inline void start(void) {if(enabled()) Start=FlowProfile::now();};
+	inline void stop(FlowProfile::Stage stage) {if(enabled()) pProfile->add(stage,FlowProfile::now()-Start);};
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "FlowWorkspace.h"
+#include "ThreadPool.h"
+
+template <class T>
+FlowWorkspace<T>::FlowWorkspace(void)
+{
+	pRou=pPartial=pRows=NULL;
+	nRou=nPartial=nRows=0;
+}
+
+template <class T>
+FlowWorkspace<T>::~FlowWorkspace(void)
+{
+	if(pRou!=NULL)
+		delete []pRou;
+	if(pPartial!=NULL)
+		delete []pPartial;
+	if(pRows!=NULL)
+		delete []pRows;
+}
+
+//---------------------------------------------------------------------------------------
+// make the images width x height, the images that already have this size are kept
+// (and not cleared)
+//---------------------------------------------------------------------------------------
+template <class T>
+void FlowWorkspace<T>::allocate(int width,int height,int nCGIterations)
+{
+	Image<T>* images[]={&du,&dv,&duLast,&dvLast,&Phi_1st,&imdxy,&imdx2,&imdy2,&imdtdx,&imdtdy,&A11,&A12,&A22,&b1,&b2,
+								&r1,&r2,&p1,&p2,&pn1,&pn2,&q1,&q2,&M11,&M12,&M22,&z1,&z2};
+	for(int i=0;i<(int)(sizeof(images)/sizeof(Image<T>*));i++)
+		if(images[i]->width()!=width || images[i]->height()!=height || images[i]->nchannels()!=1)
+			images[i]->allocate(width,height);
+
+	if(nRou<nCGIterations)
+	{
+		if(pRou!=NULL)
+			delete []pRou;
+		nRou=nCGIterations;
+		pRou=new double[nRou];
+	}
+	int bands=ThreadPool::nbands(height)*3;
+	if(nPartial<bands)
+	{
+		if(pPartial!=NULL)
+			delete []pPartial;
+		nPartial=bands;
+		pPartial=new double[nPartial];
+	}
+	// the 3x3 smoothing needs 2*1+2 rows per band
+	int rows=ThreadPool::nbands(height)*4*width;
+	if(nRows<rows)
+	{
+		if(pRows!=NULL)
+			delete []pRows;
+		nRows=rows;
+		pRows=new double[nRows];
+	}
+}
+
+template <class T>
+pthread_key_t FlowCache<T>::key;
+
+template <class T>
+pthread_once_t FlowCache<T>::once=PTHREAD_ONCE_INIT;
+
+template <class T>
+FlowCache<T>::FlowCache(void)
+{
+	for(int i=0;i<nPools;i++)
+	{
+		pPools[i]=NULL;
+		nPoolThreads[i]=0;
+	}
+	pFeatures[0]=pFeatures[1]=NULL;
+	nFeatures[0]=nFeatures[1]=0;
+	for(int i=0;i<nWorkspaceSets;i++)
+	{
+		pWorkspaces[i]=NULL;
+		nWorkspaces[i]=0;
+	}
+}
+
+template <class T>
+FlowCache<T>::~FlowCache(void)
+{
+	for(int k=0;k<2;k++)
+		if(pFeatures[k]!=NULL)
+			delete []pFeatures[k];
+	for(int i=0;i<nWorkspaceSets;i++)
+		if(pWorkspaces[i]!=NULL)
+			delete []pWorkspaces[i];
+	for(int i=0;i<nPools;i++)
+		if(pPools[i]!=NULL)
+			delete pPools[i];
+}
+
+template <class T>
+void FlowCache<T>::createKey(void)
+{
+	pthread_key_create(&key,destroy);
+}
+
+template <class T>
+void FlowCache<T>::destroy(void* cache)
+{
+	delete (FlowCache<T>*)cache;
+}
+
+template <class T>
+FlowCache<T>& FlowCache<T>::get(void)
+{
+	pthread_once(&once,createKey);
+	FlowCache<T>* cache=(FlowCache<T>*)pthread_getspecific(key);
+	if(cache==NULL)
+	{
+		cache=new FlowCache<T>;
+		pthread_setspecific(key,cache);
+	}
+	return *cache;
+}
+
+template <class T>
+ThreadPool& FlowCache<T>::pool(int nThreads,int index)
+{
+	// all the cores, so that 0 and the number of cores share the pool
+	if(nThreads<=0)
+		nThreads=ThreadPool::ncores();
+	if(pPools[index]==NULL || nPoolThreads[index]!=nThreads)
+	{
+		if(pPools[index]!=NULL)
+			delete pPools[index];
+		pPools[index]=new ThreadPool(nThreads);
+		nPoolThreads[index]=nThreads;
+	}
+	return *pPools[index];
+}
+
+template <class T>
+Image<T>* FlowCache<T>::features(int k,int nLevels)
+{
+	if(nFeatures[k]!=nLevels)
+	{
+		if(pFeatures[k]!=NULL)
+			delete []pFeatures[k];
+		nFeatures[k]=nLevels;
+		pFeatures[k]=new Image<T>[nLevels];
+	}
+	return pFeatures[k];
+}
+
+template <class T>
+FlowWorkspace<T>* FlowCache<T>::workspaces(int nLevels,int index)
+{
+	if(nWorkspaces[index]!=nLevels)
+	{
+		if(pWorkspaces[index]!=NULL)
+			delete []pWorkspaces[index];
+		nWorkspaces[index]=nLevels;
+		pWorkspaces[index]=new FlowWorkspace<T>[nLevels];
+	}
+	return pWorkspaces[index];
+}
@@ -0,0 +1,100 @@
+#ifndef _FlowWorkspace_h
+#define _FlowWorkspace_h
+
+#include "Image.h"
+#include "MultigridSolver.h"
+#include "GaussianPyramid.h"
+#include "ThreadPool.h"
+
+//---------------------------------------------------------------------------------------
+// the temporary images of OpticalFlow::SmoothFlowPDE() at one pyramid level
+// allocate() only reallocates the images whose size has changed, so a workspace that is
+// kept across the fixed point iterations and across the calls at the same level (e.g. by
+// OpticalFlowStream) lets the solver run without any heap allocation.
+// T is the type of the pixels (float or double).
+//---------------------------------------------------------------------------------------
+template <class T>
+class FlowWorkspace
+{
+public:
+	Image<T> mask,imdx,imdy,imdt;
+	Image<T> du,dv,Phi_1st;
+	// du and dv of the last inner fixed point iteration
+	Image<T> duLast,dvLast;
+	Image<T> imdxy,imdx2,imdy2,imdtdx,imdtdy;
+	Image<T> A11,A12,A22,b1,b2;
+	// conjugate gradient, pn1 and pn2 are the other buffers of the direction p1,p2
+	Image<T> r1,r2,p1,p2,pn1,pn2,q1,q2;
+	// block-Jacobi preconditioner
+	Image<T> M11,M12,M22,z1,z2;
+	// scratch images of getDxs()
+	Image<T> smooth1,smooth2,filterBuffer;
+	// the multigrid hierarchy
+	MultigridSolver<T> mgSolver;
+	// the flow of this level and the second image warped by it
+	Image<T> vx,vy,warpIm2;
+	// the upsampling of the flow to this level
+	ResizePlan flowPlan;
+private:
+	double* pRou;
+	double* pPartial;
+	double* pRows;
+	int nRou,nPartial,nRows;
+	// not copyable
+	FlowWorkspace(const FlowWorkspace<T>& other);
+	FlowWorkspace<T>& operator=(const FlowWorkspace<T>& other);
+public:
+	FlowWorkspace(void);
+	~FlowWorkspace(void);
+	void allocate(int width,int height,int nCGIterations);
+	// the step sizes of conjugate gradient, and the per-band partial sums of its three reductions
+	inline double* rou() {return pRou;};
+	inline double* partial() {return pPartial;};
+	// the per-band rows of the separable smoothing of the system
+	inline double* rows() {return pRows;};
+};
+
+//---------------------------------------------------------------------------------------
+// what OpticalFlow::Coarse2FineFlow() keeps across the calls of a thread: the thread pool,
+// the pyramids and the features of the two images, and the workspaces of the levels
+// (OpticalFlow::Coarse2FineFlowBidirectional() keeps a pool and the workspaces of each
+// direction as well)
+// Each thread that calls it has its own cache, created on its first call and deleted when
+// the thread exits, so the calls on images of the same size as the last one do not
+// allocate; the memory of the last call is kept until then.
+//---------------------------------------------------------------------------------------
+template <class T>
+class FlowCache
+{
+public:
+	enum{nPools=3,nWorkspaceSets=2};
+	GaussianPyramid<T> Pyramids[2];
+	// the scratch of OpticalFlow::im2feature() for interleaved images
+	Image<T> FeatureBuffer;
+private:
+	ThreadPool* pPools[nPools];
+	int nPoolThreads[nPools];
+	Image<T>* pFeatures[2];
+	int nFeatures[2];
+	FlowWorkspace<T>* pWorkspaces[nWorkspaceSets];
+	int nWorkspaces[nWorkspaceSets];
+	static pthread_key_t key;
+	static pthread_once_t once;
+	static void createKey(void);
+	static void destroy(void* cache);
+	// not copyable
+	FlowCache(const FlowCache<T>& other);
+	FlowCache<T>& operator=(const FlowCache<T>& other);
+public:
+	FlowCache(void);
+	~FlowCache(void);
+	// the cache of the calling thread
+	static FlowCache<T>& get(void);
+	// the pool index of nThreads threads (all the cores if nThreads<=0), recreated if nThreads changes
+	ThreadPool& pool(int nThreads,int index=0);
+	// the features of the levels of Pyramids[k], and the set index of workspaces of the levels
+	Image<T>* features(int k,int nLevels);
+	FlowWorkspace<T>* workspaces(int nLevels,int index=0);
+};
+
+#endif
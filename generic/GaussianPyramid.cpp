@@ -1,15 +1,21 @@
 #include "GaussianPyramid.h"
 #include "math.h"
 
-GaussianPyramid::GaussianPyramid(void)
+template <class T>
+GaussianPyramid<T>::GaussianPyramid(void)
 {
 	ImPyramid=NULL;
+	pPlans=NULL;
+	nPlans=0;
 }
 
-GaussianPyramid::~GaussianPyramid(void)
+template <class T>
+GaussianPyramid<T>::~GaussianPyramid(void)
 {
 	if(ImPyramid!=NULL)
 		delete []ImPyramid;
+	if(pPlans!=NULL)
+		delete []pPlans;
 }
 
 //---------------------------------------------------------------------------------------
@@ -41,39 +47,118 @@ GaussianPyramid::~GaussianPyramid(void)
 // function to construct the pyramid
 // this is the fast way
 //---------------------------------------------------------------------------------------
-void GaussianPyramid::ConstructPyramid(const DImage &image, double ratio, int minWidth)
+template <class T>
+void GaussianPyramid<T>::ConstructPyramid(const ::Image<T> &image, double ratio, int minWidth)
+{
+	initialize(image,ratio,minWidth);
+	for(int i=1;i<nLevels;i++)
+		constructLevel(i);
+}
+
+template <class T>
+void GaussianPyramid<T>::ConstructPyramid(const ::Image<T> &image, double ratio, int minWidth, ThreadPool& pool)
+{
+	initialize(image,ratio,minWidth);
+	GaussianPyramid<T>* pyramids[1]={this};
+	constructLevels(pyramids,1,pool);
+}
+
+template <class T>
+void GaussianPyramid<T>::ConstructPyramids(GaussianPyramid<T>& pyramid1, GaussianPyramid<T>& pyramid2, const ::Image<T>& image1, const ::Image<T>& image2,
+															  double ratio, int minWidth, ThreadPool& pool)
+{
+	pyramid1.initialize(image1,ratio,minWidth);
+	pyramid2.initialize(image2,ratio,minWidth);
+	GaussianPyramid<T>* pyramids[2]={&pyramid1,&pyramid2};
+	constructLevels(pyramids,2,pool);
+}
+
+//---------------------------------------------------------------------------------------
+// allocate the levels and copy the image to the level 0
+//---------------------------------------------------------------------------------------
+template <class T>
+void GaussianPyramid<T>::initialize(const ::Image<T> &image, double ratio, int minWidth)
 {
 	// the ratio cannot be arbitrary numbers
 	if(ratio>0.98 || ratio<0.4)
 		ratio=0.75;
+	Ratio=ratio;
 	// first decide how many levels
 	nLevels=log((double)minWidth/image.width())/log(ratio);
-	if(ImPyramid!=NULL)
-		delete []ImPyramid;
-	ImPyramid=new DImage[nLevels];
+	nGroupLevels=log(0.25)/log(ratio);
+	// the levels and their plans are kept while the number of levels does not change, and
+	// the levels are only reallocated if their size changes
+	if(nPlans!=nLevels)
+	{
+		if(ImPyramid!=NULL)
+			delete []ImPyramid;
+		ImPyramid=new ::Image<T>[nLevels];
+		if(pPlans!=NULL)
+			delete []pPlans;
+		nPlans=nLevels;
+		pPlans=new ResizePlan[nPlans];
+	}
 	ImPyramid[0].copyData(image);
-	double baseSigma=(1/ratio-1);
-	int n=log(0.25)/log(ratio);
+}
+
+//---------------------------------------------------------------------------------------
+// the level i is smoothed and downsampled from the image if i<=nGroupLevels, and from
+// the level i-nGroupLevels otherwise
+//---------------------------------------------------------------------------------------
+template <class T>
+void GaussianPyramid<T>::constructLevel(int i)
+{
+	const ::Image<T>& image=ImPyramid[0];
+	double baseSigma=(1/Ratio-1);
+	int n=nGroupLevels;
 	double nSigma=baseSigma*n;
-	for(int i=1;i<nLevels;i++)
+	if(i<=n)
 	{
-		DImage foo;
-		if(i<=n)
-		{
-			double sigma=baseSigma*i;
-			image.GaussianSmoothing(foo,sigma,sigma*3);
-			foo.imresize(ImPyramid[i],pow(ratio,i));
-		}
-		else
-		{
-			ImPyramid[i-n].GaussianSmoothing(foo,nSigma,nSigma*3);
-			double rate=(double)pow(ratio,i)*image.width()/foo.width();
-			foo.imresize(ImPyramid[i],rate);
-		}
+		double sigma=baseSigma*i;
+		image.GaussianSmoothResize(ImPyramid[i],sigma,sigma*3,pow(Ratio,i),pPlans[i]);
+	}
+	else
+	{
+		const ::Image<T>& source=ImPyramid[i-n];
+		double rate=(double)pow(Ratio,i)*image.width()/source.width();
+		source.GaussianSmoothResize(ImPyramid[i],nSigma,nSigma*3,rate,pPlans[i]);
 	}
 }
 
-void GaussianPyramid::displayTop(const char *filename)
+//---------------------------------------------------------------------------------------
+// the levels of the pyramids as tasks of the thread pool, in groups of independent levels
+//---------------------------------------------------------------------------------------
+template <class T>
+class PyramidLevelKernel
+{
+public:
+	GaussianPyramid<T>** pyramids;
+	int nPyramids,firstLevel;
+	// the tasks are the levels of the group from the largest, each for all the pyramids
+	void operator()(int task,int)
+	{
+		GaussianPyramid<T>* pyramid=pyramids[task%nPyramids];
+		int level=firstLevel+task/nPyramids;
+		if(level<pyramid->nlevels())
+			pyramid->constructLevel(level);
+	}
+};
+
+template <class T>
+void GaussianPyramid<T>::constructLevels(GaussianPyramid<T>** pyramids, int nPyramids, ThreadPool& pool)
+{
+	PyramidLevelKernel<T> kernel;
+	kernel.pyramids=pyramids;
+	kernel.nPyramids=nPyramids;
+	int maxLevels=0,n=pyramids[0]->nGroupLevels;
+	for(int k=0;k<nPyramids;k++)
+		maxLevels=__max(maxLevels,pyramids[k]->nLevels);
+	for(kernel.firstLevel=1;kernel.firstLevel<maxLevels;kernel.firstLevel+=n)
+		pool.runTasks(kernel,nPyramids*__min(n,maxLevels-kernel.firstLevel));
+}
+
+template <class T>
+void GaussianPyramid<T>::displayTop(const char *filename)
 {
 	ImPyramid[nLevels-1].imwrite(filename);
 }
\ No newline at end of file
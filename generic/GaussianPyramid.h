@@ -2,19 +2,43 @@
 #define _GaussianPyramid_h
 
 #include "Image.h"
+#include "ThreadPool.h"
 
+//---------------------------------------------------------------------------------------
+// Gaussian pyramid of an image, T is the type of the pixels (float or double)
+// (the member function Image() hides the class template, hence ::Image<T>)
+// The levels up to a quarter of the size are computed from the image, the levels below
+// from the level that is four times larger, so the levels of a group are independent and
+// can be built concurrently, for one or two pyramids, by a thread pool.
+//---------------------------------------------------------------------------------------
+template <class T>
+class PyramidLevelKernel;
+
+template <class T>
 class GaussianPyramid
 {
+	friend class PyramidLevelKernel<T>;
 private:
-	DImage* ImPyramid;
-	int nLevels;
+	::Image<T>* ImPyramid;
+	// the sampling of each level, kept while the size of the image does not change
+	ResizePlan* pPlans;
+	int nLevels,nPlans;
+	double Ratio;
+	int nGroupLevels;		// the number of levels up to a quarter of the size
+	void initialize(const ::Image<T>& image,double ratio,int minWidth);
+	void constructLevel(int level);
+	static void constructLevels(GaussianPyramid<T>** pyramids,int nPyramids,ThreadPool& pool);
 public:
 	GaussianPyramid(void);
 	~GaussianPyramid(void);
-	void ConstructPyramid(const DImage& image,double ratio=0.8,int minWidth=30);
+	void ConstructPyramid(const ::Image<T>& image,double ratio=0.8,int minWidth=30);
+	void ConstructPyramid(const ::Image<T>& image,double ratio,int minWidth,ThreadPool& pool);
+	// the pyramids of the two images of a pair, built concurrently
+	static void ConstructPyramids(GaussianPyramid<T>& pyramid1,GaussianPyramid<T>& pyramid2,const ::Image<T>& image1,const ::Image<T>& image2,
+												double ratio,int minWidth,ThreadPool& pool);
 	void displayTop(const char* filename);
 	inline int nlevels() const {return nLevels;};
-	inline DImage& Image(int index) {return ImPyramid[index];};
+	inline ::Image<T>& Image(int index) {return ImPyramid[index];};
 };
 
-#endif
\ No newline at end of file
+#endif
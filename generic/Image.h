@@ -25,6 +25,9 @@ protected:
 	int imWidth,imHeight,nChannels;
 	int nPixels,nElements;
 	bool IsDerivativeImage;
+	bool IsPlanar;
+	// the data is an external buffer, that is not freed (see attachPlanar())
+	bool IsView;
 public:
 	Image(void);
 	Image(int width,int height,int nchannels=1);
@@ -54,6 +57,19 @@ public:
 
 	void im2double();
 
+	// function to copy from/to planar (channel by channel) buffers with arbitrary strides
+	template <class T1>
+	void importPlanar(const T1* pSrcData,int width,int height,int nchannels,long cStride,long hStride,long wStride);
+
+	template <class T1>
+	void exportPlanar(T1* pDstData,long cStride,long hStride,long wStride) const;
+
+	// function to view a contiguous planar buffer (channel by channel, row by row) without
+	// copying it; the buffer must outlive the view, and is not freed. An allocation or a
+	// change of layout replaces the view with data of the image.
+	void attachPlanar(T* pSrcData,int width,int height,int nchannels);
+	inline bool isView() const {return IsView;};
+
 	// function to access the member variables
 	inline T*& data(){return pData;};
 	inline const T*& data() const{return (const T*&)pData;};
@@ -65,6 +81,15 @@ public:
 	inline bool isDerivativeImage() const {return IsDerivativeImage;};
 	bool IsFloat () const;
 
+	// planar layout: the channels are stored one after another, each as a contiguous plane
+	// interleaved layout (default): the channels of each pixel are stored together
+	inline bool isPlanar() const {return IsPlanar;};
+	void setPlanar(bool isPlanar=true);
+	inline int nplanes() const {return IsPlanar?nChannels:1;};
+	inline int planechannels() const {return IsPlanar?1:nChannels;};
+	inline T* plane(int k) {return pData+k*nPixels;};
+	inline const T* plane(int k) const {return pData+k*nPixels;};
+
 	template <class T1>
 	bool matchDimension  (const Image<T1>& image) const;
 
@@ -79,6 +104,11 @@ public:
 	template <class T1>
 	void imresize(Image<T1>& result,double ratio);
 	void imresize(int dstWidth,int dstHeight);
+	// the same with the sampling of plan, which is prepared for the sizes if needed
+	void imresize(int dstWidth,int dstHeight,ResizePlan& plan);
+	// the same into result, which is only reallocated if its size changes
+	template <class T1>
+	void imresize(Image<T1>& result,int dstWidth,int dstHeight,ResizePlan& plan) const;
 
 #ifndef MATLAB_FOUND
 	virtual bool imread(const QString& filename);
@@ -106,6 +136,12 @@ public:
 	template <class T1>
 	void GaussianSmoothing(Image<T1>& image,double sigma,int fsize) const;
 
+	// the same as GaussianSmoothing() followed by imresize(image,ratio), without the smoothed image
+	template <class T1>
+	void GaussianSmoothResize(Image<T1>& image,double sigma,int fsize,double ratio) const;
+	template <class T1>
+	void GaussianSmoothResize(Image<T1>& image,double sigma,int fsize,double ratio,ResizePlan& plan) const;
+
 	template <class T1>
 	void smoothing(Image<T1>& image,double factor=4);
 
@@ -130,6 +166,10 @@ public:
 	template <class T1>
 	void imfilter_hv(Image<T1>& image,double* hfilter,int hfsize,double* vfilter,int vfsize) const;
 
+	// the same, with the result of the horizontal filtering stored in buffer
+	template <class T1>
+	void imfilter_hv(Image<T1>& image,double* hfilter,int hfsize,double* vfilter,int vfsize,Image<T1>& buffer) const;
+
 	// function to desaturating
 	template <class T1>
 	void desaturate(Image<T1>& image) const;
@@ -220,6 +260,8 @@ Image<T>::Image()
 	pData=NULL;
 	imWidth=imHeight=nChannels=nPixels=nElements=0;
 	IsDerivativeImage=false;
+	IsPlanar=false;
+	IsView=false;
 }
 
 //------------------------------------------------------------------------------------------
@@ -237,12 +279,16 @@ Image<T>::Image(int width,int height,int nchannels)
 	if(nElements>0)
 		memset(pData,0,sizeof(T)*nElements);
 	IsDerivativeImage=false;
+	IsPlanar=false;
+	IsView=false;
 }
 
 template <class T>
 Image<T>::Image(const T& value,int _width,int _height,int _nchannels)
 {
 	pData=NULL;
+	IsPlanar=false;
+	IsView=false;
 	allocate(_width,_height,_nchannels);
 	setValue(value);
 }
@@ -252,6 +298,8 @@ template <class T>
 Image<T>::Image(const QImage& image)
 {
 	pData=NULL;
+	IsPlanar=false;
+	IsView=false;
 	imread(image);
 }
 #endif
@@ -274,6 +322,7 @@ template <class T>
 template <class T1>
 void Image<T>::allocate(const Image<T1> &other)
 {
+	IsPlanar=other.isPlanar();
 	allocate(other.width(),other.height(),other.nchannels());
 }
 
@@ -284,6 +333,8 @@ template <class T>
 Image<T>::Image(const Image<T>& other)
 {
 	pData=NULL;
+	nElements=0;
+	IsView=false;
 	copyData(other);
 }
 
@@ -293,7 +344,7 @@ Image<T>::Image(const Image<T>& other)
 template <class T>
 Image<T>::~Image()
 {
-	if(pData!=NULL)
+	if(pData!=NULL && !IsView)
 		delete []pData;
 }
 
@@ -303,9 +354,10 @@ Image<T>::~Image()
 template <class T>
 void Image<T>::clear()
 {
-	if(pData!=NULL)
+	if(pData!=NULL && !IsView)
 		delete []pData;
 	pData=NULL;
+	IsView=false;
 	imWidth=imHeight=nChannels=nPixels=nElements=0;
 }
 
@@ -345,14 +397,17 @@ void Image<T>::copyData(const Image<T>& other)
 	nChannels=other.nChannels;
 	nPixels=other.nPixels;
 	IsDerivativeImage=other.IsDerivativeImage;
+	IsPlanar=other.IsPlanar;
 
-	if(nElements!=other.nElements)
+	// a view is replaced by a copy, and its buffer is left as is
+	if(nElements!=other.nElements || IsView)
 	{
 		nElements=other.nElements;		
-		if(pData!=NULL)
+		if(pData!=NULL && !IsView)
 			delete []pData;
 		pData=NULL;
 		pData=new T[nElements];
+		IsView=false;
 	}
 	if(nElements>0)
 		memcpy(pData,other.pData,sizeof(T)*nElements);
@@ -370,6 +425,7 @@ void Image<T>::copy(const Image<T1>& other)
 	computeDimension();
 
 	IsDerivativeImage=other.isDerivativeImage();
+	IsPlanar=other.isPlanar();
 
 	pData=NULL;
 	pData=new T[nElements];
@@ -386,6 +442,54 @@ void Image<T>::im2double()
 			pData[i]/=255;
 }
 
+//------------------------------------------------------------------------------------------
+// copy from a planar buffer, where pixel (i,j) of channel k is at k*cStride+i*hStride+j*wStride
+//------------------------------------------------------------------------------------------
+template <class T>
+template <class T1>
+void Image<T>::importPlanar(const T1* pSrcData,int width,int height,int nchannels,long cStride,long hStride,long wStride)
+{
+	if(imWidth!=width || imHeight!=height || nChannels!=nchannels)
+		allocate(width,height,nchannels);
+	IsDerivativeImage=false;
+	if(IsPlanar)
+		for(int k=0;k<nChannels;k++)
+			ImageProcessing::planar2interleaved(pSrcData+k*cStride,plane(k),imWidth,imHeight,1,0,hStride,wStride);
+	else
+		ImageProcessing::planar2interleaved(pSrcData,pData,imWidth,imHeight,nChannels,cStride,hStride,wStride);
+}
+
+//------------------------------------------------------------------------------------------
+// copy to a planar buffer with the same layout as importPlanar()
+//------------------------------------------------------------------------------------------
+template <class T>
+template <class T1>
+void Image<T>::exportPlanar(T1* pDstData,long cStride,long hStride,long wStride) const
+{
+	if(IsPlanar)
+		for(int k=0;k<nChannels;k++)
+			ImageProcessing::interleaved2planar(plane(k),pDstData+k*cStride,imWidth,imHeight,1,0,hStride,wStride);
+	else
+		ImageProcessing::interleaved2planar(pData,pDstData,imWidth,imHeight,nChannels,cStride,hStride,wStride);
+}
+
+//------------------------------------------------------------------------------------------
+// view a planar buffer, in the layout of plane()
+//------------------------------------------------------------------------------------------
+template <class T>
+void Image<T>::attachPlanar(T* pSrcData,int width,int height,int nchannels)
+{
+	clear();
+	imWidth=width;
+	imHeight=height;
+	nChannels=nchannels;
+	computeDimension();
+	pData=pSrcData;
+	IsView=true;
+	IsPlanar=true;
+	IsDerivativeImage=false;
+}
+
 //------------------------------------------------------------------------------------------
 // override equal operator
 //------------------------------------------------------------------------------------------
@@ -405,6 +509,29 @@ bool Image<T>::IsFloat() const
 		return false;
 }
 
+//------------------------------------------------------------------------------------------
+// function to switch between the interleaved and the planar layout, converting the data
+//------------------------------------------------------------------------------------------
+template <class T>
+void Image<T>::setPlanar(bool isPlanar)
+{
+	if(IsPlanar==isPlanar)
+		return;
+	if(pData!=NULL && nChannels>1)
+	{
+		T* pDstData=new T[nElements];
+		if(isPlanar)
+			ImageProcessing::interleaved2planar(pData,pDstData,imWidth,imHeight,nChannels,nPixels,imWidth,1);
+		else
+			ImageProcessing::planar2interleaved(pData,pDstData,imWidth,imHeight,nChannels,nPixels,imWidth,1);
+		if(!IsView)
+			delete []pData;
+		pData=pDstData;
+		IsView=false;
+	}
+	IsPlanar=isPlanar;
+}
+
 template <class T>
 template <class T1>
 bool Image<T>::matchDimension(const Image<T1>& image) const
@@ -461,10 +588,13 @@ bool Image<T>::imresize(double ratio)
 	DstHeight=(double)imHeight*ratio;
 	pDstData=new T[DstWidth*DstHeight*nChannels];
 
-	ImageProcessing::ResizeImage(pData,pDstData,imWidth,imHeight,nChannels,ratio);
+	for(int k=0;k<nplanes();k++)
+		ImageProcessing::ResizeImage(plane(k),pDstData+k*DstWidth*DstHeight,imWidth,imHeight,planechannels(),ratio);
 
-	delete []pData;
+	if(!IsView)
+		delete []pData;
 	pData=pDstData;
+	IsView=false;
 	imWidth=DstWidth;
 	imHeight=DstHeight;
 	computeDimension();
@@ -478,19 +608,40 @@ void Image<T>::imresize(Image<T1>& result,double ratio)
 	int DstWidth,DstHeight;
 	DstWidth=(double)imWidth*ratio;
 	DstHeight=(double)imHeight*ratio;
+	result.setPlanar(IsPlanar);
 	if(result.width()!=DstWidth || result.height()!=DstHeight || result.nchannels()!=nChannels)
 		result.allocate(DstWidth,DstHeight,nChannels);
-	ImageProcessing::ResizeImage(pData,result.data(),imWidth,imHeight,nChannels,ratio);
+	for(int k=0;k<nplanes();k++)
+		ImageProcessing::ResizeImage(plane(k),result.plane(k),imWidth,imHeight,planechannels(),ratio);
 }
 
 template <class T>
 void Image<T>::imresize(int dstWidth,int dstHeight)
 {
-	DImage foo(dstWidth,dstHeight,nChannels);
-	ImageProcessing::ResizeImage(pData,foo.data(),imWidth,imHeight,nChannels,dstWidth,dstHeight);
+	ResizePlan plan;
+	imresize(dstWidth,dstHeight,plan);
+}
+
+template <class T>
+void Image<T>::imresize(int dstWidth,int dstHeight,ResizePlan& plan)
+{
+	Image<T> foo;
+	imresize(foo,dstWidth,dstHeight,plan);
 	copyData(foo);
 }
 
+template <class T>
+template <class T1>
+void Image<T>::imresize(Image<T1>& result,int dstWidth,int dstHeight,ResizePlan& plan) const
+{
+	result.setPlanar(IsPlanar);
+	if(result.width()!=dstWidth || result.height()!=dstHeight || result.nchannels()!=nChannels)
+		result.allocate(dstWidth,dstHeight,nChannels);
+	plan.prepare(imWidth,imHeight,dstWidth,dstHeight);
+	for(int k=0;k<nplanes();k++)
+		plan.resize(plane(k),result.plane(k),planechannels());
+}
+
 //------------------------------------------------------------------------------------------
 // function to load the image
 //------------------------------------------------------------------------------------------
@@ -544,26 +695,33 @@ template <class T>
 template <class T1>
 void Image<T>::dx(Image<T1>& result,bool IsAdvancedFilter) const
 {
+	result.setPlanar(IsPlanar);
 	if(matchDimension(result)==false)
 		result.allocate(imWidth,imHeight,nChannels);
 	result.reset();
 	result.setDerivative();
-	T1*& data=result.data();
-	int i,j,k,offset;
+	int i,j,k,l,offset;
+	int nc=planechannels();
 	if(IsAdvancedFilter==false)
-		for(i=0;i<imHeight;i++)
-			for(j=0;j<imWidth-1;j++)
-			{
-				offset=i*imWidth+j;
-				for(k=0;k<nChannels;k++)
-					data[offset*nChannels+k]=(T1)pData[(offset+1)*nChannels+k]-pData[offset*nChannels+k];
-			}
+		for(l=0;l<nplanes();l++)
+		{
+			const T* pSrc=plane(l);
+			T1* data=result.plane(l);
+			for(i=0;i<imHeight;i++)
+				for(j=0;j<imWidth-1;j++)
+				{
+					offset=i*imWidth+j;
+					for(k=0;k<nc;k++)
+						data[offset*nc+k]=(T1)pSrc[(offset+1)*nc+k]-pSrc[offset*nc+k];
+				}
+		}
 	else
 	{
 		double xFilter[5]={1,-8,0,8,-1};
 		for(i=0;i<5;i++)
 			xFilter[i]/=12;
-		ImageProcessing::hfiltering(pData,data,imWidth,imHeight,nChannels,xFilter,2);
+		for(l=0;l<nplanes();l++)
+			ImageProcessing::hfiltering(plane(l),result.plane(l),imWidth,imHeight,nc,xFilter,2);
 	}
 }
 
@@ -583,25 +741,32 @@ template <class T>
 template <class T1>
 void Image<T>::dy(Image<T1>& result,bool IsAdvancedFilter) const
 {
+	result.setPlanar(IsPlanar);
 	if(matchDimension(result)==false)
 		result.allocate(imWidth,imHeight,nChannels);
 	result.setDerivative();
-	T1*& data=result.data();
-	int i,j,k,offset;
+	int i,j,k,l,offset;
+	int nc=planechannels();
 	if(IsAdvancedFilter==false)
-		for(i=0;i<imHeight-1;i++)
-			for(j=0;j<imWidth;j++)
-			{
-				offset=i*imWidth+j;
-				for(k=0;k<nChannels;k++)
-					data[offset*nChannels+k]=(T1)pData[(offset+imWidth)*nChannels+k]-pData[offset*nChannels+k];
-			}
+		for(l=0;l<nplanes();l++)
+		{
+			const T* pSrc=plane(l);
+			T1* data=result.plane(l);
+			for(i=0;i<imHeight-1;i++)
+				for(j=0;j<imWidth;j++)
+				{
+					offset=i*imWidth+j;
+					for(k=0;k<nc;k++)
+						data[offset*nc+k]=(T1)pSrc[(offset+imWidth)*nc+k]-pSrc[offset*nc+k];
+				}
+		}
 	else
 	{
 		double yFilter[5]={1,-8,0,8,-1};
 		for(i=0;i<5;i++)
 			yFilter[i]/=12;
-		ImageProcessing::vfiltering(pData,data,imWidth,imHeight,nChannels,yFilter,2);
+		for(l=0;l<nplanes();l++)
+			ImageProcessing::vfiltering(plane(l),result.plane(l),imWidth,imHeight,nc,yFilter,2);
 	}
 }
 
@@ -625,20 +790,39 @@ void Image<T>::GaussianSmoothing(Image<T1>& image,double sigma,int fsize) const
 	// constructing the 1D gaussian filter
 	double* gFilter;
 	gFilter=new double[fsize*2+1];
-	double sum=0;
-	sigma=sigma*sigma*2;
-	for(int i=-fsize;i<=fsize;i++)
-	{
-		gFilter[i+fsize]=exp(-(double)(i*i)/sigma);
-		sum+=gFilter[i+fsize];
-	}
-	for(int i=0;i<2*fsize+1;i++)
-		gFilter[i]/=sum;
+	ImageProcessing::generate1DGaussian(gFilter,fsize,sigma);
 
 	// apply filtering
 	imfilter_hv(image,gFilter,fsize,gFilter,fsize);
 
-	delete gFilter;
+	delete []gFilter;
+}
+
+template <class T>
+template <class T1>
+void Image<T>::GaussianSmoothResize(Image<T1>& image,double sigma,int fsize,double ratio) const
+{
+	ResizePlan plan;
+	GaussianSmoothResize(image,sigma,fsize,ratio,plan);
+}
+
+template <class T>
+template <class T1>
+void Image<T>::GaussianSmoothResize(Image<T1>& image,double sigma,int fsize,double ratio,ResizePlan& plan) const
+{
+	double stackFilter[33];
+	double* gFilter=fsize*2+1<=33?stackFilter:new double[fsize*2+1];
+	ImageProcessing::generate1DGaussian(gFilter,fsize,sigma);
+
+	plan.prepare(imWidth,imHeight,ratio);
+	image.setPlanar(IsPlanar);
+	if(image.width()!=plan.dstwidth() || image.height()!=plan.dstheight() || image.nchannels()!=nChannels)
+		image.allocate(plan.dstwidth(),plan.dstheight(),nChannels);
+	for(int k=0;k<nplanes();k++)
+		ImageProcessing::smoothResize(plane(k),image.plane(k),imWidth,imHeight,planechannels(),gFilter,fsize,plan);
+
+	if(gFilter!=stackFilter)
+		delete []gFilter;
 }
 
 //------------------------------------------------------------------------------------------
@@ -656,6 +840,7 @@ void Image<T>::smoothing(Image<T1>& image,double factor)
 	for(int i=0;i<9;i++)
 		filter2D[i]/=(factor+2)*(factor+2);
 
+	image.setPlanar(IsPlanar);
 	if(matchDimension(image)==false)
 		image.allocate(imWidth,imHeight,nChannels);
 	imfilter<T1>(image,filter2D,1);
@@ -673,7 +858,7 @@ Image<T1> Image<T>::smoothing(double factor)
 template <class T>
 void Image<T>::smoothing(double factor)
 {
-	Image<T> result(imWidth,imHeight,nChannels);
+	Image<T> result;
 	smoothing(result,factor);
 	copyData(result);
 }
@@ -685,9 +870,11 @@ template <class T>
 template <class T1>
 void Image<T>::imfilter(Image<T1>& image,double* filter,int fsize) const
 {
+	image.setPlanar(IsPlanar);
 	if(matchDimension(image)==false)
 		image.allocate(imWidth,imHeight,nChannels);
-	ImageProcessing::filtering(pData,image.data(),imWidth,imHeight,nChannels,filter,fsize);
+	for(int k=0;k<nplanes();k++)
+		ImageProcessing::filtering(plane(k),image.plane(k),imWidth,imHeight,planechannels(),filter,fsize);
 }
 
 template <class T>
@@ -703,18 +890,22 @@ template <class T>
 template <class T1>
 void Image<T>::imfilter_h(Image<T1>& image,double* filter,int fsize) const
 {
+	image.setPlanar(IsPlanar);
 	if(matchDimension(image)==false)
 		image.allocate(imWidth,imHeight,nChannels);
-	ImageProcessing::hfiltering(pData,image.data(),imWidth,imHeight,nChannels,filter,fsize);
+	for(int k=0;k<nplanes();k++)
+		ImageProcessing::hfiltering(plane(k),image.plane(k),imWidth,imHeight,planechannels(),filter,fsize);
 }
 
 template <class T>
 template <class T1>
 void Image<T>::imfilter_v(Image<T1>& image,double* filter,int fsize) const
 {
+	image.setPlanar(IsPlanar);
 	if(matchDimension(image)==false)
 		image.allocate(imWidth,imHeight,nChannels);
-	ImageProcessing::vfiltering(pData,image.data(),imWidth,imHeight,nChannels,filter,fsize);
+	for(int k=0;k<nplanes();k++)
+		ImageProcessing::vfiltering(plane(k),image.plane(k),imWidth,imHeight,planechannels(),filter,fsize);
 }
 
 
@@ -722,13 +913,25 @@ template <class T>
 template <class T1>
 void Image<T>::imfilter_hv(Image<T1> &image, double *hfilter, int hfsize, double *vfilter, int vfsize) const
 {
+	Image<T1> buffer;
+	imfilter_hv(image,hfilter,hfsize,vfilter,vfsize,buffer);
+}
+
+template <class T>
+template <class T1>
+void Image<T>::imfilter_hv(Image<T1> &image, double *hfilter, int hfsize, double *vfilter, int vfsize, Image<T1>& buffer) const
+{
+	image.setPlanar(IsPlanar);
 	if(matchDimension(image)==false)
 		image.allocate(imWidth,imHeight,nChannels);
-	T1* pTempBuffer;
-	pTempBuffer=new T1[nElements];
-	ImageProcessing::hfiltering(pData,pTempBuffer,imWidth,imHeight,nChannels,hfilter,hfsize);
-	ImageProcessing::vfiltering(pTempBuffer,image.data(),imWidth,imHeight,nChannels,vfilter,vfsize);
-    delete pTempBuffer;
+	if(matchDimension(buffer)==false)
+		buffer.allocate(imWidth,imHeight,nChannels);
+	T1* pTempBuffer=buffer.data();
+	for(int k=0;k<nplanes();k++)
+	{
+		ImageProcessing::hfiltering(plane(k),pTempBuffer+k*nPixels,imWidth,imHeight,planechannels(),hfilter,hfsize);
+		ImageProcessing::vfiltering(pTempBuffer+k*nPixels,image.plane(k),imWidth,imHeight,planechannels(),vfilter,vfsize);
+	}
 }
 
 //------------------------------------------------------------------------------------------
@@ -747,6 +950,13 @@ void Image<T>::desaturate(Image<T1> &image) const
 		image.allocate(imWidth,imHeight,1);
 	T1* data=image.data();
 	int offset;
+	if(IsPlanar)
+	{
+		const T *pR=plane(0),*pG=plane(1),*pB=plane(2);
+		for(int i=0;i<nPixels;i++)
+			data[i]=(double)pR[i]*.299+pG[i]*.587+pB[i]*.114;
+		return;
+	}
 	for(int i=0;i<nPixels;i++)
 	{
 		offset=i*3;
@@ -763,6 +973,21 @@ void Image<T>::collapse(Image<T1> &image) const
 	T1* data=image.data();
 	int offset;
 	double temp;
+	if(IsPlanar)
+	{
+		// accumulate the planes one by one
+		for(int i=0;i<nPixels;i++)
+			data[i]=pData[i];
+		for(int k=1;k<nChannels;k++)
+		{
+			const T* pPlane=plane(k);
+			for(int i=0;i<nPixels;i++)
+				data[i]+=pPlane[i];
+		}
+		for(int i=0;i<nPixels;i++)
+			data[i]/=nChannels;
+		return;
+	}
 	for(int i=0;i<nPixels;i++)
 	{
 		offset=i*nChannels;
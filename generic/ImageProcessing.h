@@ -5,6 +5,8 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include <typeinfo>
+class ResizePlan;
+
 //----------------------------------------------------------------------------------
 // class to handle basic image processing functions
 // this is a collection of template functions. These template functions are
@@ -33,21 +35,51 @@ public:
 	template <class T1,class T2>
 	static void ResizeImage(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,int DstWidth,int DstHeight);
 
+	// function to filter an image with the separable filter pfilter1D and resize it, as hfiltering(),
+	// vfiltering() and ResizeImage() in turn, but the image is filtered row by row and only the rows
+	// that are sampled are filtered vertically
+	template <class T1,class T2>
+	static void smoothResize(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double* pfilter1D,int fsize,double Ratio);
+	// the same with the sampling of plan (see ResizePlan)
+	template <class T1,class T2>
+	static void smoothResize(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double* pfilter1D,int fsize,const ResizePlan& plan);
+
 	//---------------------------------------------------------------------------------
 	// functions for 1D filtering
 	//---------------------------------------------------------------------------------
 	template <class T1,class T2>
 	static void hfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter1D,int fsize);
 
+	template <class T1,class T2>
+	static void hfilteringRow(const T1* pSrcRow,T2* pDstRow,int width,int nChannels,double* pfilter1D,int fsize);
+
 	template <class T1,class T2>
 	static void vfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter1D,int fsize);
 
+	// function to filter a line of length elements with nTaps taps, the l-th tap is read from pLines[l]
+	template <class T1,class T2>
+	static inline void filterLine(const T1* const* pLines,T2* pDstLine,int length,const double* pfilter1D,int nTaps);
+
 	//---------------------------------------------------------------------------------
 	// functions for 2D filtering
 	//---------------------------------------------------------------------------------
 	template <class T1,class T2>
 	static void filtering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter2D,int fsize);
 
+	// only the rows [rowStart,rowEnd) of the destination are computed
+	template <class T1,class T2>
+	static void filtering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter2D,int fsize,int rowStart,int rowEnd);
+
+	// function to test whether a 2D filter is the product of a vertical and a horizontal 1D filter,
+	// which are then stored in pvfilter1D and phfilter1D
+	static inline bool separateFilter(const double* pfilter2D,int fsize,double* phfilter1D,double* pvfilter1D);
+
+	// separable 2D filtering of the rows [rowStart,rowEnd) of the destination, each row is filtered
+	// horizontally only once into pRows, a ring of (2*fsize+2)*width*nChannels elements
+	template <class T1,class T2>
+	static void separableFiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* phfilter1D,const double* pvfilter1D,int fsize,
+												int rowStart,int rowEnd,double* pRows);
+
 	//---------------------------------------------------------------------------------
 	// functions for sample a patch from the image
 	//---------------------------------------------------------------------------------
@@ -60,6 +92,10 @@ public:
 	template <class T1,class T2>
 	static void warpImage(T1* pWarpIm2,const T1* pIm1,const T1* pIm2,const T2* pVx,const T2* pVy,int width,int height,int nChannels);
 
+	// function to warp the pixel (i,j)
+	template <class T1,class T2>
+	static inline void warpPixel(T1* pWarpIm2,const T1* pIm1,const T1* pIm2,const T2* pVx,const T2* pVy,int i,int j,int width,int height,int nChannels);
+
 	//---------------------------------------------------------------------------------
 	// function to crop an image
 	//---------------------------------------------------------------------------------
@@ -67,13 +103,29 @@ public:
 	static void cropImage(const T1* pSrcImage,int SrcWidth,int SrcHeight,int nChannels,T2* pDstImage,int Left,int Top,int DstWidth,int DstHeight);
 	//---------------------------------------------------------------------------------
 
+	//---------------------------------------------------------------------------------
+	// functions to convert between interleaved images and planar (channel by channel)
+	// buffers with arbitrary strides
+	//---------------------------------------------------------------------------------
+	template <class T1,class T2>
+	static void planar2interleaved(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,long cStride,long hStride,long wStride);
+
+	template <class T1,class T2>
+	static void interleaved2planar(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,long cStride,long hStride,long wStride);
+
 	//---------------------------------------------------------------------------------
 	// function to generate a 2D Gaussian 
 	//---------------------------------------------------------------------------------
 	template <class T>
 	static void generate2DGaussian(T*& pImage,int wsize,double sigma=-1);
+
+	// the normalized 1D Gaussian of Image::GaussianSmoothing(), pFilter has fsize*2+1 elements
+	static inline void generate1DGaussian(double* pFilter,int fsize,double sigma);
 };
 
+#include "ImageProcessingSIMD.h"
+#include "ResizePlan.h"
+
 //--------------------------------------------------------------------------------------------------
 // function to interplate multi-channel image plane for (x,y)
 // --------------------------------------------------------------------------------------------------
@@ -108,42 +160,65 @@ inline void ImageProcessing::BilinearInterpolate(const T1* pImage,int width,int
 template <class T1,class T2>
 void ImageProcessing::ResizeImage(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double Ratio)
 {
-	int DstWidth,DstHeight;
-	DstWidth=(double)SrcWidth*Ratio;
-	DstHeight=(double)SrcHeight*Ratio;
-	memset(pDstImage,sizeof(T2)*DstWidth*DstHeight*nChannels,0);
-	
-	double x,y;
-
-	for(int i=0;i<DstHeight;i++)
-		for(int j=0;j<DstWidth;j++)
-		{
-			x=(double)(j+1)/Ratio-1;
-			y=(double)(i+1)/Ratio-1;
-
-			// bilinear interpolation
-			BilinearInterpolate(pSrcImage,SrcWidth,SrcHeight,nChannels,x,y,pDstImage+(i*DstWidth+j)*nChannels);
-		}
+	ResizePlan plan;
+	plan.prepare(SrcWidth,SrcHeight,Ratio);
+	plan.resize(pSrcImage,pDstImage,nChannels);
 }
 
 template <class T1,class T2>
 void ImageProcessing::ResizeImage(const T1 *pSrcImage, T2 *pDstImage, int SrcWidth, int SrcHeight, int nChannels, int DstWidth, int DstHeight)
 {
-	double xRatio=(double)DstWidth/SrcWidth;
-	double yRatio=(double)DstHeight/SrcHeight;
-	memset(pDstImage,sizeof(T2)*DstWidth*DstHeight*nChannels,0);
+	ResizePlan plan;
+	plan.prepare(SrcWidth,SrcHeight,DstWidth,DstHeight);
+	plan.resize(pSrcImage,pDstImage,nChannels);
+}
 
-	double x,y;
+template <class T1,class T2>
+void ImageProcessing::smoothResize(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double* pfilter1D,int fsize,double Ratio)
+{
+	ResizePlan plan;
+	plan.prepare(SrcWidth,SrcHeight,Ratio);
+	smoothResize(pSrcImage,pDstImage,SrcWidth,SrcHeight,nChannels,pfilter1D,fsize,plan);
+}
 
-	for(int i=0;i<DstHeight;i++)
-		for(int j=0;j<DstWidth;j++)
+//------------------------------------------------------------------------------------------------------------
+// the rows are filtered horizontally into a ring of fsize*2+1 rows as they are needed, and the two rows of
+// the filtered image that are sampled by a row of the destination are kept
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::smoothResize(const T1* pSrcImage,T2* pDstImage,int SrcWidth,int SrcHeight,int nChannels,double* pfilter1D,int fsize,const ResizePlan& plan)
+{
+	int i,l,n,nTaps=fsize*2+1,rowSize=SrcWidth*nChannels;
+	T2* pHRows=plan.rowBuffer<T2>((nTaps+2)*rowSize);
+	T2* pSmoothRows=pHRows+nTaps*rowSize;
+	int smoothRow[2]={-1,-1},lastHRow=-1;
+	const T2* stackLines[16];
+	const T2** pLines=nTaps<=16?stackLines:new const T2*[nTaps];
+	for(i=0;i<plan.dstheight();i++)
+	{
+		const T2* pRows[2];
+		for(n=0;n<=1;n++)
 		{
-			x=(double)(j+1)/xRatio-1;
-			y=(double)(i+1)/yRatio-1;
-
-			// bilinear interpolation
-			BilinearInterpolate(pSrcImage,SrcWidth,SrcHeight,nChannels,x,y,pDstImage+(i*DstWidth+j)*nChannels);
+			// the rows sampled by the destination rows only increase, so each is filtered at most once
+			int v=plan.rows()[i*2+n];
+			T2* pSmoothRow=pSmoothRows+(v&1)*rowSize;
+			if(smoothRow[v&1]!=v)
+			{
+				int last=__min(v+fsize,SrcHeight-1);
+				for(int r=__max(v-fsize,lastHRow+1);r<=last;r++)
+					hfilteringRow(pSrcImage+r*rowSize,pHRows+(r%nTaps)*rowSize,SrcWidth,nChannels,pfilter1D,fsize);
+				lastHRow=__max(lastHRow,last);
+				for(l=0;l<nTaps;l++)
+					pLines[l]=pHRows+(EnforceRange(v+l-fsize,SrcHeight)%nTaps)*rowSize;
+				filterLine(pLines,pSmoothRow,rowSize,pfilter1D,nTaps);
+				smoothRow[v&1]=v;
+			}
+			pRows[n]=pSmoothRow;
 		}
+		plan.resizeRow(pRows[0],pRows[1],pDstImage+i*plan.dstwidth()*nChannels,i,nChannels);
+	}
+	if(pLines!=stackLines)
+		delete []pLines;
 }
 
 //------------------------------------------------------------------------------------------------------------
@@ -152,47 +227,86 @@ void ImageProcessing::ResizeImage(const T1 *pSrcImage, T2 *pDstImage, int SrcWid
 template <class T1,class T2>
 void ImageProcessing::hfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter1D,int fsize)
 {
-	memset(pDstImage,0,sizeof(T2)*width*height*nChannels);
-	T2* pBuffer;
-	double w;
-	int i,j,l,k,offset,jj;
-	for(i=0;i<height;i++)
-		for(j=0;j<width;j++)
+	for(int i=0;i<height;i++)
+		hfilteringRow(pSrcImage+i*width*nChannels,pDstImage+i*width*nChannels,width,nChannels,pfilter1D,fsize);
+}
+
+template <class T1,class T2>
+void ImageProcessing::hfilteringRow(const T1* pSrcRow,T2* pDstRow,int width,int nChannels,double* pfilter1D,int fsize)
+{
+	int j,l,k,jj,nTaps=fsize*2+1;
+	// the interior is [fsize,width-fsize), the pixels on the left and on the right of it are clamped
+	int interiorEnd=__max(width-fsize,fsize);
+	for(j=0;j<width;j++)
+	{
+		if(j==fsize && j<interiorEnd)
 		{
-			offset=i*width*nChannels;
-			pBuffer=pDstImage+offset+j*nChannels;
-			for(l=-fsize;l<=fsize;l++)
-			{
-				w=pfilter1D[l+fsize];
-				jj=EnforceRange(j+l,width);
-				for(k=0;k<nChannels;k++)
-					pBuffer[k]+=pSrcImage[offset+jj*nChannels+k]*w;
-			}
+			// the pointers to the taps of the first interior pixel
+			const T1* stackLines[16];
+			const T1** pLines=nTaps<=16?stackLines:new const T1*[nTaps];
+			for(l=0;l<nTaps;l++)
+				pLines[l]=pSrcRow+l*nChannels;
+			filterLine(pLines,pDstRow+j*nChannels,(interiorEnd-fsize)*nChannels,pfilter1D,nTaps);
+			if(pLines!=stackLines)
+				delete []pLines;
+			j=interiorEnd-1;
+			continue;
+		}
+		T2* pBuffer=pDstRow+j*nChannels;
+		for(k=0;k<nChannels;k++)
+			pBuffer[k]=0;
+		for(l=-fsize;l<=fsize;l++)
+		{
+			double w=pfilter1D[l+fsize];
+			jj=EnforceRange(j+l,width);
+			for(k=0;k<nChannels;k++)
+				pBuffer[k]+=pSrcRow[jj*nChannels+k]*w;
 		}
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
 // vertical direction filtering
+// the rows are processed in blocks of columns, so that the 2*fsize+1 rows of a block that are read for
+// a row of the output stay in the cache for the next rows
 //------------------------------------------------------------------------------------------------------------
 template <class T1,class T2>
 void ImageProcessing::vfiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter1D,int fsize)
 {
-	memset(pDstImage,0,sizeof(T2)*width*height*nChannels);
-	T2* pBuffer;
-	double w;
-	int i,j,l,k,offset,ii;
-	for(i=0;i<height;i++)
-		for(j=0;j<width;j++)
+	int i,l,nTaps=fsize*2+1,rowSize=width*nChannels;
+	const T1* stackLines[16];
+	const T1** pLines=nTaps<=16?stackLines:new const T1*[nTaps];
+	// about 32KB of source rows per block
+	int blockSize=__max(32768/((nTaps+1)*(int)sizeof(T1))/16*16,64);
+	for(int x=0;x<rowSize;x+=blockSize)
+	{
+		int length=__min(blockSize,rowSize-x);
+		for(i=0;i<height;i++)
 		{
-			pBuffer=pDstImage+(i*width+j)*nChannels;
-			for(l=-fsize;l<=fsize;l++)
-			{
-				w=pfilter1D[l+fsize];
-				ii=EnforceRange(i+l,height);
-				for(k=0;k<nChannels;k++)
-					pBuffer[k]+=pSrcImage[(ii*width+j)*nChannels+k]*w;
-			}
+			for(l=0;l<nTaps;l++)
+				pLines[l]=pSrcImage+EnforceRange(i+l-fsize,height)*rowSize+x;
+			filterLine(pLines,pDstImage+i*rowSize+x,length,pfilter1D,nTaps);
 		}
+	}
+	if(pLines!=stackLines)
+		delete []pLines;
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the weighted sum of the taps for each element of a line, accumulated in T2 in the order of the taps
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+inline void ImageProcessing::filterLine(const T1* const* pLines,T2* pDstLine,int length,const double* pfilter1D,int nTaps)
+{
+	// the vectorized version does the first elements (if there is one for T1 and T2)
+	int x=ImageProcessingSIMD::filterLine(pLines,pDstLine,length,pfilter1D,nTaps);
+	for(;x<length;x++)
+	{
+		T2 value=0;
+		for(int l=0;l<nTaps;l++)
+			value+=pLines[l][x]*pfilter1D[l];
+		pDstLine[x]=value;
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
@@ -200,12 +314,30 @@ void ImageProcessing::vfiltering(const T1* pSrcImage,T2* pDstImage,int width,int
 //------------------------------------------------------------------------------------------------------------
 template <class T1,class T2>
 void ImageProcessing::filtering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter2D,int fsize)
+{
+	// a separable filter (e.g. the one of Image::smoothing()) is applied as two 1D filters
+	double* pfilter1D=new double[(fsize*2+1)*2];
+	if(separateFilter(pfilter2D,fsize,pfilter1D,pfilter1D+fsize*2+1))
+	{
+		double* pRows=new double[(fsize*2+2)*width*nChannels];
+		separableFiltering(pSrcImage,pDstImage,width,height,nChannels,pfilter1D,pfilter1D+fsize*2+1,fsize,0,height,pRows);
+		delete []pRows;
+	}
+	else
+		filtering(pSrcImage,pDstImage,width,height,nChannels,pfilter2D,fsize,0,height);
+	delete []pfilter1D;
+}
+
+template <class T1,class T2>
+void ImageProcessing::filtering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,double* pfilter2D,int fsize,int rowStart,int rowEnd)
 {
 	double w;
 	int i,j,u,v,k,ii,jj,wsize,offset;
 	wsize=fsize*2+1;
-	double* pBuffer=new double[nChannels];
-	for(i=0;i<height;i++)
+	// this is called for every band of rows, so the buffer is on the stack unless the image has many channels
+	double stackBuffer[8];
+	double* pBuffer=nChannels<=8?stackBuffer:new double[nChannels];
+	for(i=rowStart;i<rowEnd;i++)
 		for(j=0;j<width;j++)
 		{
 			for(k=0;k<nChannels;k++)
@@ -224,7 +356,101 @@ void ImageProcessing::filtering(const T1* pSrcImage,T2* pDstImage,int width,int
 			for(k=0;k<nChannels;k++)
 				pDstImage[offset+k]=pBuffer[k];
 		}
-	delete pBuffer;
+	if(pBuffer!=stackBuffer)
+		delete []pBuffer;
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the filter is separable if it is the outer product of its column and its row through the
+// largest coefficient, up to the rounding errors
+//------------------------------------------------------------------------------------------------------------
+inline bool ImageProcessing::separateFilter(const double* pfilter2D,int fsize,double* phfilter1D,double* pvfilter1D)
+{
+	int wsize=fsize*2+1,u,v,row=0,col=0;
+	double maxValue=0;
+	for(u=0;u<wsize;u++)
+		for(v=0;v<wsize;v++)
+			if(fabs(pfilter2D[u*wsize+v])>maxValue)
+			{
+				maxValue=fabs(pfilter2D[u*wsize+v]);
+				row=u;
+				col=v;
+			}
+	if(maxValue==0)
+		return false;
+	for(u=0;u<wsize;u++)
+	{
+		pvfilter1D[u]=pfilter2D[u*wsize+col];
+		phfilter1D[u]=pfilter2D[row*wsize+u]/pfilter2D[row*wsize+col];
+	}
+	for(u=0;u<wsize;u++)
+		for(v=0;v<wsize;v++)
+			if(fabs(pvfilter1D[u]*phfilter1D[v]-pfilter2D[u*wsize+v])>maxValue*1E-12)
+				return false;
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------------
+// separable 2D filtering
+// the interior of a row, where all the taps are inside the image, is filtered tap by tap
+// without clamping so that the loops are vectorized, only the fsize pixels on each side are
+// clamped. The horizontally filtered rows [i-fsize,i+fsize] needed by row i are kept in a
+// ring indexed by row%(2*fsize+1), the last row of pRows accumulates the vertical filter.
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::separableFiltering(const T1* pSrcImage,T2* pDstImage,int width,int height,int nChannels,const double* phfilter1D,const double* pvfilter1D,int fsize,
+															int rowStart,int rowEnd,double* pRows)
+{
+	int wsize=fsize*2+1,rowLength=width*nChannels;
+	int border=__min(fsize,width)*nChannels,interiorEnd=__max(width-fsize,__min(fsize,width))*nChannels;
+	double* pSum=pRows+wsize*rowLength;
+	int i,j,k,l,x,nextRow=__max(rowStart-fsize,0);
+	for(i=rowStart;i<rowEnd;i++)
+	{
+		// filter the rows that enter the window horizontally
+		for(;nextRow<=__min(i+fsize,height-1);nextRow++)
+		{
+			const T1* pSrc=pSrcImage+nextRow*rowLength;
+			double* pRow=pRows+(nextRow%wsize)*rowLength;
+			for(x=border;x<interiorEnd;x++)
+				pRow[x]=pSrc[x-border]*phfilter1D[0];
+			for(l=1;l<wsize;l++)
+			{
+				const T1* pTap=pSrc+(l-fsize)*nChannels;
+				double w=phfilter1D[l];
+				for(x=border;x<interiorEnd;x++)
+					pRow[x]+=pTap[x]*w;
+			}
+			for(j=0;j<width;j++)
+			{
+				if(j==fsize && j<width-fsize)
+					j=width-fsize;
+				for(k=0;k<nChannels;k++)
+					pRow[j*nChannels+k]=0;
+				for(l=-fsize;l<=fsize;l++)
+				{
+					const T1* pTap=pSrc+EnforceRange(j+l,width)*nChannels;
+					double w=phfilter1D[l+fsize];
+					for(k=0;k<nChannels;k++)
+						pRow[j*nChannels+k]+=pTap[k]*w;
+				}
+			}
+		}
+		// then vertically
+		const double* pRow=pRows+(EnforceRange(i-fsize,height)%wsize)*rowLength;
+		for(x=0;x<rowLength;x++)
+			pSum[x]=pRow[x]*pvfilter1D[0];
+		for(l=1;l<wsize;l++)
+		{
+			pRow=pRows+(EnforceRange(i+l-fsize,height)%wsize)*rowLength;
+			double w=pvfilter1D[l];
+			for(x=0;x<rowLength;x++)
+				pSum[x]+=pRow[x]*w;
+		}
+		T2* pDst=pDstImage+i*rowLength;
+		for(x=0;x<rowLength;x++)
+			pDst[x]=pSum[x];
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
@@ -255,21 +481,53 @@ template <class T1,class T2>
 void ImageProcessing::warpImage(T1 *pWarpIm2, const T1 *pIm1, const T1 *pIm2, const T2 *pVx, const T2 *pVy, int width, int height, int nChannels)
 {
 	for(int i=0;i<height;i++)
-		for(int j=0;j<width;j++)
-		{
-			int offset=i*width+j;
-			double x,y;
-			y=i+pVy[offset];
-			x=j+pVx[offset];
-			offset*=nChannels;
-			if(x<0 || x>width-1 || y<0 || y>height-1)
-			{
-				for(int k=0;k<nChannels;k++)
-					pWarpIm2[offset+k]=pIm1[offset+k];
-				continue;
-			}
-			BilinearInterpolate(pIm2,width,height,nChannels,x,y,pWarpIm2+offset);
-		}
+	{
+		// the vectorized version does the first pixels of the row (if there is one for T1 and T2)
+		int j=ImageProcessingSIMD::warpImageRow(pWarpIm2,pIm1,pIm2,pVx,pVy,i,width,height,nChannels);
+		for(;j<width;j++)
+			warpPixel(pWarpIm2,pIm1,pIm2,pVx,pVy,i,j,width,height,nChannels);
+	}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// the pixels moving outside of the image take the value of Im1
+// in the interior, where the four neighbors of (x,y) are inside the image, the bilinear
+// interpolation is done without clamping, in the order of BilinearInterpolate()
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+inline void ImageProcessing::warpPixel(T1 *pWarpIm2, const T1 *pIm1, const T1 *pIm2, const T2 *pVx, const T2 *pVy, int i, int j, int width, int height, int nChannels)
+{
+	int offset=i*width+j;
+	double x,y;
+	y=i+pVy[offset];
+	x=j+pVx[offset];
+	offset*=nChannels;
+	if(x<0 || x>width-1 || y<0 || y>height-1)
+	{
+		for(int k=0;k<nChannels;k++)
+			pWarpIm2[offset+k]=pIm1[offset+k];
+		return;
+	}
+	int xx=x,yy=y;
+	// (a NaN flow passes the test above)
+	if(!(xx>=0 && yy>=0 && xx<width-1 && yy<height-1))
+	{
+		BilinearInterpolate(pIm2,width,height,nChannels,x,y,pWarpIm2+offset);
+		return;
+	}
+	double dx=x-xx,dy=y-yy;
+	double s00=(1-dx)*(1-dy),s01=(1-dx)*dy,s10=dx*(1-dy),s11=dx*dy;
+	const T1* p=pIm2+(yy*width+xx)*nChannels;
+	int rowStep=width*nChannels;
+	for(int k=0;k<nChannels;k++)
+	{
+		T1 value=0;
+		value+=p[k]*s00;
+		value+=p[k+rowStep]*s01;
+		value+=p[k+nChannels]*s10;
+		value+=p[k+rowStep+nChannels]*s11;
+		pWarpIm2[offset+k]=value;
+	}
 }
 
 //------------------------------------------------------------------------------------------------------------
@@ -298,6 +556,57 @@ void ImageProcessing::cropImage(const T1 *pSrcImage, int SrcWidth, int SrcHeight
 		}
 }
 
+//------------------------------------------------------------------------------------------------------------
+// function to copy a planar buffer, where pixel (i,j) of channel k is at k*cStride+i*hStride+j*wStride,
+// into an interleaved image. pDstImage has to be allocated before hands
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::planar2interleaved(const T1 *pSrcImage, T2 *pDstImage, int width, int height, int nChannels, long cStride, long hStride, long wStride)
+{
+	if(typeid(T1)==typeid(T2) && nChannels==1 && wStride==1 && hStride==width)
+	{
+		memcpy(pDstImage,pSrcImage,sizeof(T1)*width*height);
+		return;
+	}
+	for(int k=0;k<nChannels;k++)
+		for(int i=0;i<height;i++)
+		{
+			const T1* pSrcRow=pSrcImage+k*cStride+i*hStride;
+			T2* pDstRow=pDstImage+i*width*nChannels+k;
+			if(wStride==1)
+				for(int j=0;j<width;j++)
+					pDstRow[j*nChannels]=pSrcRow[j];
+			else
+				for(int j=0;j<width;j++)
+					pDstRow[j*nChannels]=pSrcRow[j*wStride];
+		}
+}
+
+//------------------------------------------------------------------------------------------------------------
+// function to copy an interleaved image into a planar buffer with the layout of planar2interleaved()
+//------------------------------------------------------------------------------------------------------------
+template <class T1,class T2>
+void ImageProcessing::interleaved2planar(const T1 *pSrcImage, T2 *pDstImage, int width, int height, int nChannels, long cStride, long hStride, long wStride)
+{
+	if(typeid(T1)==typeid(T2) && nChannels==1 && wStride==1 && hStride==width)
+	{
+		memcpy(pDstImage,pSrcImage,sizeof(T1)*width*height);
+		return;
+	}
+	for(int k=0;k<nChannels;k++)
+		for(int i=0;i<height;i++)
+		{
+			const T1* pSrcRow=pSrcImage+i*width*nChannels+k;
+			T2* pDstRow=pDstImage+k*cStride+i*hStride;
+			if(wStride==1)
+				for(int j=0;j<width;j++)
+					pDstRow[j]=pSrcRow[j*nChannels];
+			else
+				for(int j=0;j<width;j++)
+					pDstRow[j*wStride]=pSrcRow[j*nChannels];
+		}
+}
+
 //------------------------------------------------------------------------------------------------------------
 // function to generate a 2D Gaussian image
 // pImage must be allocated before calling the function
@@ -315,4 +624,17 @@ void ImageProcessing::generate2DGaussian(T*& pImage, int wsize, double sigma)
 		for(int j=-wsize;j<=wsize;j++)
 			pImage[(i+wsize)*winlength+j+wsize]=exp(-(double)(i*i+j*j)*alpha);
 }
+
+inline void ImageProcessing::generate1DGaussian(double* pFilter,int fsize,double sigma)
+{
+	double sum=0;
+	sigma=sigma*sigma*2;
+	for(int i=-fsize;i<=fsize;i++)
+	{
+		pFilter[i+fsize]=exp(-(double)(i*i)/sigma);
+		sum+=pFilter[i+fsize];
+	}
+	for(int i=0;i<2*fsize+1;i++)
+		pFilter[i]/=sum;
+}
 #endif
\ No newline at end of file
@@ -0,0 +1,522 @@
+#ifndef _ImageProcessingSIMD_h
+#define _ImageProcessingSIMD_h
+
+#include "SIMD.h"
+
+//----------------------------------------------------------------------------------
+// vectorized versions of some functions of ImageProcessing, for images of float and
+// double, selected at runtime by SIMD::level()
+// Each function processes a part of the work and returns how far it got, the rest is
+// left to the scalar code of ImageProcessing. The arithmetic is done in double in the
+// same order as the scalar code (and without fused multiply-add), so the results are
+// the same.
+//----------------------------------------------------------------------------------
+class ImageProcessingSIMD
+{
+public:
+	//---------------------------------------------------------------------------------
+	// function to warp the pixels [0,j) of row i, returns j
+	// see ImageProcessing::warpImage()
+	//---------------------------------------------------------------------------------
+	template <class T1,class T2>
+	static inline int warpImageRow(T1* pWarpIm2,const T1* pIm1,const T1* pIm2,const T2* pVx,const T2* pVy,int i,int width,int height,int nChannels) {return 0;};
+	static inline int warpImageRow(double* pWarpIm2,const double* pIm1,const double* pIm2,const double* pVx,const double* pVy,int i,int width,int height,int nChannels);
+	static inline int warpImageRow(float* pWarpIm2,const float* pIm1,const float* pIm2,const float* pVx,const float* pVy,int i,int width,int height,int nChannels);
+
+	//---------------------------------------------------------------------------------
+	// function to filter the elements [0,x) of a line, returns x
+	// see ImageProcessing::filterLine()
+	//---------------------------------------------------------------------------------
+	template <class T1,class T2>
+	static inline int filterLine(const T1* const* pLines,T2* pDstLine,int length,const double* pfilter1D,int nTaps) {return 0;};
+	static inline int filterLine(const double* const* pLines,double* pDstLine,int length,const double* pfilter1D,int nTaps);
+	static inline int filterLine(const float* const* pLines,float* pDstLine,int length,const double* pfilter1D,int nTaps);
+
+	//---------------------------------------------------------------------------------
+	// function to split the interleaved flow of the pixels [0,i) to its components,
+	// returns i
+	// see FlowFile::split()
+	//---------------------------------------------------------------------------------
+	template <class T>
+	static inline int splitFlow(const float* pFlow,T* pVx,T* pVy,int nPixels,double maxFlow) {return 0;};
+	static inline int splitFlow(const float* pFlow,float* pVx,float* pVy,int nPixels,double maxFlow);
+	static inline int splitFlow(const float* pFlow,double* pVx,double* pVy,int nPixels,double maxFlow);
+
+	//---------------------------------------------------------------------------------
+	// function to compute the norm, the angle and the color of the flow of the pixels
+	// [0,i), or only their color from the norm and the angle if pVx is NULL, returns i
+	// see FlowColor::colorPixel()
+	//---------------------------------------------------------------------------------
+	template <class T>
+	static inline int flowColor(T* pNorm,T* pAngle,T* pR,T* pG,T* pB,const T* pVx,const T* pVy,int nPixels,double maxFlow,bool IsSaturated) {return 0;};
+	static inline int flowColor(float* pNorm,float* pAngle,float* pR,float* pG,float* pB,const float* pVx,const float* pVy,int nPixels,double maxFlow,bool IsSaturated);
+	static inline int flowColor(double* pNorm,double* pAngle,double* pR,double* pG,double* pB,const double* pVx,const double* pVy,int nPixels,double maxFlow,bool IsSaturated);
+
+#ifdef SIMD_X86
+private:
+	// AVX-512 implies FMA, which GCC would otherwise use to contract the multiply-adds
+	#define SIMD_AVX2 __attribute__((target("avx2")))
+	#define SIMD_AVX512 __attribute__((target("avx512f"),optimize("fp-contract=off")))
+
+	//---------------------------------------------------------------------------------
+	// AVX2, four pixels at a time
+	// the values of T are loaded as four doubles, and rounded to T after each operation
+	// that the scalar code does in T
+	//---------------------------------------------------------------------------------
+	static inline SIMD_AVX2 __m256d gather4(const double* p,__m128i index) {return _mm256_i32gather_pd(p,index,8);};
+	static inline SIMD_AVX2 __m256d gather4(const float* p,__m128i index) {return _mm256_cvtps_pd(_mm_i32gather_ps(p,index,4));};
+	static inline SIMD_AVX2 __m256d round4(__m256d x,const double*) {return x;};
+	static inline SIMD_AVX2 __m256d round4(__m256d x,const float*) {return _mm256_cvtps_pd(_mm256_cvtpd_ps(x));};
+	static inline SIMD_AVX2 void store4(double* p,__m256d x) {_mm256_storeu_pd(p,x);};
+	static inline SIMD_AVX2 void store4(float* p,__m256d x) {_mm_storeu_ps(p,_mm256_cvtpd_ps(x));};
+	// j+vx for the pixels [j,j+4) and i+vy, the sums are in T as in the scalar code
+	static inline SIMD_AVX2 __m256d xPosition4(const double* pV,int j) {return _mm256_add_pd(_mm256_cvtepi32_pd(_mm_add_epi32(_mm_set1_epi32(j),_mm_setr_epi32(0,1,2,3))),_mm256_loadu_pd(pV));};
+	static inline SIMD_AVX2 __m256d yPosition4(const double* pV,int i) {return _mm256_add_pd(_mm256_set1_pd(i),_mm256_loadu_pd(pV));};
+	static inline SIMD_AVX2 __m256d xPosition4(const float* pV,int j) {return _mm256_cvtps_pd(_mm_add_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(j),_mm_setr_epi32(0,1,2,3))),_mm_loadu_ps(pV)));};
+	static inline SIMD_AVX2 __m256d yPosition4(const float* pV,int i) {return _mm256_cvtps_pd(_mm_add_ps(_mm_set1_ps(i),_mm_loadu_ps(pV)));};
+
+	template <class T>
+	static SIMD_AVX2 int warpImageRowAVX2(T* pWarpIm2,const T* pIm1,const T* pIm2,const T* pVx,const T* pVy,int i,int width,int height,int nChannels)
+	{
+		const __m256d zero=_mm256_setzero_pd(),one=_mm256_set1_pd(1);
+		const __m256d xMax=_mm256_set1_pd(width-1),yMax=_mm256_set1_pd(height-1);
+		const __m128i rowStride=_mm_set1_epi32(width),channels=_mm_set1_epi32(nChannels);
+		int rowOffset=i*width,j;
+		for(j=0;j+4<=width;j+=4)
+		{
+			int offset=rowOffset+j;
+			__m256d x=xPosition4(pVx+offset,j);
+			__m256d y=yPosition4(pVy+offset,i);
+			// the interior, where the four neighbors are inside the image
+			__m256d inside=_mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x,zero,_CMP_GE_OQ),_mm256_cmp_pd(x,xMax,_CMP_LT_OQ)),
+													_mm256_and_pd(_mm256_cmp_pd(y,zero,_CMP_GE_OQ),_mm256_cmp_pd(y,yMax,_CMP_LT_OQ)));
+			if(_mm256_movemask_pd(inside)!=0xF)
+			{
+				for(int l=0;l<4;l++)
+					ImageProcessing::warpPixel(pWarpIm2,pIm1,pIm2,pVx,pVy,i,j+l,width,height,nChannels);
+				continue;
+			}
+			__m256d xx=_mm256_round_pd(x,_MM_FROUND_TO_NEG_INF|_MM_FROUND_NO_EXC);
+			__m256d yy=_mm256_round_pd(y,_MM_FROUND_TO_NEG_INF|_MM_FROUND_NO_EXC);
+			__m256d dx=_mm256_sub_pd(x,xx),dy=_mm256_sub_pd(y,yy);
+			__m256d dx1=_mm256_sub_pd(one,dx),dy1=_mm256_sub_pd(one,dy);
+			__m256d s00=_mm256_mul_pd(dx1,dy1),s01=_mm256_mul_pd(dx1,dy),s10=_mm256_mul_pd(dx,dy1),s11=_mm256_mul_pd(dx,dy);
+			__m128i index=_mm_mullo_epi32(_mm_add_epi32(_mm_mullo_epi32(_mm256_cvttpd_epi32(yy),rowStride),_mm256_cvttpd_epi32(xx)),channels);
+			for(int k=0;k<nChannels;k++)
+			{
+				const T* p=pIm2+k;
+				__m256d result=round4(_mm256_add_pd(zero,_mm256_mul_pd(gather4(p,index),s00)),p);
+				result=round4(_mm256_add_pd(result,_mm256_mul_pd(gather4(p+width*nChannels,index),s01)),p);
+				result=round4(_mm256_add_pd(result,_mm256_mul_pd(gather4(p+nChannels,index),s10)),p);
+				result=round4(_mm256_add_pd(result,_mm256_mul_pd(gather4(p+(width+1)*nChannels,index),s11)),p);
+				if(nChannels==1)
+				{
+					store4(pWarpIm2+offset,result);
+					continue;
+				}
+				double values[4];
+				_mm256_storeu_pd(values,result);
+				for(int l=0;l<4;l++)
+					pWarpIm2[(offset+l)*nChannels+k]=values[l];
+			}
+		}
+		return j;
+	};
+
+	// the filtering is done on 16 elements at a time, in four sums to hide the latency of the additions
+	static inline SIMD_AVX2 __m256d load4(const double* p) {return _mm256_loadu_pd(p);};
+	static inline SIMD_AVX2 __m256d load4(const float* p) {return _mm256_cvtps_pd(_mm_loadu_ps(p));};
+
+	template <class T>
+	static SIMD_AVX2 int filterLineAVX2(const T* const* pLines,T* pDstLine,int length,const double* pfilter1D,int nTaps)
+	{
+		int x,l;
+		for(x=0;x+16<=length;x+=16)
+		{
+			__m256d sum0=_mm256_setzero_pd(),sum1=sum0,sum2=sum0,sum3=sum0;
+			for(l=0;l<nTaps;l++)
+			{
+				const T* p=pLines[l]+x;
+				__m256d w=_mm256_set1_pd(pfilter1D[l]);
+				sum0=round4(_mm256_add_pd(sum0,_mm256_mul_pd(load4(p),w)),p);
+				sum1=round4(_mm256_add_pd(sum1,_mm256_mul_pd(load4(p+4),w)),p);
+				sum2=round4(_mm256_add_pd(sum2,_mm256_mul_pd(load4(p+8),w)),p);
+				sum3=round4(_mm256_add_pd(sum3,_mm256_mul_pd(load4(p+12),w)),p);
+			}
+			store4(pDstLine+x,sum0);
+			store4(pDstLine+x+4,sum1);
+			store4(pDstLine+x+8,sum2);
+			store4(pDstLine+x+12,sum3);
+		}
+		for(;x+4<=length;x+=4)
+		{
+			__m256d sum=_mm256_setzero_pd();
+			for(l=0;l<nTaps;l++)
+			{
+				const T* p=pLines[l]+x;
+				sum=round4(_mm256_add_pd(sum,_mm256_mul_pd(load4(p),_mm256_set1_pd(pfilter1D[l]))),p);
+			}
+			store4(pDstLine+x,sum);
+		}
+		return x;
+	};
+
+	//---------------------------------------------------------------------------------
+	// AVX-512, eight pixels at a time
+	//---------------------------------------------------------------------------------
+	static inline SIMD_AVX512 __m512d gather8(const double* p,__m256i index) {return _mm512_i32gather_pd(index,p,8);};
+	static inline SIMD_AVX512 __m512d gather8(const float* p,__m256i index) {return _mm512_cvtps_pd(_mm256_i32gather_ps(p,index,4));};
+	static inline SIMD_AVX512 __m512d round8(__m512d x,const double*) {return x;};
+	static inline SIMD_AVX512 __m512d round8(__m512d x,const float*) {return _mm512_cvtps_pd(_mm512_cvtpd_ps(x));};
+	static inline SIMD_AVX512 void store8(double* p,__m512d x) {_mm512_storeu_pd(p,x);};
+	static inline SIMD_AVX512 void store8(float* p,__m512d x) {_mm256_storeu_ps(p,_mm512_cvtpd_ps(x));};
+	static inline SIMD_AVX512 __m256i columns8(int j) {return _mm256_add_epi32(_mm256_set1_epi32(j),_mm256_setr_epi32(0,1,2,3,4,5,6,7));};
+	static inline SIMD_AVX512 __m512d xPosition8(const double* pV,int j) {return _mm512_add_pd(_mm512_cvtepi32_pd(columns8(j)),_mm512_loadu_pd(pV));};
+	static inline SIMD_AVX512 __m512d yPosition8(const double* pV,int i) {return _mm512_add_pd(_mm512_set1_pd(i),_mm512_loadu_pd(pV));};
+	static inline SIMD_AVX512 __m512d xPosition8(const float* pV,int j) {return _mm512_cvtps_pd(_mm256_add_ps(_mm256_cvtepi32_ps(columns8(j)),_mm256_loadu_ps(pV)));};
+	static inline SIMD_AVX512 __m512d yPosition8(const float* pV,int i) {return _mm512_cvtps_pd(_mm256_add_ps(_mm256_set1_ps(i),_mm256_loadu_ps(pV)));};
+
+	template <class T>
+	static SIMD_AVX512 int warpImageRowAVX512(T* pWarpIm2,const T* pIm1,const T* pIm2,const T* pVx,const T* pVy,int i,int width,int height,int nChannels)
+	{
+		const __m512d zero=_mm512_setzero_pd(),one=_mm512_set1_pd(1);
+		const __m512d xMax=_mm512_set1_pd(width-1),yMax=_mm512_set1_pd(height-1);
+		const __m256i rowStride=_mm256_set1_epi32(width),channels=_mm256_set1_epi32(nChannels);
+		int rowOffset=i*width,j;
+		for(j=0;j+8<=width;j+=8)
+		{
+			int offset=rowOffset+j;
+			__m512d x=xPosition8(pVx+offset,j);
+			__m512d y=yPosition8(pVy+offset,i);
+			__mmask8 inside=_mm512_cmp_pd_mask(x,zero,_CMP_GE_OQ)&_mm512_cmp_pd_mask(x,xMax,_CMP_LT_OQ)&
+									_mm512_cmp_pd_mask(y,zero,_CMP_GE_OQ)&_mm512_cmp_pd_mask(y,yMax,_CMP_LT_OQ);
+			if(inside!=0xFF)
+			{
+				for(int l=0;l<8;l++)
+					ImageProcessing::warpPixel(pWarpIm2,pIm1,pIm2,pVx,pVy,i,j+l,width,height,nChannels);
+				continue;
+			}
+			__m512d xx=_mm512_roundscale_pd(x,_MM_FROUND_TO_NEG_INF|_MM_FROUND_NO_EXC);
+			__m512d yy=_mm512_roundscale_pd(y,_MM_FROUND_TO_NEG_INF|_MM_FROUND_NO_EXC);
+			__m512d dx=_mm512_sub_pd(x,xx),dy=_mm512_sub_pd(y,yy);
+			__m512d dx1=_mm512_sub_pd(one,dx),dy1=_mm512_sub_pd(one,dy);
+			__m512d s00=_mm512_mul_pd(dx1,dy1),s01=_mm512_mul_pd(dx1,dy),s10=_mm512_mul_pd(dx,dy1),s11=_mm512_mul_pd(dx,dy);
+			__m256i index=_mm256_mullo_epi32(_mm256_add_epi32(_mm256_mullo_epi32(_mm512_cvttpd_epi32(yy),rowStride),_mm512_cvttpd_epi32(xx)),channels);
+			for(int k=0;k<nChannels;k++)
+			{
+				const T* p=pIm2+k;
+				__m512d result=round8(_mm512_add_pd(zero,_mm512_mul_pd(gather8(p,index),s00)),p);
+				result=round8(_mm512_add_pd(result,_mm512_mul_pd(gather8(p+width*nChannels,index),s01)),p);
+				result=round8(_mm512_add_pd(result,_mm512_mul_pd(gather8(p+nChannels,index),s10)),p);
+				result=round8(_mm512_add_pd(result,_mm512_mul_pd(gather8(p+(width+1)*nChannels,index),s11)),p);
+				if(nChannels==1)
+				{
+					store8(pWarpIm2+offset,result);
+					continue;
+				}
+				double values[8];
+				_mm512_storeu_pd(values,result);
+				for(int l=0;l<8;l++)
+					pWarpIm2[(offset+l)*nChannels+k]=values[l];
+			}
+		}
+		return j;
+	};
+
+	// 32 elements at a time
+	static inline SIMD_AVX512 __m512d load8(const double* p) {return _mm512_loadu_pd(p);};
+	static inline SIMD_AVX512 __m512d load8(const float* p) {return _mm512_cvtps_pd(_mm256_loadu_ps(p));};
+
+	template <class T>
+	static SIMD_AVX512 int filterLineAVX512(const T* const* pLines,T* pDstLine,int length,const double* pfilter1D,int nTaps)
+	{
+		int x,l;
+		for(x=0;x+32<=length;x+=32)
+		{
+			__m512d sum0=_mm512_setzero_pd(),sum1=sum0,sum2=sum0,sum3=sum0;
+			for(l=0;l<nTaps;l++)
+			{
+				const T* p=pLines[l]+x;
+				__m512d w=_mm512_set1_pd(pfilter1D[l]);
+				sum0=round8(_mm512_add_pd(sum0,_mm512_mul_pd(load8(p),w)),p);
+				sum1=round8(_mm512_add_pd(sum1,_mm512_mul_pd(load8(p+8),w)),p);
+				sum2=round8(_mm512_add_pd(sum2,_mm512_mul_pd(load8(p+16),w)),p);
+				sum3=round8(_mm512_add_pd(sum3,_mm512_mul_pd(load8(p+24),w)),p);
+			}
+			store8(pDstLine+x,sum0);
+			store8(pDstLine+x+8,sum1);
+			store8(pDstLine+x+16,sum2);
+			store8(pDstLine+x+24,sum3);
+		}
+		for(;x+8<=length;x+=8)
+		{
+			__m512d sum=_mm512_setzero_pd();
+			for(l=0;l<nTaps;l++)
+			{
+				const T* p=pLines[l]+x;
+				sum=round8(_mm512_add_pd(sum,_mm512_mul_pd(load8(p),_mm512_set1_pd(pfilter1D[l]))),p);
+			}
+			store8(pDstLine+x,sum);
+		}
+		return x;
+	};
+
+	template <class T>
+	static inline int warpImageRowSIMD(T* pWarpIm2,const T* pIm1,const T* pIm2,const T* pVx,const T* pVy,int i,int width,int height,int nChannels)
+	{
+		switch(SIMD::level())
+		{
+		case SIMD::AVX512:
+			return warpImageRowAVX512(pWarpIm2,pIm1,pIm2,pVx,pVy,i,width,height,nChannels);
+		case SIMD::AVX2:
+			return warpImageRowAVX2(pWarpIm2,pIm1,pIm2,pVx,pVy,i,width,height,nChannels);
+		default:
+			return 0;
+		}
+	};
+	template <class T>
+	static inline int filterLineSIMD(const T* const* pLines,T* pDstLine,int length,const double* pfilter1D,int nTaps)
+	{
+		switch(SIMD::level())
+		{
+		case SIMD::AVX512:
+			return filterLineAVX512(pLines,pDstLine,length,pfilter1D,nTaps);
+		case SIMD::AVX2:
+			return filterLineAVX2(pLines,pDstLine,length,pfilter1D,nTaps);
+		default:
+			return 0;
+		}
+	};
+
+	//---------------------------------------------------------------------------------
+	// AVX2, eight pixels at a time (memory bound, so AVX-512 would not be faster)
+	//---------------------------------------------------------------------------------
+	static inline SIMD_AVX2 void store8(float* p,__m256 x) {_mm256_storeu_ps(p,x);};
+	static inline SIMD_AVX2 void store8(double* p,__m256 x)
+	{
+		_mm256_storeu_pd(p,_mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+		_mm256_storeu_pd(p+4,_mm256_cvtps_pd(_mm256_extractf128_ps(x,1)));
+	};
+
+	template <class T>
+	static SIMD_AVX2 int splitFlowAVX2(const float* pFlow,T* pVx,T* pVy,int nPixels,double maxFlow)
+	{
+		const __m256i order=_mm256_setr_epi32(0,2,4,6,1,3,5,7);
+		const __m256 absMask=_mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+		// the largest float that is not larger than maxFlow, so that the test is the same in float
+		float limit=(float)maxFlow;
+		if(limit>maxFlow)
+			limit=nextafterf(limit,0);
+		const __m256 maxFlow8=_mm256_set1_ps(limit);
+		bool IsMasked=(maxFlow>0);
+		int i;
+		for(i=0;i+8<=nPixels;i+=8)
+		{
+			// (u0 u1 u2 u3 v0 v1 v2 v3) and (u4 u5 u6 u7 v4 v5 v6 v7)
+			__m256 low=_mm256_permutevar8x32_ps(_mm256_loadu_ps(pFlow+i*2),order);
+			__m256 high=_mm256_permutevar8x32_ps(_mm256_loadu_ps(pFlow+i*2+8),order);
+			__m256 u=_mm256_permute2f128_ps(low,high,0x20);
+			__m256 v=_mm256_permute2f128_ps(low,high,0x31);
+			if(IsMasked)
+			{
+				// not (|u|<=maxFlow and |v|<=maxFlow), which is true for NaN
+				__m256 outside=_mm256_or_ps(_mm256_cmp_ps(_mm256_and_ps(u,absMask),maxFlow8,_CMP_NLE_UQ),
+														_mm256_cmp_ps(_mm256_and_ps(v,absMask),maxFlow8,_CMP_NLE_UQ));
+				u=_mm256_andnot_ps(outside,u);
+				v=_mm256_andnot_ps(outside,v);
+			}
+			store8(pVx+i,u);
+			store8(pVy+i,v);
+		}
+		return i;
+	};
+
+	template <class T>
+	static inline int splitFlowSIMD(const float* pFlow,T* pVx,T* pVy,int nPixels,double maxFlow)
+	{
+		if(SIMD::level()>=SIMD::AVX2)
+			return splitFlowAVX2(pFlow,pVx,pVy,nPixels,maxFlow);
+		return 0;
+	};
+
+	//---------------------------------------------------------------------------------
+	// AVX2, four pixels at a time, in double as FlowColor::colorPixel()
+	// all the branches are computed and blended
+	//---------------------------------------------------------------------------------
+	// mask ? a : b
+	static inline SIMD_AVX2 __m256d select4(__m256d mask,__m256d a,__m256d b) {return _mm256_blendv_pd(b,a,mask);};
+	static inline SIMD_AVX2 __m256d set4(double x) {return _mm256_set1_pd(x);};
+
+	// FlowColor::atan()
+	static inline SIMD_AVX2 __m256d atan4(__m256d t)
+	{
+		const __m256d one=set4(1);
+		__m256d big=_mm256_cmp_pd(t,set4(2.41421356237309504880),_CMP_GT_OQ);
+		__m256d mid=_mm256_andnot_pd(big,_mm256_cmp_pd(t,set4(0.66),_CMP_GT_OQ));
+		// -1/t, (t-1)/(t+1) or t/1, in one division
+		__m256d x=_mm256_div_pd(select4(big,set4(-1),select4(mid,_mm256_sub_pd(t,one),t)),
+										select4(big,t,select4(mid,_mm256_add_pd(t,one),one)));
+		__m256d y0=select4(big,set4(M_PI_2),select4(mid,set4(M_PI_4),_mm256_setzero_pd()));
+		__m256d more=select4(big,set4(6.123233995736765886130E-17),select4(mid,set4(0.5*6.123233995736765886130E-17),_mm256_setzero_pd()));
+		__m256d z=_mm256_mul_pd(x,x);
+		__m256d num=_mm256_sub_pd(_mm256_mul_pd(set4(-8.750608600031904122785E-1),z),set4(1.615753718733365076637E1));
+		num=_mm256_sub_pd(_mm256_mul_pd(num,z),set4(7.500855792314704667340E1));
+		num=_mm256_sub_pd(_mm256_mul_pd(num,z),set4(1.228866684490136173410E2));
+		num=_mm256_sub_pd(_mm256_mul_pd(num,z),set4(6.485021904942025371773E1));
+		__m256d den=_mm256_add_pd(z,set4(2.485846490142306297962E1));
+		den=_mm256_add_pd(_mm256_mul_pd(den,z),set4(1.650270098316988542046E2));
+		den=_mm256_add_pd(_mm256_mul_pd(den,z),set4(4.328810604912902668951E2));
+		den=_mm256_add_pd(_mm256_mul_pd(den,z),set4(4.853903996359136964868E2));
+		den=_mm256_add_pd(_mm256_mul_pd(den,z),set4(1.945506571482613964425E2));
+		z=_mm256_div_pd(_mm256_mul_pd(z,num),den);
+		z=_mm256_add_pd(_mm256_mul_pd(x,z),x);
+		z=_mm256_add_pd(z,more);
+		return _mm256_add_pd(y0,z);
+	};
+
+	// FlowColor::exp(), the power of two is built in the exponent bits as ldexp() does
+	static inline SIMD_AVX2 __m256d exp4(__m256d x)
+	{
+		__m256d n=_mm256_floor_pd(_mm256_add_pd(_mm256_mul_pd(set4(1.4426950408889634073599),x),set4(0.5)));
+		x=_mm256_sub_pd(x,_mm256_mul_pd(n,set4(6.93145751953125E-1)));
+		x=_mm256_sub_pd(x,_mm256_mul_pd(n,set4(1.42860682030941723212E-6)));
+		__m256d xx=_mm256_mul_pd(x,x);
+		__m256d p=_mm256_add_pd(_mm256_mul_pd(set4(1.26177193074810590878E-4),xx),set4(3.02994407707441961300E-2));
+		p=_mm256_mul_pd(x,_mm256_add_pd(_mm256_mul_pd(p,xx),set4(9.99999999999999999910E-1)));
+		__m256d q=_mm256_add_pd(_mm256_mul_pd(set4(3.00198505138664455042E-6),xx),set4(2.52448340349684104192E-3));
+		q=_mm256_add_pd(_mm256_mul_pd(q,xx),set4(2.27265548208155028766E-1));
+		q=_mm256_add_pd(_mm256_mul_pd(q,xx),set4(2.00000000000000000009E0));
+		x=_mm256_div_pd(p,_mm256_sub_pd(q,p));
+		x=_mm256_add_pd(set4(1),_mm256_mul_pd(set4(2),x));
+		__m256i exponent=_mm256_slli_epi64(_mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n)),_mm256_set1_epi64x(1023)),52);
+		return _mm256_mul_pd(x,_mm256_castsi256_pd(exponent));
+	};
+
+	// FlowColor::tanh()
+	static inline SIMD_AVX2 __m256d tanh4(__m256d x)
+	{
+		__m256d e=exp4(_mm256_mul_pd(set4(-2),_mm256_min_pd(x,set4(20))));
+		return _mm256_div_pd(_mm256_sub_pd(set4(1),e),_mm256_add_pd(set4(1),e));
+	};
+
+	// FlowColor::hue2rgb()
+	static inline SIMD_AVX2 __m256d hue2rgb4(__m256d p,__m256d q,__m256d t)
+	{
+		const __m256d one=set4(1);
+		t=select4(_mm256_cmp_pd(t,_mm256_setzero_pd(),_CMP_LT_OQ),_mm256_add_pd(t,one),t);
+		t=select4(_mm256_cmp_pd(t,one,_CMP_GT_OQ),_mm256_sub_pd(t,one),t);
+		__m256d d=_mm256_sub_pd(q,p);
+		__m256d rising=_mm256_add_pd(p,_mm256_mul_pd(_mm256_mul_pd(d,set4(6)),t));
+		__m256d falling=_mm256_add_pd(p,_mm256_mul_pd(_mm256_mul_pd(d,_mm256_sub_pd(set4(2./3),t)),set4(6)));
+		__m256d value=select4(_mm256_cmp_pd(t,set4(2./3),_CMP_LT_OQ),falling,p);
+		value=select4(_mm256_cmp_pd(t,set4(1./2),_CMP_LT_OQ),q,value);
+		return select4(_mm256_cmp_pd(t,set4(1./6),_CMP_LT_OQ),rising,value);
+	};
+
+	template <class T>
+	static SIMD_AVX2 int flowColorAVX2(T* pNorm,T* pAngle,T* pR,T* pG,T* pB,const T* pVx,const T* pVy,int nPixels,double maxFlow,bool IsSaturated)
+	{
+		const __m256d absMask=_mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+		const __m256d zero=_mm256_setzero_pd();
+		int i;
+		for(i=0;i+4<=nPixels;i+=4)
+		{
+			__m256d norm,angle;
+			if(pVx!=NULL)
+			{
+				__m256d x=load4(pVx+i);
+				__m256d y=load4(pVy+i);
+				norm=round4(_mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(y,y),_mm256_mul_pd(x,x))),pVx);
+				__m256d h=_mm256_mul_pd(atan4(_mm256_div_pd(_mm256_and_pd(y,absMask),_mm256_and_pd(x,absMask))),set4(180/M_PI));
+				__m256d yPositive=_mm256_cmp_pd(y,zero,_CMP_GE_OQ);
+				angle=select4(_mm256_cmp_pd(x,zero,_CMP_GT_OQ),
+								  select4(yPositive,h,_mm256_sub_pd(set4(360),h)),
+								  select4(yPositive,_mm256_sub_pd(set4(180),h),_mm256_add_pd(set4(180),h)));
+				angle=round4(select4(_mm256_cmp_pd(x,zero,_CMP_EQ_OQ),select4(yPositive,set4(90),set4(270)),angle),pVx);
+				store4(pNorm+i,norm);
+				store4(pAngle+i,angle);
+			}
+			else
+			{
+				norm=load4(pNorm+i);
+				angle=load4(pAngle+i);
+			}
+			if(pR==NULL)
+				continue;
+			__m256d s=_mm256_div_pd(norm,set4(maxFlow));
+			if(IsSaturated)
+				s=tanh4(s);
+			__m256d l=_mm256_add_pd(_mm256_mul_pd(s,set4(-0.5)),set4(1));
+			__m256d q=_mm256_sub_pd(_mm256_add_pd(l,s),_mm256_mul_pd(l,s));
+			__m256d p=_mm256_sub_pd(_mm256_mul_pd(set4(2),l),q);
+			__m256d hue=_mm256_div_pd(angle,set4(360));
+			store4(pR+i,hue2rgb4(p,q,_mm256_add_pd(hue,set4(1./3))));
+			store4(pG+i,hue2rgb4(p,q,hue));
+			store4(pB+i,hue2rgb4(p,q,_mm256_sub_pd(hue,set4(1./3))));
+		}
+		return i;
+	};
+
+	template <class T>
+	static inline int flowColorSIMD(T* pNorm,T* pAngle,T* pR,T* pG,T* pB,const T* pVx,const T* pVy,int nPixels,double maxFlow,bool IsSaturated)
+	{
+		if(SIMD::level()>=SIMD::AVX2)
+			return flowColorAVX2(pNorm,pAngle,pR,pG,pB,pVx,pVy,nPixels,maxFlow,IsSaturated);
+		return 0;
+	};
+	#undef SIMD_AVX2
+	#undef SIMD_AVX512
+#else
+private:
+	template <class T>
+	static inline int warpImageRowSIMD(T* pWarpIm2,const T* pIm1,const T* pIm2,const T* pVx,const T* pVy,int i,int width,int height,int nChannels) {return 0;};
+	template <class T>
+	static inline int filterLineSIMD(const T* const* pLines,T* pDstLine,int length,const double* pfilter1D,int nTaps) {return 0;};
+	template <class T>
+	static inline int splitFlowSIMD(const float* pFlow,T* pVx,T* pVy,int nPixels,double maxFlow) {return 0;};
+	template <class T>
+	static inline int flowColorSIMD(T* pNorm,T* pAngle,T* pR,T* pG,T* pB,const T* pVx,const T* pVy,int nPixels,double maxFlow,bool IsSaturated) {return 0;};
+#endif
+};
+
+inline int ImageProcessingSIMD::warpImageRow(double* pWarpIm2,const double* pIm1,const double* pIm2,const double* pVx,const double* pVy,int i,int width,int height,int nChannels)
+{
+	return warpImageRowSIMD(pWarpIm2,pIm1,pIm2,pVx,pVy,i,width,height,nChannels);
+}
+
+inline int ImageProcessingSIMD::warpImageRow(float* pWarpIm2,const float* pIm1,const float* pIm2,const float* pVx,const float* pVy,int i,int width,int height,int nChannels)
+{
+	return warpImageRowSIMD(pWarpIm2,pIm1,pIm2,pVx,pVy,i,width,height,nChannels);
+}
+
+inline int ImageProcessingSIMD::filterLine(const double* const* pLines,double* pDstLine,int length,const double* pfilter1D,int nTaps)
+{
+	return filterLineSIMD(pLines,pDstLine,length,pfilter1D,nTaps);
+}
+
+inline int ImageProcessingSIMD::filterLine(const float* const* pLines,float* pDstLine,int length,const double* pfilter1D,int nTaps)
+{
+	return filterLineSIMD(pLines,pDstLine,length,pfilter1D,nTaps);
+}
+
+inline int ImageProcessingSIMD::splitFlow(const float* pFlow,float* pVx,float* pVy,int nPixels,double maxFlow)
+{
+	return splitFlowSIMD(pFlow,pVx,pVy,nPixels,maxFlow);
+}
+
+inline int ImageProcessingSIMD::splitFlow(const float* pFlow,double* pVx,double* pVy,int nPixels,double maxFlow)
+{
+	return splitFlowSIMD(pFlow,pVx,pVy,nPixels,maxFlow);
+}
+
+inline int ImageProcessingSIMD::flowColor(float* pNorm,float* pAngle,float* pR,float* pG,float* pB,const float* pVx,const float* pVy,int nPixels,double maxFlow,bool IsSaturated)
+{
+	return flowColorSIMD(pNorm,pAngle,pR,pG,pB,pVx,pVy,nPixels,maxFlow,IsSaturated);
+}
+
+inline int ImageProcessingSIMD::flowColor(double* pNorm,double* pAngle,double* pR,double* pG,double* pB,const double* pVx,const double* pVy,int nPixels,double maxFlow,bool IsSaturated)
+{
+	return flowColorSIMD(pNorm,pAngle,pR,pG,pB,pVx,pVy,nPixels,maxFlow,IsSaturated);
+}
+
+#endif
@@ -0,0 +1,391 @@
+#include "MultigridSolver.h"
+#include "math.h"
+
+template <class T>
+MultigridSolver<T>::MultigridSolver(void)
+{
+	pA11=pA12=pA22=pWh=pWv=pDu=pDv=pB1=pB2=pR1=pR2=NULL;
+	nLevels=0;
+	nCycles=0;
+}
+
+template <class T>
+MultigridSolver<T>::~MultigridSolver(void)
+{
+	allocateLevels(0);
+}
+
+template <class T>
+void MultigridSolver<T>::allocateLevels(int levels)
+{
+	if(levels==nLevels)
+		return;
+	if(pA11!=NULL)
+	{
+		delete []pA11;
+		delete []pA12;
+		delete []pA22;
+		delete []pWh;
+		delete []pWv;
+		delete []pDu;
+		delete []pDv;
+		delete []pB1;
+		delete []pB2;
+		delete []pR1;
+		delete []pR2;
+		pA11=pA12=pA22=pWh=pWv=pDu=pDv=pB1=pB2=pR1=pR2=NULL;
+	}
+	nLevels=levels;
+	if(nLevels==0)
+		return;
+	pA11=new Image<T>[nLevels];
+	pA12=new Image<T>[nLevels];
+	pA22=new Image<T>[nLevels];
+	pWh=new Image<T>[nLevels];
+	pWv=new Image<T>[nLevels];
+	pDu=new Image<T>[nLevels];
+	pDv=new Image<T>[nLevels];
+	pB1=new Image<T>[nLevels];
+	pB2=new Image<T>[nLevels];
+	pR1=new Image<T>[nLevels];
+	pR2=new Image<T>[nLevels];
+}
+
+//---------------------------------------------------------------------------------------
+// function to build the hierarchy of the linear system
+// the finest level uses the same discretization as OpticalFlow::Laplacian(), i.e. the
+// weight of pixel (i,j) is shared by the edges (i,j)-(i,j+1) and (i,j)-(i+1,j)
+//---------------------------------------------------------------------------------------
+template <class T>
+void MultigridSolver<T>::ConstructHierarchy(const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,const Image<T>& phi,double alpha,int minWidth)
+{
+	int width=A11.width(),height=A11.height();
+	// first decide how many levels
+	int levels=1;
+	while(__min(width,height)>=minWidth*2)
+	{
+		width=(width+1)/2;
+		height=(height+1)/2;
+		levels++;
+	}
+	allocateLevels(levels);
+
+	width=A11.width();
+	height=A11.height();
+	pA11[0].copyData(A11);
+	pA12[0].copyData(A12);
+	pA22[0].copyData(A22);
+	if(pWh[0].matchDimension(phi)==false)
+	{
+		pWh[0].allocate(width,height);
+		pWv[0].allocate(width,height);
+	}
+	const T* phiData=phi.data();
+	T* whData=pWh[0].data();
+	T* wvData=pWv[0].data();
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			whData[offset]=(j<width-1)?alpha*phiData[offset]:0;
+			wvData[offset]=(i<height-1)?alpha*phiData[offset]:0;
+		}
+	for(int k=1;k<nLevels;k++)
+		coarsen(k);
+}
+
+//---------------------------------------------------------------------------------------
+// function to build level k from level k-1
+// the data term is summed over each 2x2 block, and the weight of a coarse edge is the
+// average of the fine edges it covers
+//---------------------------------------------------------------------------------------
+template <class T>
+void MultigridSolver<T>::coarsen(int k)
+{
+	int width=pA11[k-1].width(),height=pA11[k-1].height();
+	int Width=(width+1)/2,Height=(height+1)/2;
+	Image<T>* images[5]={pA11+k,pA12+k,pA22+k,pWh+k,pWv+k};
+	for(int l=0;l<5;l++)
+		if(images[l]->width()!=Width || images[l]->height()!=Height)
+			images[l]->allocate(Width,Height);
+		else
+			images[l]->reset();
+
+	const T *a11=pA11[k-1].data(),*a12=pA12[k-1].data(),*a22=pA22[k-1].data();
+	const T *wh=pWh[k-1].data(),*wv=pWv[k-1].data();
+	T *A11=pA11[k].data(),*A12=pA12[k].data(),*A22=pA22[k].data();
+	T *Wh=pWh[k].data(),*Wv=pWv[k].data();
+
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			int Offset=(i/2)*Width+j/2;
+			A11[Offset]+=a11[offset];
+			A12[Offset]+=a12[offset];
+			A22[Offset]+=a22[offset];
+		}
+	for(int I=0;I<Height;I++)
+		for(int J=0;J<Width;J++)
+		{
+			int Offset=I*Width+J;
+			int nRows=(2*I+1<height)?2:1;
+			int nCols=(2*J+1<width)?2:1;
+			if(J<Width-1)
+			{
+				for(int i=2*I;i<2*I+nRows;i++)
+					Wh[Offset]+=wh[i*width+2*J+1];
+				Wh[Offset]/=nRows;
+			}
+			if(I<Height-1)
+			{
+				for(int j=2*J;j<2*J+nCols;j++)
+					Wv[Offset]+=wv[(2*I+1)*width+j];
+				Wv[Offset]/=nCols;
+			}
+		}
+}
+
+//---------------------------------------------------------------------------------------
+// red-black block Gauss-Seidel relaxation
+// the 2x2 system of each pixel is solved exactly given the current values of its neighbors
+//---------------------------------------------------------------------------------------
+template <class T>
+void MultigridSolver<T>::Relax(Image<T>& du,Image<T>& dv,const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,const Image<T>& wh,const Image<T>& wv,
+												const Image<T>& b1,const Image<T>& b2,int nIterations)
+{
+	int width=du.width(),height=du.height();
+	T *duData=du.data(),*dvData=dv.data();
+	const T *a11=A11.data(),*a12=A12.data(),*a22=A22.data();
+	const T *whData=wh.data(),*wvData=wv.data();
+	const T *b1Data=b1.data(),*b2Data=b2.data();
+
+	for(int count=0;count<nIterations;count++)
+		for(int color=0;color<2;color++)
+			for(int i=0;i<height;i++)
+				for(int j=(i+color)%2;j<width;j+=2)
+				{
+					int offset=i*width+j;
+					double diag=0,sigma1=0,sigma2=0,w;
+					if(j>0)
+					{
+						w=whData[offset-1];
+						diag+=w;
+						sigma1+=w*duData[offset-1];
+						sigma2+=w*dvData[offset-1];
+					}
+					if(j<width-1)
+					{
+						w=whData[offset];
+						diag+=w;
+						sigma1+=w*duData[offset+1];
+						sigma2+=w*dvData[offset+1];
+					}
+					if(i>0)
+					{
+						w=wvData[offset-width];
+						diag+=w;
+						sigma1+=w*duData[offset-width];
+						sigma2+=w*dvData[offset-width];
+					}
+					if(i<height-1)
+					{
+						w=wvData[offset];
+						diag+=w;
+						sigma1+=w*duData[offset+width];
+						sigma2+=w*dvData[offset+width];
+					}
+					double m11=a11[offset]+diag,m12=a12[offset],m22=a22[offset]+diag;
+					double r1=b1Data[offset]+sigma1,r2=b2Data[offset]+sigma2;
+					double det=m11*m22-m12*m12;
+					duData[offset]=(m22*r1-m12*r2)/det;
+					dvData[offset]=(m11*r2-m12*r1)/det;
+				}
+}
+
+//---------------------------------------------------------------------------------------
+// function to compute r=b-M*x and return the squared norm of r
+//---------------------------------------------------------------------------------------
+template <class T>
+double MultigridSolver<T>::Residual(Image<T>& r1,Image<T>& r2,const Image<T>& du,const Image<T>& dv,const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,
+												const Image<T>& wh,const Image<T>& wv,const Image<T>& b1,const Image<T>& b2)
+{
+	int width=du.width(),height=du.height();
+	if(r1.matchDimension(du)==false)
+		r1.allocate(width,height);
+	if(r2.matchDimension(du)==false)
+		r2.allocate(width,height);
+	const T *duData=du.data(),*dvData=dv.data();
+	const T *a11=A11.data(),*a12=A12.data(),*a22=A22.data();
+	const T *whData=wh.data(),*wvData=wv.data();
+	const T *b1Data=b1.data(),*b2Data=b2.data();
+	T *r1Data=r1.data(),*r2Data=r2.data();
+	double norm=0;
+
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double u=duData[offset],v=dvData[offset],w;
+			double q1=a11[offset]*u+a12[offset]*v;
+			double q2=a12[offset]*u+a22[offset]*v;
+			if(j>0)
+			{
+				w=whData[offset-1];
+				q1+=w*(u-duData[offset-1]);
+				q2+=w*(v-dvData[offset-1]);
+			}
+			if(j<width-1)
+			{
+				w=whData[offset];
+				q1+=w*(u-duData[offset+1]);
+				q2+=w*(v-dvData[offset+1]);
+			}
+			if(i>0)
+			{
+				w=wvData[offset-width];
+				q1+=w*(u-duData[offset-width]);
+				q2+=w*(v-dvData[offset-width]);
+			}
+			if(i<height-1)
+			{
+				w=wvData[offset];
+				q1+=w*(u-duData[offset+width]);
+				q2+=w*(v-dvData[offset+width]);
+			}
+			r1Data[offset]=b1Data[offset]-q1;
+			r2Data[offset]=b2Data[offset]-q2;
+			norm+=r1Data[offset]*r1Data[offset]+r2Data[offset]*r2Data[offset];
+		}
+	return norm;
+}
+
+//---------------------------------------------------------------------------------------
+// function to restrict the residual of level k to the right hand side of level k+1
+//---------------------------------------------------------------------------------------
+template <class T>
+void MultigridSolver<T>::restrictResidual(int k)
+{
+	// the sizes of the levels are the ones of the system: in full multigrid the right hand
+	// sides are restricted before the corrections of the coarse levels are sized
+	int width=pA11[k].width(),height=pA11[k].height();
+	int Width=pA11[k+1].width(),Height=pA11[k+1].height();
+	if(pB1[k+1].width()!=Width || pB1[k+1].height()!=Height)
+	{
+		pB1[k+1].allocate(Width,Height);
+		pB2[k+1].allocate(Width,Height);
+	}
+	else
+	{
+		pB1[k+1].reset();
+		pB2[k+1].reset();
+	}
+	const T *r1Data=pR1[k].data(),*r2Data=pR2[k].data();
+	T *B1=pB1[k+1].data(),*B2=pB2[k+1].data();
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			int Offset=(i/2)*Width+j/2;
+			B1[Offset]+=r1Data[offset];
+			B2[Offset]+=r2Data[offset];
+		}
+}
+
+//---------------------------------------------------------------------------------------
+// function to add the correction of level k+1 to level k
+//---------------------------------------------------------------------------------------
+template <class T>
+void MultigridSolver<T>::prolongate(int k)
+{
+	int width=pA11[k].width(),height=pA11[k].height();
+	int Width=pA11[k+1].width();
+	T *du=pDu[k].data(),*dv=pDv[k].data();
+	const T *Du=pDu[k+1].data(),*Dv=pDv[k+1].data();
+	for(int i=0;i<height;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			int Offset=(i/2)*Width+j/2;
+			du[offset]+=Du[Offset];
+			dv[offset]+=Dv[Offset];
+		}
+}
+
+//---------------------------------------------------------------------------------------
+// function to set the right hand side of the finest level to (b1,b2), and to restrict it
+// to the levels 1 to nRestrictedLevels-1, as full multigrid starts from
+//---------------------------------------------------------------------------------------
+template <class T>
+void MultigridSolver<T>::RestrictRightHandSide(const Image<T>& b1,const Image<T>& b2,int nRestrictedLevels)
+{
+	pB1[0].copyData(b1);
+	pB2[0].copyData(b2);
+	for(int k=0;k<__min(nRestrictedLevels,nLevels)-1;k++)
+	{
+		pR1[k].copyData(pB1[k]);
+		pR2[k].copyData(pB2[k]);
+		restrictResidual(k);
+	}
+}
+
+template <class T>
+void MultigridSolver<T>::VCycle(int k,int nPreSmoothing,int nPostSmoothing)
+{
+	if(k==nLevels-1)
+	{
+		// the coarsest level is small enough to be solved by relaxation only
+		Relax(pDu[k],pDv[k],pA11[k],pA12[k],pA22[k],pWh[k],pWv[k],pB1[k],pB2[k],__max(pDu[k].width(),pDu[k].height())*2);
+		return;
+	}
+	Relax(pDu[k],pDv[k],pA11[k],pA12[k],pA22[k],pWh[k],pWv[k],pB1[k],pB2[k],nPreSmoothing);
+	Residual(pR1[k],pR2[k],pDu[k],pDv[k],pA11[k],pA12[k],pA22[k],pWh[k],pWv[k],pB1[k],pB2[k]);
+	restrictResidual(k);
+	pDu[k+1].setValue(0,pB1[k+1].width(),pB1[k+1].height());
+	pDv[k+1].setValue(0,pB1[k+1].width(),pB1[k+1].height());
+	VCycle(k+1,nPreSmoothing,nPostSmoothing);
+	prolongate(k);
+	Relax(pDu[k],pDv[k],pA11[k],pA12[k],pA22[k],pWh[k],pWv[k],pB1[k],pB2[k],nPostSmoothing);
+}
+
+//---------------------------------------------------------------------------------------
+// function to solve the system with V-cycles, starting from du=dv=0
+// if IsFMG is true, the initial guess is obtained by full multigrid, i.e. solving the
+// coarsest level first and refining it with one V-cycle per level
+// at most nMaxCycles cycles are run, they stop once the residual norm is below tolerance
+// times the initial one
+// the function returns the squared norm of the final residual
+//---------------------------------------------------------------------------------------
+template <class T>
+double MultigridSolver<T>::Solve(Image<T>& du,Image<T>& dv,const Image<T>& b1,const Image<T>& b2,int nMaxCycles,int nPreSmoothing,int nPostSmoothing,bool IsFMG,double tolerance)
+{
+	RestrictRightHandSide(b1,b2,IsFMG?nLevels:1);
+	pDu[0].setValue(0,b1.width(),b1.height());
+	pDv[0].setValue(0,b1.width(),b1.height());
+
+	if(IsFMG && nLevels>1)
+	{
+		pDu[nLevels-1].setValue(0,pB1[nLevels-1].width(),pB1[nLevels-1].height());
+		pDv[nLevels-1].setValue(0,pB1[nLevels-1].width(),pB1[nLevels-1].height());
+		VCycle(nLevels-1,nPreSmoothing,nPostSmoothing);
+		for(int k=nLevels-2;k>=0;k--)
+		{
+			// the V-cycle of level k only overwrites the right hand side of the coarser levels
+			pDu[k].setValue(0,pB1[k].width(),pB1[k].height());
+			pDv[k].setValue(0,pB1[k].width(),pB1[k].height());
+			prolongate(k);
+			VCycle(k,nPreSmoothing,nPostSmoothing);
+		}
+	}
+
+	double rou0=pB1[0].norm2()+pB2[0].norm2();
+	double rou=Residual(pR1[0],pR2[0],pDu[0],pDv[0],pA11[0],pA12[0],pA22[0],pWh[0],pWv[0],pB1[0],pB2[0]);
+	for(nCycles=0;nCycles<nMaxCycles && rou>=1E-10 && rou>=tolerance*tolerance*rou0;nCycles++)
+	{
+		VCycle(0,nPreSmoothing,nPostSmoothing);
+		rou=Residual(pR1[0],pR2[0],pDu[0],pDv[0],pA11[0],pA12[0],pA22[0],pWh[0],pWv[0],pB1[0],pB2[0]);
+	}
+	du.copyData(pDu[0]);
+	dv.copyData(pDv[0]);
+	return rou;
+}
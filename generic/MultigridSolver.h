@@ -0,0 +1,59 @@
+#ifndef _MultigridSolver_h
+#define _MultigridSolver_h
+
+#include "Image.h"
+
+//---------------------------------------------------------------------------------------
+// geometric multigrid solver for the linear system of SmoothFlowPDE
+//
+//		[A11+alpha*L	A12				] [du]	 [b1]
+//		[A12			A22+alpha*L		] [dv] = [b2]
+//
+// where L is the Laplacian weighted by Phi_1st. Each level stores the data term and the
+// weights of the horizontal and vertical edges; coarser levels are built by aggregating
+// 2x2 blocks of pixels. T is the type of the pixels (float or double).
+//---------------------------------------------------------------------------------------
+template <class T>
+class MultigridSolver
+{
+private:
+	Image<T>* pA11;
+	Image<T>* pA12;
+	Image<T>* pA22;
+	Image<T>* pWh;
+	Image<T>* pWv;
+	Image<T>* pDu;
+	Image<T>* pDv;
+	Image<T>* pB1;
+	Image<T>* pB2;
+	// the residual of each level, restricted to the right hand side of the next one
+	Image<T>* pR1;
+	Image<T>* pR2;
+	int nLevels;
+	int nCycles;
+	void allocateLevels(int levels);
+	void coarsen(int level);
+	void VCycle(int level,int nPreSmoothing,int nPostSmoothing);
+	void restrictResidual(int level);
+	void prolongate(int level);
+public:
+	MultigridSolver(void);
+	~MultigridSolver(void);
+	void ConstructHierarchy(const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,const Image<T>& phi,double alpha,int minWidth=4);
+	void RestrictRightHandSide(const Image<T>& b1,const Image<T>& b2,int nRestrictedLevels);
+	double Solve(Image<T>& du,Image<T>& dv,const Image<T>& b1,const Image<T>& b2,int nMaxCycles,int nPreSmoothing=2,int nPostSmoothing=2,bool IsFMG=false,double tolerance=0);
+	inline int nlevels() const {return nLevels;};
+	// the number of V-cycles on the finest level that the last Solve() ran, which stops early
+	// once the tolerance is met (the V-cycles of the full multigrid initial guess are not counted)
+	inline int ncycles() const {return nCycles;};
+	// the right hand side of level k (the V-cycles overwrite the ones of the coarse levels)
+	inline const Image<T>& rhs1(int k) const {return pB1[k];};
+	inline const Image<T>& rhs2(int k) const {return pB2[k];};
+
+	static void Relax(Image<T>& du,Image<T>& dv,const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,const Image<T>& wh,const Image<T>& wv,
+								const Image<T>& b1,const Image<T>& b2,int nIterations);
+	static double Residual(Image<T>& r1,Image<T>& r2,const Image<T>& du,const Image<T>& dv,const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,
+								const Image<T>& wh,const Image<T>& wv,const Image<T>& b1,const Image<T>& b2);
+};
+
+#endif
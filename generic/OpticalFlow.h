@@ -2,6 +2,54 @@
 #define _OpticalFlow_h
 
 #include "Image.h"
+#include "ThreadPool.h"
+#include "GaussianPyramid.h"
+#include "FlowWorkspace.h"
+#include "FlowProfile.h"
+
+//---------------------------------------------------------------------------------------
+// parameters of the linear solver used in the inner fixed point iterations, and of the
+// coarse to fine iterations
+//---------------------------------------------------------------------------------------
+class SolverPara
+{
+public:
+	enum SolverType{CG,Multigrid,PCG,SOR};
+	SolverType solver;
+	double tolerance;				// stop when the residual norm is reduced by this factor (0: disabled)
+	int nCycles;					// number of V-cycles for multigrid
+	int nPreSmoothing,nPostSmoothing;	// number of relaxation sweeps before and after the coarse grid correction
+	bool IsFMG;						// start the V-cycles from a full multigrid initial guess
+	int nSORIterations;				// number of red-black SOR sweeps
+	double omega;					// relaxation factor of SOR
+	int nThreads;					// number of threads of SmoothFlowPDE (0: all the cores)
+	// when the flow is initialized with a prior flow field (warm start)
+	int nWarmSkipLevels;			// number of the coarsest levels that are skipped
+	int nWarmOuterFPIterations;		// number of outer fixed point iterations (0: unchanged)
+	// early termination of the fixed point iterations (0: disabled)
+	double outerTolerance;			// stop the outer iterations of a level when the RMS of the update of the flow is below outerTolerance*(1+RMS of the flow)
+	double innerTolerance;			// stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS of the update)
+	int nMinOuterFPIterations;		// number of outer iterations before the test
+	bool IsAdaptiveBudget;			// limit the outer iterations of a level to one more than the coarser level needed
+	FlowProfile* pProfile;			// where the time of the stages is recorded (NULL: not recorded)
+	SolverPara(void)
+	{
+		solver=CG;
+		tolerance=0;
+		nCycles=3;
+		nPreSmoothing=nPostSmoothing=2;
+		IsFMG=false;
+		nSORIterations=30;
+		omega=1.8;
+		nThreads=1;
+		nWarmSkipLevels=0;
+		nWarmOuterFPIterations=0;
+		outerTolerance=innerTolerance=0;
+		nMinOuterFPIterations=1;
+		IsAdaptiveBudget=false;
+		pProfile=NULL;
+	};
+};
 
 class OpticalFlow
 {
@@ -11,21 +59,95 @@ public:
 	OpticalFlow(void);
 	~OpticalFlow(void);
 public:
-	static void getDxs(DImage& imdx,DImage& imdy,DImage& imdt,const DImage& im1,const DImage& im2);
-	static void SanityCheck(const DImage& imdx,const DImage& imdy,const DImage& imdt,double du,double dv);
-	static void warpFL(DImage& warpIm2,const DImage& Im1,const DImage& Im2,const DImage& vx,const DImage& vy);
+	template <class T>
+	static void getDxs(Image<T>& imdx,Image<T>& imdy,Image<T>& imdt,const Image<T>& im1,const Image<T>& im2);
+	// the same, with the scratch images for the smoothed frames and the filtering
+	template <class T>
+	static void getDxs(Image<T>& imdx,Image<T>& imdy,Image<T>& imdt,const Image<T>& im1,const Image<T>& im2,Image<T>& Im1,Image<T>& Im2,Image<T>& buffer);
+	template <class T>
+	static void SanityCheck(const Image<T>& imdx,const Image<T>& imdy,const Image<T>& imdt,double du,double dv);
+	template <class T>
+	static void warpFL(Image<T>& warpIm2,const Image<T>& Im1,const Image<T>& Im2,const Image<T>& vx,const Image<T>& vy);
 	static void genConstFlow(DImage& flow,double value,int width,int height);
-	static void genInImageMask(DImage& mask,const DImage& vx,const DImage& vy);
-	static void SmoothFlowPDE(const DImage& Im1,const DImage& Im2, DImage& warpIm2,DImage& vx,DImage& vy,
-														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations);
-	static void Laplacian(DImage& output,const DImage& input,const DImage& weight);
+	template <class T>
+	static void genInImageMask(Image<T>& mask,const Image<T>& vx,const Image<T>& vy);
+	// function to generate the mask of the pixels whose flow (vx,vy) is consistent with the backward flow
+	// (backVx,backVy) where it moves to: |v+back|^2<=ratio*(|v|^2+|back|^2)+offset (1), or that are occluded
+	// or move out of the image (0)
+	template <class T>
+	static void genConsistencyMask(Image<T>& mask,const Image<T>& vx,const Image<T>& vy,const Image<T>& backVx,const Image<T>& backVy,ThreadPool& pool,
+															double ratio=0.01,double offset=0.5);
+	// the functions return the number of outer fixed point iterations that were run
+	template <class T>
+	static int SmoothFlowPDE(const Image<T>& Im1,const Image<T>& Im2, Image<T>& warpIm2,Image<T>& vx,Image<T>& vy,
+														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para=SolverPara());
+	template <class T>
+	static int SmoothFlowPDE(const Image<T>& Im1,const Image<T>& Im2, Image<T>& warpIm2,Image<T>& vx,Image<T>& vy,
+														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para,ThreadPool& pool);
+	// the same, with the temporary images taken from the workspace
+	template <class T>
+	static int SmoothFlowPDE(const Image<T>& Im1,const Image<T>& Im2, Image<T>& warpIm2,Image<T>& vx,Image<T>& vy,
+														 double alpha,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para,ThreadPool& pool,
+														 FlowWorkspace<T>& workspace);
+	template <class T>
+	static void Laplacian(Image<T>& output,const Image<T>& input,const Image<T>& weight);
+	template <class T>
+	static void Laplacian(Image<T>& output,const Image<T>& input,const Image<T>& weight,ThreadPool& pool);
+	// the same for two images with the same weight, e.g. the two components of the flow field
+	template <class T>
+	static void Laplacian(Image<T>& output1,Image<T>& output2,const Image<T>& input1,const Image<T>& input2,const Image<T>& weight,ThreadPool& pool);
+	template <class T>
+	static void genBlockJacobi(Image<T>& M11,Image<T>& M12,Image<T>& M22,const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,const Image<T>& weight,double alpha);
+	template <class T>
+	static void RedBlackSOR(Image<T>& du,Image<T>& dv,const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,const Image<T>& b1,const Image<T>& b2,
+													const Image<T>& weight,double alpha,int nIterations,double omega);
+	template <class T>
+	static void RedBlackSOR(Image<T>& du,Image<T>& dv,const Image<T>& A11,const Image<T>& A12,const Image<T>& A22,const Image<T>& b1,const Image<T>& b2,
+													const Image<T>& weight,double alpha,int nIterations,double omega,ThreadPool& pool);
+	template <class T>
+	static void applyBlockJacobi(Image<T>& z1,Image<T>& z2,const Image<T>& r1,const Image<T>& r2,const Image<T>& M11,const Image<T>& M12,const Image<T>& M22);
 	static void testLaplacian(int dim=3);
 
 	// function of coarse to fine optical flow
-	static void Coarse2FineFlow(DImage& vx,DImage& vy,DImage &warpI2,const DImage& Im1,const DImage& Im2,double alpha,double ratio,int minWidth,
-															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations);
-	// function to convert image to features
-	static void im2feature(DImage& imfeature,const DImage& im);
+	// the thread pool, the pyramids and the buffers are kept across the calls of a thread (see FlowCache)
+	template <class T>
+	static void Coarse2FineFlow(Image<T>& vx,Image<T>& vy,Image<T> &warpI2,const Image<T>& Im1,const Image<T>& Im2,double alpha,double ratio,int minWidth,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para=SolverPara());
+	// the same, initialized with the prior flow field (pInitVx,pInitVy) of any size, e.g. the flow of the
+	// previous frame of a video (no prior if NULL, or if the two components differ in size); vx is
+	// scaled with the width and vy with the height
+	template <class T>
+	static void Coarse2FineFlow(Image<T>& vx,Image<T>& vy,Image<T> &warpI2,const Image<T>& Im1,const Image<T>& Im2,const Image<T>* pInitVx,const Image<T>* pInitVy,
+															double alpha,double ratio,int minWidth,int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para=SolverPara());
+	// coarse to fine optical flow from the pyramids of the two images and the features of their levels
+	// workspaces has one workspace per level of the pyramids, that can be kept across calls (temporary
+	// ones if NULL)
+	template <class T>
+	static void Coarse2FineFlow(Image<T>& vx,Image<T>& vy,Image<T> &warpI2,GaussianPyramid<T>& GPyramid1,GaussianPyramid<T>& GPyramid2,
+															const Image<T>* Features1,const Image<T>* Features2,double alpha,double ratio,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para,ThreadPool& pool,
+															const Image<T>* pInitVx=NULL,const Image<T>* pInitVy=NULL,FlowWorkspace<T>* workspaces=NULL);
+	// function of coarse to fine optical flow in both directions, from Im1 to Im2 (vx,vy) and from Im2 to Im1
+	// (backVx,backVy), warpI1 being Im1 warped by the backward flow
+	// the pyramids and the features are built once for the two flows, which are then computed concurrently,
+	// each with half of para.nThreads threads (the pools and the buffers are kept as by Coarse2FineFlow())
+	template <class T>
+	static void Coarse2FineFlowBidirectional(Image<T>& vx,Image<T>& vy,Image<T>& warpI2,Image<T>& backVx,Image<T>& backVy,Image<T>& warpI1,
+															const Image<T>& Im1,const Image<T>& Im2,double alpha,double ratio,int minWidth,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para=SolverPara());
+	// function of coarse to fine optical flow for a batch of nPairs image pairs
+	// the pairs are processed concurrently by para.nThreads threads, one thread per pair
+	template <class T>
+	static void Coarse2FineFlowBatch(Image<T>* vx,Image<T>* vy,Image<T>* warpI2,const Image<T>* Im1,const Image<T>* Im2,int nPairs,double alpha,double ratio,int minWidth,
+															int nOuterFPIterations,int nInnerFPIterations,int nCGIterations,const SolverPara& para=SolverPara());
+	// function to convert image to features, pBuffer is the scratch of an interleaved image
+	// (3*width*height elements, temporary images if NULL)
+	template <class T>
+	static void im2feature(Image<T>& imfeature,const Image<T>& im,T* pBuffer=NULL);
+	// function to convert each level of a pyramid to features, with the scratch of interleaved
+	// levels kept in buffer (temporary images if NULL)
+	template <class T>
+	static void im2feature(Image<T>* features,GaussianPyramid<T>& pyramid,Image<T>* buffer=NULL);
 };
 
 #endif
\ No newline at end of file
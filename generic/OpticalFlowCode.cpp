@@ -1,6 +1,7 @@
 #include "OpticalFlow.h"
 #include "ImageProcessing.h"
 #include "GaussianPyramid.h"
+#include "MultigridSolver.h"
 #include <cstdlib> 
 #include <iostream>
 
@@ -19,13 +20,20 @@ OpticalFlow::~OpticalFlow(void)
 //--------------------------------------------------------------------------------------------------------
 //  function to compute dx, dy and dt for motion estimation
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::getDxs(DImage &imdx, DImage &imdy, DImage &imdt, const DImage &im1, const DImage &im2)
+template <class T>
+void OpticalFlow::getDxs(Image<T> &imdx, Image<T> &imdy, Image<T> &imdt, const Image<T> &im1, const Image<T> &im2)
 {
 	// Im1 and Im2 are the smoothed version of im1 and im2
-	DImage Im1,Im2;
+	Image<T> Im1,Im2,buffer;
+	getDxs(imdx,imdy,imdt,im1,im2,Im1,Im2,buffer);
+}
+
+template <class T>
+void OpticalFlow::getDxs(Image<T> &imdx, Image<T> &imdy, Image<T> &imdt, const Image<T> &im1, const Image<T> &im2, Image<T> &Im1, Image<T> &Im2, Image<T> &buffer)
+{
 	double gfilter[5]={0.05,0.2,0.5,0.2,0.05};
-	im1.imfilter_hv(Im1,gfilter,2,gfilter,2);
-	im2.imfilter_hv(Im2,gfilter,2,gfilter,2);
+	im1.imfilter_hv(Im1,gfilter,2,gfilter,2,buffer);
+	im2.imfilter_hv(Im2,gfilter,2,gfilter,2,buffer);
 
     //Im1.copyData(im1);
     //Im2.copyData(im2);
@@ -41,14 +49,15 @@ void OpticalFlow::getDxs(DImage &imdx, DImage &imdy, DImage &imdt, const DImage
 //--------------------------------------------------------------------------------------------------------
 // function to do sanity check: imdx*du+imdy*dy+imdt=0
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::SanityCheck(const DImage &imdx, const DImage &imdy, const DImage &imdt, double du, double dv)
+template <class T>
+void OpticalFlow::SanityCheck(const Image<T> &imdx, const Image<T> &imdy, const Image<T> &imdt, double du, double dv)
 {
 	if(imdx.matchDimension(imdy)==false || imdx.matchDimension(imdt)==false)
 	{
 		cout<<"The dimensions of the derivatives don't match!"<<endl;
 		return;
 	}
-	const double* pImDx,*pImDy,*pImDt;
+	const T* pImDx,*pImDy,*pImDt;
 	pImDx=imdx.data();
 	pImDy=imdy.data();
 	pImDt=imdt.data();
@@ -68,25 +77,29 @@ void OpticalFlow::SanityCheck(const DImage &imdx, const DImage &imdy, const DIma
 //--------------------------------------------------------------------------------------------------------
 // function to warp image based on the flow field
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::warpFL(DImage &warpIm2, const DImage &Im1, const DImage &Im2, const DImage &vx, const DImage &vy)
+template <class T>
+void OpticalFlow::warpFL(Image<T> &warpIm2, const Image<T> &Im1, const Image<T> &Im2, const Image<T> &vx, const Image<T> &vy)
 {
+	warpIm2.setPlanar(Im2.isPlanar());
 	if(warpIm2.matchDimension(Im2)==false)
 		warpIm2.allocate(Im2.width(),Im2.height(),Im2.nchannels());
-	ImageProcessing::warpImage(warpIm2.data(),Im1.data(),Im2.data(),vx.data(),vy.data(),Im2.width(),Im2.height(),Im2.nchannels());
+	for(int k=0;k<Im2.nplanes();k++)
+		ImageProcessing::warpImage(warpIm2.plane(k),Im1.plane(k),Im2.plane(k),vx.data(),vy.data(),Im2.width(),Im2.height(),Im2.planechannels());
 }
 
 //--------------------------------------------------------------------------------------------------------
 // function to generate mask of the pixels that move inside the image boundary
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::genInImageMask(DImage &mask, const DImage &vx, const DImage &vy)
+template <class T>
+void OpticalFlow::genInImageMask(Image<T> &mask, const Image<T> &vx, const Image<T> &vy)
 {
 	int imWidth,imHeight;
 	imWidth=vx.width();
 	imHeight=vx.height();
 	if(mask.matchDimension(vx)==false)
 		mask.allocate(imWidth,imHeight);
-	const double *pVx,*pVy;
-	double *pMask;
+	const T *pVx,*pVy;
+	T *pMask;
 	pVx=vx.data();
 	pVy=vy.data();
 	mask.reset();
@@ -104,6 +117,478 @@ void OpticalFlow::genInImageMask(DImage &mask, const DImage &vx, const DImage &v
 		}
 }
 
+//--------------------------------------------------------------------------------------------------------
+// function to generate the mask of the pixels whose flow is consistent with the backward flow
+// the backward flow is interpolated where the pixel moves to, and cancels the flow up to an error that
+// grows with the motion, as in the forward-backward check of Sundaram et al. (ECCV 2010)
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class ConsistencyKernel
+{
+public:
+	T* pMask;
+	const T *pVx,*pVy,*pBackVx,*pBackVy;
+	int width,height;
+	double ratio,offset;
+	void operator()(int rowStart,int rowEnd,int)
+	{
+		for(int i=rowStart;i<rowEnd;i++)
+			for(int j=0;j<width;j++)
+			{
+				int k=i*width+j;
+				double u=pVx[k],v=pVy[k];
+				double x=j+u,y=i+v;
+				pMask[k]=0;
+				// (false for a NaN flow)
+				if(!(x>=0 && x<=width-1 && y>=0 && y<=height-1))
+					continue;
+				double backU,backV;
+				ImageProcessing::BilinearInterpolate(pBackVx,width,height,1,x,y,&backU);
+				ImageProcessing::BilinearInterpolate(pBackVy,width,height,1,x,y,&backV);
+				double du=u+backU,dv=v+backV;
+				if(du*du+dv*dv<=ratio*(u*u+v*v+backU*backU+backV*backV)+offset)
+					pMask[k]=1;
+			}
+	}
+};
+
+template <class T>
+void OpticalFlow::genConsistencyMask(Image<T> &mask, const Image<T> &vx, const Image<T> &vy, const Image<T> &backVx, const Image<T> &backVy, ThreadPool& pool,
+														 double ratio, double offset)
+{
+	if(mask.matchDimension(vx)==false)
+		mask.allocate(vx.width(),vx.height());
+	if(vx.matchDimension(vy)==false || vx.matchDimension(backVx)==false || vx.matchDimension(backVy)==false)
+	{
+		cout<<"Error in image dimension matching OpticalFlow::genConsistencyMask()!"<<endl;
+		return;
+	}
+	ConsistencyKernel<T> kernel;
+	kernel.pMask=mask.data();
+	kernel.pVx=vx.data();
+	kernel.pVy=vy.data();
+	kernel.pBackVx=backVx.data();
+	kernel.pBackVy=backVy.data();
+	kernel.width=vx.width();
+	kernel.height=vx.height();
+	kernel.ratio=ratio;
+	kernel.offset=offset;
+	pool.run(kernel,kernel.height);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the RMS of the length of the flow (u,v) over the pixels, and of the difference of two flows, for the
+// convergence tests of SmoothFlowPDE
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+double flowNorm(const Image<T>& u,const Image<T>& v)
+{
+	return sqrt((u.norm2()+v.norm2())/__max(u.npixels(),1));
+}
+
+template <class T>
+double flowDistance(const Image<T>& u1,const Image<T>& v1,const Image<T>& u2,const Image<T>& v2)
+{
+	const T *pU1=u1.data(),*pV1=v1.data(),*pU2=u2.data(),*pV2=v2.data();
+	double sum=0;
+	for(int i=0;i<u1.npixels();i++)
+	{
+		double du=pU1[i]-pU2[i],dv=pV1[i]-pV2[i];
+		sum+=du*du+dv*dv;
+	}
+	return sqrt(sum/__max(u1.npixels(),1));
+}
+
+//--------------------------------------------------------------------------------------------------------
+// kernels of SmoothFlowPDE, run by the thread pool over bands of rows
+//--------------------------------------------------------------------------------------------------------
+
+// weight of the smoothness term, computed from the derivatives of the flow field (u+du,v+dv)
+template <class T>
+class PhiKernel
+{
+public:
+	const T *u,*v,*du,*dv;
+	T* phi;
+	int width,height;
+	double varepsilon;
+	void operator()(int rowStart,int rowEnd,int)
+	{
+		for(int i=rowStart;i<rowEnd;i++)
+			for(int j=0;j<width;j++)
+			{
+				int offset=i*width+j;
+				T uu=u[offset]+du[offset],vv=v[offset]+dv[offset];
+				T ux=0,uy=0,vx=0,vy=0;
+				if(j<width-1)
+				{
+					ux=(T)(u[offset+1]+du[offset+1])-uu;
+					vx=(T)(v[offset+1]+dv[offset+1])-vv;
+				}
+				if(i<height-1)
+				{
+					uy=(T)(u[offset+width]+du[offset+width])-uu;
+					vy=(T)(v[offset+width]+dv[offset+width])-vv;
+				}
+				double temp=ux*ux+uy*uy+vx*vx+vy*vy;
+				phi[offset]=1/(2*sqrt(temp+varepsilon));
+			}
+	}
+};
+
+// weight of the data term psi, and the products of the derivatives weighted by psi and
+// averaged over the channels
+template <class T>
+class DataTermKernel
+{
+public:
+	const T *imdx,*imdy,*imdt,*du,*dv;
+	T *imdx2,*imdxy,*imdy2,*imdtdx,*imdtdy;
+	int width,nChannels;
+	int pixelStep,channelStep;	// (1,nPixels) for planar images, (nChannels,1) for interleaved ones
+	double varepsilon;
+	void operator()(int rowStart,int rowEnd,int)
+	{
+		for(int i=rowStart*width;i<rowEnd*width;i++)
+		{
+			double dx2=0,dxy=0,dy2=0,dtdx=0,dtdy=0;
+			for(int k=0;k<nChannels;k++)
+			{
+				int offset=i*pixelStep+k*channelStep;
+				double temp=imdt[offset]+imdx[offset]*du[i]+imdy[offset]*dv[i];
+				T psi=1/(2*sqrt(temp*temp+varepsilon));
+				dxy+=(T)(psi*imdx[offset]*imdy[offset]);
+				dx2+=(T)(psi*imdx[offset]*imdx[offset]);
+				dy2+=(T)(psi*imdy[offset]*imdy[offset]);
+				dtdx+=(T)(psi*imdx[offset]*imdt[offset]);
+				dtdy+=(T)(psi*imdy[offset]*imdt[offset]);
+			}
+			imdxy[i]=dxy/nChannels;
+			imdx2[i]=dx2/nChannels;
+			imdy2[i]=dy2/nChannels;
+			imdtdx[i]=dtdx/nChannels;
+			imdtdy[i]=dtdy/nChannels;
+		}
+	}
+};
+
+// 3x3 smoothing of a set of single channel images of the same size in one sweep over the
+// bands, the filter is the one of Image::smoothing(), applied as two separable 1D filters
+// pRows has nRowsPerBand elements per band for the rows of ImageProcessing::separableFiltering()
+template <class T>
+class SmoothingKernel
+{
+public:
+	enum{maxImages=5,fsize=1};
+	const T* src[maxImages];
+	T* dst[maxImages];
+	int nImages,width,height;
+	double filter1D[3];
+	double* pRows;
+	SmoothingKernel(double factor)
+	{
+		filter1D[0]=filter1D[2]=1/(factor+2);
+		filter1D[1]=factor/(factor+2);
+		nImages=0;
+		pRows=NULL;
+	};
+	static inline int nRowsPerBand(int width) {return (fsize*2+2)*width;};
+	void add(const Image<T>& source,Image<T>& dest)
+	{
+		src[nImages]=source.data();
+		dst[nImages]=dest.data();
+		nImages++;
+	};
+	void operator()(int rowStart,int rowEnd,int band)
+	{
+		double* pBandRows=pRows+band*nRowsPerBand(width);
+		for(int k=0;k<nImages;k++)
+			ImageProcessing::separableFiltering(src[k],dst[k],width,height,1,filter1D,filter1D,fsize,rowStart,rowEnd,pBandRows);
+	}
+};
+
+// the weighted Laplacian at pixel j of a row, hasUp and hasDown tell whether the rows above
+// and below exist
+template <class T,class Up,class Down>
+inline T weightedLaplacianPixel(const T* center,const Up& up,const Down& down,const T* weight,const T* weightUp,int j,int width,bool hasUp,bool hasDown)
+{
+	T value=0;
+	if(j<width-1)
+		value-=(T)((center[j+1]-center[j])*weight[j]);
+	if(j>0)
+		value+=(T)((center[j]-center[j-1])*weight[j-1]);
+	if(hasDown)
+		value-=(T)((down[j]-center[j])*weight[j]);
+	if(hasUp)
+		value+=(T)((center[j]-up[j])*weightUp[j]);
+	return value;
+}
+
+// the weighted Laplacian of OpticalFlow::Laplacian() on row i, in one pass
+// center is the row of the input, and up and down the rows above and below it (used only if
+// they exist), read with operator[](j) so that they can also be computed on the fly.
+// The interior pixels of the interior rows go through a loop without branches that the
+// compiler vectorizes, the first and the last pixels and the first and the last rows through
+// weightedLaplacianPixel(). The result is exactly the one of the two-pass definition
+// (0-a+b is b-a), and output must not be the input.
+template <class T,class Up,class Down>
+inline void weightedLaplacianRow(T* output,const T* center,const Up& up,const Down& down,const T* weight,const T* weightUp,int i,int width,int height)
+{
+	bool hasUp=(i>0),hasDown=(i<height-1);
+	if(!hasUp || !hasDown || width<3)
+	{
+		for(int j=0;j<width;j++)
+			output[j]=weightedLaplacianPixel(center,up,down,weight,weightUp,j,width,hasUp,hasDown);
+		return;
+	}
+	output[0]=weightedLaplacianPixel(center,up,down,weight,weightUp,0,width,true,true);
+	for(int j=1;j<width-1;j++)
+	{
+		T value=(T)((center[j]-center[j-1])*weight[j-1]);
+		value-=(T)((center[j+1]-center[j])*weight[j]);
+		value-=(T)((down[j]-center[j])*weight[j]);
+		value+=(T)((center[j]-up[j])*weightUp[j]);
+		output[j]=value;
+	}
+	output[width-1]=weightedLaplacianPixel(center,up,down,weight,weightUp,width-1,width,true,true);
+}
+
+// the inverse of the 2x2 block diagonal of the linear system (see OpticalFlow::genBlockJacobi())
+// on rows [rowStart,rowEnd)
+template <class T>
+inline void blockJacobiRows(T* m11,T* m12,T* m22,const T* a11,const T* a12,const T* a22,const T* weightData,double alpha,
+							int rowStart,int rowEnd,int width,int height)
+{
+	for(int i=rowStart;i<rowEnd;i++)
+		for(int j=0;j<width;j++)
+		{
+			int offset=i*width+j;
+			double diag=0;
+			if(j<width-1)
+				diag+=weightData[offset];
+			if(j>0)
+				diag+=weightData[offset-1];
+			if(i<height-1)
+				diag+=weightData[offset];
+			if(i>0)
+				diag+=weightData[offset-width];
+			diag*=alpha;
+			double d11=a11[offset]+diag,d22=a22[offset]+diag;
+			double det=d11*d22-a12[offset]*a12[offset];
+			m11[offset]=d22/det;
+			m12[offset]=-a12[offset]/det;
+			m22[offset]=d11/det;
+		}
+}
+
+// a row of the search direction of conjugate gradient, z+ratio*p, computed on the fly
+template <class T>
+class DirectionRow
+{
+public:
+	const T *pz,*p;
+	double ratio;
+	bool IsFirst;
+	inline T operator[](int j) const {return IsFirst?pz[j]:(T)(pz[j]+p[j]*ratio);};
+};
+
+// the per-pixel operations of building and solving the linear system with (preconditioned)
+// conjugate gradient. Each step of conjugate gradient is two sweeps over the bands:
+//		ApplySystem:	the new direction p, q=A*p and p.q
+//		UpdateSolution:	du, dv and r, the preconditioned residual z, and r.r and r.z
+// ApplySystem goes row by row, the new direction of the next row is written (to the other
+// buffer pn, as the neighboring bands read the old one) before the Laplacian of the current
+// row; the rows of the neighboring bands are computed on the fly. The buffers are swapped
+// after each step. The reductions store one partial sum per band.
+template <class T>
+class LinearSystemKernel
+{
+public:
+	enum Operation{FormSystem,Initialize,ApplySystem,UpdateSolution};
+	T *A11,*A22,*b1,*b2;
+	const T *A12,*u,*v,*phi;
+	T *M11,*M12,*M22;
+	T *du,*dv,*r1,*r2,*z1,*z2,*p1,*p2,*pn1,*pn2,*q1,*q2;
+	const T *pz1,*pz2;
+	double alpha,ratio,beta;
+	bool IsFirstDirection,IsPreconditioned;
+	int width,height;
+	Operation operation;
+	double *pqPartial,*rrPartial,*rzPartial;
+
+	// partial has 3*ThreadPool::nbands(_height) elements
+	LinearSystemKernel(int _width,int _height,double* partial)
+	{
+		width=_width;
+		height=_height;
+		int bands=ThreadPool::nbands(height);
+		pqPartial=partial;
+		rrPartial=partial+bands;
+		rzPartial=partial+bands*2;
+		ratio=0;
+		IsPreconditioned=false;
+	};
+
+	void run(ThreadPool& pool,Operation op)
+	{
+		operation=op;
+		pool.run(*this,height);
+	};
+	// the sum of the partial results in band order
+	double sum(const double* partial) const
+	{
+		double result=0;
+		for(int i=0;i<ThreadPool::nbands(height);i++)
+			result+=partial[i];
+		return result;
+	};
+	inline double pq() const {return sum(pqPartial);};
+	inline double rr() const {return sum(rrPartial);};
+	inline double rz() const {return sum(rzPartial);};
+	void swapDirections()
+	{
+		T* temp;
+		temp=p1; p1=pn1; pn1=temp;
+		temp=p2; p2=pn2; pn2=temp;
+	};
+
+	// r.r, and with the preconditioner z=M^-1*r and r.z, over [start,end)
+	void residual(int start,int end,int band)
+	{
+		double sum1=0,sum2=0;
+		for(int i=start;i<end;i++)
+		{
+			sum1+=r1[i]*r1[i];
+			sum2+=r2[i]*r2[i];
+		}
+		rrPartial[band]=sum1+sum2;
+		if(!IsPreconditioned)
+			return;
+		sum1=sum2=0;
+		for(int i=start;i<end;i++)
+		{
+			z1[i]=M11[i]*r1[i]+M12[i]*r2[i];
+			z2[i]=M12[i]*r1[i]+M22[i]*r2[i];
+			sum1+=r1[i]*z1[i];
+			sum2+=r2[i]*z2[i];
+		}
+		rzPartial[band]=sum1+sum2;
+	};
+
+	DirectionRow<T> direction(const T* pz,const T* p,int i) const
+	{
+		DirectionRow<T> row;
+		row.pz=pz+i*width;
+		row.p=p+i*width;
+		row.ratio=ratio;
+		row.IsFirst=IsFirstDirection;
+		return row;
+	};
+	void writeDirection(int i)
+	{
+		DirectionRow<T> dir1=direction(pz1,p1,i),dir2=direction(pz2,p2,i);
+		T* row1=pn1+i*width;
+		T* row2=pn2+i*width;
+		for(int j=0;j<width;j++)
+		{
+			row1[j]=dir1[j];
+			row2[j]=dir2[j];
+		}
+	};
+	// the Laplacian of row i of the new direction, rows [rowStart,i+1] are written
+	void directionLaplacian(T* output,const T* pz,const T* p,const T* pn,int i,int rowStart,int rowEnd)
+	{
+		const T* center=pn+i*width;
+		const T* weightUp=phi+(i>0?i-1:0)*width;
+		bool IsUpWritten=(i>rowStart),IsDownWritten=(i+1<rowEnd);
+		if(IsUpWritten && IsDownWritten)
+			weightedLaplacianRow(output,center,center-width,center+width,phi+i*width,weightUp,i,width,height);
+		else if(IsDownWritten)
+			weightedLaplacianRow(output,center,direction(pz,p,i>0?i-1:0),center+width,phi+i*width,weightUp,i,width,height);
+		else if(IsUpWritten)
+			weightedLaplacianRow(output,center,center-width,direction(pz,p,i<height-1?i+1:i),phi+i*width,weightUp,i,width,height);
+		else
+			weightedLaplacianRow(output,center,direction(pz,p,i>0?i-1:0),direction(pz,p,i<height-1?i+1:i),phi+i*width,weightUp,i,width,height);
+	};
+
+	void operator()(int rowStart,int rowEnd,int band)
+	{
+		int start=rowStart*width,end=rowEnd*width;
+		switch(operation)
+		{
+		case FormSystem:
+			// add epsilon to A11 and A22, and form b with the laplacian of the current flow field
+			// (q1 and q2 are free, and used to store the rows of the laplacian), then the
+			// preconditioner from the final A11 and A22
+			{
+				T epsilon=alpha*0.1;
+				for(int i=rowStart;i<rowEnd;i++)
+				{
+					int offset=i*width;
+					int up=i>0?offset-width:offset,down=i<height-1?offset+width:offset;
+					weightedLaplacianRow(q1+offset,u+offset,u+up,u+down,phi+offset,phi+up,i,width,height);
+					weightedLaplacianRow(q2+offset,v+offset,v+up,v+down,phi+offset,phi+up,i,width,height);
+				}
+				for(int i=start;i<end;i++)
+				{
+					A11[i]+=epsilon;
+					A22[i]+=epsilon;
+					b1[i]=-b1[i]-alpha*q1[i];
+					b2[i]=-b2[i]-alpha*q2[i];
+				}
+				if(IsPreconditioned)
+					blockJacobiRows(M11,M12,M22,A11,A12,A22,phi,alpha,rowStart,rowEnd,width,height);
+			}
+			break;
+		case Initialize:
+			for(int i=start;i<end;i++)
+			{
+				r1[i]=b1[i];
+				r2[i]=b2[i];
+				du[i]=dv[i]=0;
+			}
+			residual(start,end,band);
+			break;
+		case ApplySystem:
+			{
+				double sum1=0,sum2=0;
+				writeDirection(rowStart);
+				for(int i=rowStart;i<rowEnd;i++)
+				{
+					if(i+1<rowEnd)
+						writeDirection(i+1);
+					int offset=i*width;
+					directionLaplacian(q1+offset,pz1,p1,pn1,i,rowStart,rowEnd);
+					directionLaplacian(q2+offset,pz2,p2,pn2,i,rowStart,rowEnd);
+					for(int j=offset;j<offset+width;j++)
+					{
+						T temp1=(T)(A11[j]*pn1[j])+(T)(A12[j]*pn2[j]);
+						T temp2=(T)(A12[j]*pn1[j])+(T)(A22[j]*pn2[j]);
+						temp1+=q1[j]*alpha;
+						temp2+=q2[j]*alpha;
+						q1[j]=temp1;
+						q2[j]=temp2;
+						sum1+=pn1[j]*temp1;
+						sum2+=pn2[j]*temp2;
+					}
+				}
+				pqPartial[band]=sum1+sum2;
+			}
+			break;
+		case UpdateSolution:
+			for(int i=start;i<end;i++)
+			{
+				du[i]+=pn1[i]*beta;
+				dv[i]+=pn2[i]*beta;
+				r1[i]+=q1[i]*(-beta);
+				r2[i]+=q2[i]*(-beta);
+			}
+			residual(start,end,band);
+			break;
+		}
+	}
+};
+
 //--------------------------------------------------------------------------------------------------------
 // function to compute optical flow field using two fixed point iterations
 // Input arguments:
@@ -112,46 +597,138 @@ void OpticalFlow::genInImageMask(DImage &mask, const DImage &vx, const DImage &v
 //	u,v:									the current flow field, NOTICE that they are also output arguments
 //	
 //--------------------------------------------------------------------------------------------------------
-void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &warpIm2, DImage &u, DImage &v, 
-																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nCGIterations)
+template <class T>
+int OpticalFlow::SmoothFlowPDE(const Image<T> &Im1, const Image<T> &Im2, Image<T> &warpIm2, Image<T> &u, Image<T> &v, 
+																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para)
+{
+	ThreadPool pool(para.nThreads);
+	return SmoothFlowPDE(Im1,Im2,warpIm2,u,v,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations,para,pool);
+}
+
+template <class T>
+int OpticalFlow::SmoothFlowPDE(const Image<T> &Im1, const Image<T> &Im2, Image<T> &warpIm2, Image<T> &u, Image<T> &v, 
+																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para, ThreadPool& pool)
+{
+	FlowWorkspace<T> workspace;
+	return SmoothFlowPDE(Im1,Im2,warpIm2,u,v,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations,para,pool,workspace);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// the per-pixel work is split into bands of rows and run by the thread pool
+// all the temporary images live in the workspace, so that nothing is allocated here once the
+// workspace has the size of the images
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+int OpticalFlow::SmoothFlowPDE(const Image<T> &Im1, const Image<T> &Im2, Image<T> &warpIm2, Image<T> &u, Image<T> &v, 
+																    double alpha, int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para, ThreadPool& pool,
+																	FlowWorkspace<T>& workspace)
 {
-	DImage mask,imdx,imdy,imdt;
 	int imWidth,imHeight,nChannels,nPixels;
 	imWidth=Im1.width();
 	imHeight=Im1.height();
 	nChannels=Im1.nchannels();
 	nPixels=imWidth*imHeight;
 
-	DImage du(imWidth,imHeight),dv(imWidth,imHeight);
-	DImage uu(imWidth,imHeight),vv(imWidth,imHeight);
-	DImage ux(imWidth,imHeight),uy(imWidth,imHeight);
-	DImage vx(imWidth,imHeight),vy(imWidth,imHeight);
-	DImage Phi_1st(imWidth,imHeight);
-	DImage Psi_1st(imWidth,imHeight,nChannels);
+	workspace.allocate(imWidth,imHeight,nCGIterations);
+	Image<T> &mask=workspace.mask,&imdx=workspace.imdx,&imdy=workspace.imdy,&imdt=workspace.imdt;
+	Image<T> &du=workspace.du,&dv=workspace.dv;
+	Image<T> &Phi_1st=workspace.Phi_1st;
 
-	DImage imdxy,imdx2,imdy2,imdtdx,imdtdy;
-	DImage ImDxy,ImDx2,ImDy2,ImDtDx,ImDtDy;
-	DImage A11,A12,A22,b1,b2;
-	DImage foo1,foo2;
+	Image<T> &imdxy=workspace.imdxy,&imdx2=workspace.imdx2,&imdy2=workspace.imdy2,&imdtdx=workspace.imdtdx,&imdtdy=workspace.imdtdy;
+	Image<T> &A11=workspace.A11,&A12=workspace.A12,&A22=workspace.A22,&b1=workspace.b1,&b2=workspace.b2;
 
 	// variables for conjugate gradient
-	DImage r1,r2,p1,p2,q1,q2;
-	double* rou;
-	rou=new double[nCGIterations];
+	Image<T> &r1=workspace.r1,&r2=workspace.r2,&q1=workspace.q1,&q2=workspace.q2;
+	double* rou=workspace.rou();
+
+	// variables for the block-Jacobi preconditioner
+	Image<T> &M11=workspace.M11,&M12=workspace.M12,&M22=workspace.M22,&z1=workspace.z1,&z2=workspace.z2;
+
+	// the multigrid hierarchy is reused across the fixed point iterations
+	MultigridSolver<T>& mgSolver=workspace.mgSolver;
 
 	double varepsilon_phi=pow(0.001,2);
 	double varepsilon_psi=pow(0.001,2);
 
+	// the kernels work in place on the images allocated above
+	PhiKernel<T> phiKernel;
+	phiKernel.u=u.data();
+	phiKernel.v=v.data();
+	phiKernel.du=du.data();
+	phiKernel.dv=dv.data();
+	phiKernel.phi=Phi_1st.data();
+	phiKernel.width=imWidth;
+	phiKernel.height=imHeight;
+	phiKernel.varepsilon=varepsilon_phi;
+
+	DataTermKernel<T> dataKernel;
+	dataKernel.du=du.data();
+	dataKernel.dv=dv.data();
+	dataKernel.imdx2=imdx2.data();
+	dataKernel.imdxy=imdxy.data();
+	dataKernel.imdy2=imdy2.data();
+	dataKernel.imdtdx=imdtdx.data();
+	dataKernel.imdtdy=imdtdy.data();
+	dataKernel.width=imWidth;
+	dataKernel.nChannels=nChannels;
+	dataKernel.pixelStep=Im1.isPlanar()?1:nChannels;
+	dataKernel.channelStep=Im1.isPlanar()?nPixels:1;
+	dataKernel.varepsilon=varepsilon_psi;
+
+	SmoothingKernel<T> smoothingKernel(3);
+	smoothingKernel.width=imWidth;
+	smoothingKernel.height=imHeight;
+	smoothingKernel.pRows=workspace.rows();
+	smoothingKernel.add(imdx2,A11);
+	smoothingKernel.add(imdxy,A12);
+	smoothingKernel.add(imdy2,A22);
+	smoothingKernel.add(imdtdx,b1);
+	smoothingKernel.add(imdtdy,b2);
+
+	LinearSystemKernel<T> cgKernel(imWidth,imHeight,workspace.partial());
+	cgKernel.A11=A11.data();
+	cgKernel.A12=A12.data();
+	cgKernel.A22=A22.data();
+	cgKernel.b1=b1.data();
+	cgKernel.b2=b2.data();
+	cgKernel.u=u.data();
+	cgKernel.v=v.data();
+	cgKernel.phi=Phi_1st.data();
+	cgKernel.M11=M11.data();
+	cgKernel.M12=M12.data();
+	cgKernel.M22=M22.data();
+	cgKernel.du=du.data();
+	cgKernel.dv=dv.data();
+	cgKernel.r1=r1.data();
+	cgKernel.r2=r2.data();
+	cgKernel.z1=z1.data();
+	cgKernel.z2=z2.data();
+	cgKernel.p1=workspace.p1.data();
+	cgKernel.p2=workspace.p2.data();
+	cgKernel.pn1=workspace.pn1.data();
+	cgKernel.pn2=workspace.pn2.data();
+	cgKernel.q1=q1.data();
+	cgKernel.q2=q2.data();
+	cgKernel.alpha=alpha;
+
+	FlowProbe probe(para.pProfile);
+
 	//--------------------------------------------------------------------------
 	// the outer fixed point iteration
 	//--------------------------------------------------------------------------
-	for(int count=0;count<nOuterFPIterations;count++)
+	int count;
+	for(count=0;count<nOuterFPIterations;count++)
 	{
 		// compute the gradient
-		getDxs(imdx,imdy,imdt,Im1,warpIm2);
+		probe.start();
+		getDxs(imdx,imdy,imdt,Im1,warpIm2,workspace.smooth1,workspace.smooth2,workspace.filterBuffer);
+		dataKernel.imdx=imdx.data();
+		dataKernel.imdy=imdy.data();
+		dataKernel.imdt=imdt.data();
 
 		// generate the mask to set the weight of the pxiels moving outside of the image boundary to be zero
-		genInImageMask(mask,vx,vy);
+		genInImageMask(mask,u,v);
+		probe.stop(FlowProfile::Derivatives);
 
 		// set the derivative of the flow field to be zero
 		du.reset();
@@ -162,123 +739,36 @@ void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &wa
 		//--------------------------------------------------------------------------
 		for(int hh=0;hh<nInnerFPIterations;hh++)
 		{
-			// compute the derivatives of the current flow field
-			if(hh==0)
-			{
-				uu.copyData(u);
-				vv.copyData(v);
-			}
-			else
+			// stop when the last inner iteration hardly changed du and dv
+			if(para.innerTolerance>0 && hh>0)
 			{
-				uu.Add(u,du);
-				vv.Add(v,dv);
-			}
-			uu.dx(ux);
-			uu.dy(uy);
-			vv.dx(vx);
-			vv.dy(vy);
-
-			// compute the weight of phi
-			Phi_1st.reset();
-			double* phiData=Phi_1st.data();
-			double temp;
-			const double *uxData,*uyData,*vxData,*vyData;
-			uxData=ux.data();
-			uyData=uy.data();
-			vxData=vx.data();
-			vyData=vy.data();
-			for(int i=0;i<nPixels;i++)
-			{
-				temp=uxData[i]*uxData[i]+uyData[i]*uyData[i]+vxData[i]*vxData[i]+vyData[i]*vyData[i];
-				phiData[i]=1/(2*sqrt(temp+varepsilon_phi));
+				if(hh>1 && flowDistance(du,dv,workspace.duLast,workspace.dvLast)<=para.innerTolerance*flowNorm(du,dv))
+					break;
+				workspace.duLast.copyData(du);
+				workspace.dvLast.copyData(dv);
 			}
 
-			// compute the nonlinear term of psi
-			Psi_1st.reset();
-			double* psiData=Psi_1st.data();
-			const double *imdxData,*imdyData,*imdtData;
-			const double *duData,*dvData;
-			imdxData=imdx.data();
-			imdyData=imdy.data();
-			imdtData=imdt.data();
-			duData=du.data();
-			dvData=dv.data();
-		
-			double _a  = 10000, _b = 0.1;
-			if(nChannels==1)
-			{
-				for(int i=0;i<nPixels;i++)
-				{
-					temp=imdtData[i]+imdxData[i]*duData[i]+imdyData[i]*dvData[i];
-					//if(temp*temp<0.04)
-					psiData[i]=1/(2*sqrt(temp*temp+varepsilon_psi));
-					//psiData[i] = _a*_b/(1+_a*temp*temp);
-				}
-			}
-			else
-			{
-				for(int i=0;i<nPixels;i++)
-					for(int k=0;k<nChannels;k++)
-					{
-						int offset=i*nChannels+k;
-						temp=imdtData[offset]+imdxData[offset]*duData[i]+imdyData[offset]*dvData[i];
-						//if(temp*temp<0.04)
-						psiData[offset]=1/(2*sqrt(temp*temp+varepsilon_psi));
-						//psiData[offset] =  _a*_b/(1+_a*temp*temp);
-					}
-			}
+			if(probe.enabled())
+				probe.profile().record().nInnerIterations++;
 
-			// prepare the components of the large linear system
-			ImDxy.Multiply(Psi_1st,imdx,imdy);
-			ImDx2.Multiply(Psi_1st,imdx,imdx);
-			ImDy2.Multiply(Psi_1st,imdy,imdy);
-			ImDtDx.Multiply(Psi_1st,imdx,imdt);
-			ImDtDy.Multiply(Psi_1st,imdy,imdt);
+			// compute the weight of phi from the derivatives of the current flow field
+			probe.start();
+			pool.run(phiKernel,imHeight);
 
-			if(nChannels>1)
-			{
-				ImDxy.collapse(imdxy);
-				ImDx2.collapse(imdx2);
-				ImDy2.collapse(imdy2);
-				ImDtDx.collapse(imdtdx);
-				ImDtDy.collapse(imdtdy);
-			}
-			else
-			{
-				imdxy.copyData(ImDxy);
-				imdx2.copyData(ImDx2);
-				imdy2.copyData(ImDy2);
-				imdtdx.copyData(ImDtDx);
-				imdtdy.copyData(ImDtDy);
-			}
+			// compute the nonlinear term of psi, and prepare the components of the large linear system
+			pool.run(dataKernel,imHeight);
+			probe.stop(FlowProfile::Weights);
 
 			// filtering
-			imdx2.smoothing(A11,3);
-			imdxy.smoothing(A12,3);
-			imdy2.smoothing(A22,3);
-
-			// add epsilon to A11 and A22
-			A11.Add(alpha*0.1);
-			A22.Add(alpha*0.1);
-
-			// form b
-			imdtdx.smoothing(b1,3);
-			imdtdy.smoothing(b2,3);
-			// laplacian filtering of the current flow field
-		    Laplacian(foo1,u,Phi_1st);
-			Laplacian(foo2,v,Phi_1st);
-			double *b1Data,*b2Data;
-			const double *foo1Data,*foo2Data;
-			b1Data=b1.data();
-			b2Data=b2.data();
-			foo1Data=foo1.data();
-			foo2Data=foo2.data();
-
-			for(int i=0;i<nPixels;i++)
-			{
-				b1Data[i]=-b1Data[i]-alpha*foo1Data[i];
-				b2Data[i]=-b2Data[i]-alpha*foo2Data[i];
-			}
+			probe.start();
+			pool.run(smoothingKernel,imHeight);
+			probe.stop(FlowProfile::Smoothing);
+
+			// add epsilon to A11 and A22, and form b with the laplacian of the current flow field
+			// with the PCG solver, the block-Jacobi preconditioner is formed in the same sweep
+			probe.start();
+			cgKernel.IsPreconditioned=(para.solver==SolverPara::PCG);
+			cgKernel.run(pool,LinearSystemKernel<T>::FormSystem);
 
 			// for debug only, displaying the matrix coefficients
 			//A11.imwrite("A11.bmp",ImageIO::normalized);
@@ -287,52 +777,83 @@ void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &wa
 			//b1.imwrite("b1.bmp",ImageIO::normalized);
 			//b2.imwrite("b2.bmp",ImageIO::normalized);
 
+			//-----------------------------------------------------------------------
+			// multigrid
+			//-----------------------------------------------------------------------
+			if(para.solver==SolverPara::Multigrid)
+			{
+				mgSolver.ConstructHierarchy(A11,A12,A22,Phi_1st,alpha);
+				probe.stop(FlowProfile::System);
+				probe.start();
+				double residual=mgSolver.Solve(du,dv,b1,b2,para.nCycles,para.nPreSmoothing,para.nPostSmoothing,para.IsFMG,para.tolerance);
+				probe.stop(FlowProfile::Solver);
+				if(probe.enabled())
+				{
+					probe.profile().record().nSolverIterations+=mgSolver.ncycles();
+					probe.profile().record().residual=sqrt(residual);
+				}
+				continue;
+			}
+
+			//-----------------------------------------------------------------------
+			// red-black SOR, du and dv are updated in place
+			//-----------------------------------------------------------------------
+			if(para.solver==SolverPara::SOR)
+			{
+				probe.stop(FlowProfile::System);
+				probe.start();
+				du.reset();
+				dv.reset();
+				RedBlackSOR(du,dv,A11,A12,A22,b1,b2,Phi_1st,alpha,para.nSORIterations,para.omega,pool);
+				probe.stop(FlowProfile::Solver);
+				if(probe.enabled())
+					probe.profile().record().nSolverIterations+=para.nSORIterations;
+				continue;
+			}
+
 			//-----------------------------------------------------------------------
 			// conjugate gradient algorithm
+			// with the PCG solver, z=M^-1*r is used as the search direction, where M
+			// is the 2x2 block diagonal of the system
 			//-----------------------------------------------------------------------
-			r1.copyData(b1);
-			r2.copyData(b2);
-			du.reset();
-			dv.reset();
+			cgKernel.pz1=r1.data();
+			cgKernel.pz2=r2.data();
+			if(cgKernel.IsPreconditioned)
+			{
+				cgKernel.pz1=z1.data();
+				cgKernel.pz2=z2.data();
+			}
+			probe.stop(FlowProfile::System);
+			probe.start();
+			cgKernel.run(pool,LinearSystemKernel<T>::Initialize);
+			double rnorm0=0;
 
-			for(int k=0;k<nCGIterations;k++)
+			int k;
+			for(k=0;k<nCGIterations;k++)
 			{
-				rou[k]=r1.norm2()+r2.norm2();
-				//cout<<rou[k]<<endl;
-				if(rou[k]<1E-10)
-					break;
+				double rnorm=cgKernel.rr();
+				//cout<<rnorm<<endl;
 				if(k==0)
-				{
-					p1.copyData(r1);
-					p2.copyData(r2);
-				}
-				else
-				{
-					double ratio=rou[k]/rou[k-1];
-					p1.Add(r1,p1,ratio);
-					p2.Add(r2,p2,ratio);
-				}
-				// go through the large linear system
-				foo1.Multiply(A11,p1);
-				foo2.Multiply(A12,p2);
-				q1.Add(foo1,foo2);
-				Laplacian(foo1,p1,Phi_1st);
-				q1.Add(foo1,alpha);
-
-				foo1.Multiply(A12,p1);
-				foo2.Multiply(A22,p2);
-				q2.Add(foo1,foo2);
-				Laplacian(foo2,p2,Phi_1st);
-				q2.Add(foo2,alpha);
-
-				double beta;
-				beta=rou[k]/(p1.innerproduct(q1)+p2.innerproduct(q2));
-				
-				du.Add(p1,beta);
-				dv.Add(p2,beta);
-
-				r1.Add(q1,-beta);
-				r2.Add(q2,-beta);
+					rnorm0=rnorm;
+				if(rnorm<1E-10 || rnorm<para.tolerance*para.tolerance*rnorm0)
+					break;
+				rou[k]=cgKernel.IsPreconditioned?cgKernel.rz():rnorm;
+				cgKernel.IsFirstDirection=(k==0);
+				if(k>0)
+					cgKernel.ratio=rou[k]/rou[k-1];
+
+				// go through the large linear system along the new direction
+				cgKernel.run(pool,LinearSystemKernel<T>::ApplySystem);
+
+				cgKernel.beta=rou[k]/cgKernel.pq();
+				cgKernel.run(pool,LinearSystemKernel<T>::UpdateSolution);
+				cgKernel.swapDirections();
+			}
+			probe.stop(FlowProfile::Solver);
+			if(probe.enabled())
+			{
+				probe.profile().record().nSolverIterations+=k;
+				probe.profile().record().residual=sqrt(cgKernel.rr());
 			}
 			//-----------------------------------------------------------------------
 			// end of conjugate gradient algorithm
@@ -342,20 +863,199 @@ void OpticalFlow::SmoothFlowPDE(const DImage &Im1, const DImage &Im2, DImage &wa
 		// the following procedure is merely for debugging
 		//cout<<"du "<<du.norm2()<<" dv "<<dv.norm2()<<endl;
 		// update the flow field
+		probe.start();
 		u.Add(du,1);
 		v.Add(dv,1);
 		warpFL(warpIm2,Im1,Im2,u,v);
+		probe.stop(FlowProfile::Warping);
+
+		// stop when the update is small with respect to the flow (or to one pixel)
+		if(para.outerTolerance>0 && count+1>=para.nMinOuterFPIterations &&
+			flowNorm(du,dv)<=para.outerTolerance*(1+flowNorm(u,v)))
+		{
+			count++;
+			break;
+		}
 	}// end of outer fixed point iteration
-	
-	
-	delete rou;
+	if(probe.enabled())
+		probe.profile().record().nOuterIterations+=count;
+	return count;
+}
+
+//--------------------------------------------------------------------------------------------------------
+// function to compute the inverse of the 2x2 block diagonal of the linear system in SmoothFlowPDE
+//		[A11+alpha*D	A12			]
+//		[A12			A22+alpha*D	]
+// where D is the diagonal of the weighted Laplacian
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlow::genBlockJacobi(Image<T> &M11, Image<T> &M12, Image<T> &M22, const Image<T> &A11, const Image<T> &A12, const Image<T> &A22, const Image<T> &weight, double alpha)
+{
+	int width=weight.width(),height=weight.height();
+	if(M11.matchDimension(weight)==false)
+	{
+		M11.allocate(width,height);
+		M12.allocate(width,height);
+		M22.allocate(width,height);
+	}
+	blockJacobiRows(M11.data(),M12.data(),M22.data(),A11.data(),A12.data(),A22.data(),weight.data(),alpha,0,height,width,height);
+}
+
+//--------------------------------------------------------------------------------------------------------
+// function to apply the block-Jacobi preconditioner: z=M^-1*r
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlow::applyBlockJacobi(Image<T> &z1, Image<T> &z2, const Image<T> &r1, const Image<T> &r2, const Image<T> &M11, const Image<T> &M12, const Image<T> &M22)
+{
+	if(z1.matchDimension(r1)==false)
+	{
+		z1.allocate(r1);
+		z2.allocate(r1);
+	}
+	const T *r1Data=r1.data(),*r2Data=r2.data();
+	const T *m11=M11.data(),*m12=M12.data(),*m22=M22.data();
+	T *z1Data=z1.data(),*z2Data=z2.data();
+	int nPixels=r1.npixels();
+	for(int i=0;i<nPixels;i++)
+	{
+		z1Data[i]=m11[i]*r1Data[i]+m12[i]*r2Data[i];
+		z2Data[i]=m12[i]*r1Data[i]+m22[i]*r2Data[i];
+	}
 }
 
-void OpticalFlow::Laplacian(DImage &output, const DImage &input, const DImage& weight)
+//--------------------------------------------------------------------------------------------------------
+// function to solve the linear system in SmoothFlowPDE with red-black block SOR
+// the 2x2 system of each pixel is solved given the current values of its four neighbors, and the
+// solution is over-relaxed by omega. Pixels of one color only depend on the other color.
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class RedBlackSORKernel
+{
+public:
+	T *duData,*dvData;
+	const T *a11,*a12,*a22,*b1Data,*b2Data,*weightData;
+	int width,height,color;
+	double alpha,omega;
+	void operator()(int rowStart,int rowEnd,int)
+	{
+		for(int i=rowStart;i<rowEnd;i++)
+			for(int j=(i+color)%2;j<width;j+=2)
+			{
+				int offset=i*width+j;
+				double diag=0,sigma1=0,sigma2=0,w;
+				if(j>0)
+				{
+					w=weightData[offset-1];
+					diag+=w;
+					sigma1+=w*duData[offset-1];
+					sigma2+=w*dvData[offset-1];
+				}
+				if(j<width-1)
+				{
+					w=weightData[offset];
+					diag+=w;
+					sigma1+=w*duData[offset+1];
+					sigma2+=w*dvData[offset+1];
+				}
+				if(i>0)
+				{
+					w=weightData[offset-width];
+					diag+=w;
+					sigma1+=w*duData[offset-width];
+					sigma2+=w*dvData[offset-width];
+				}
+				if(i<height-1)
+				{
+					w=weightData[offset];
+					diag+=w;
+					sigma1+=w*duData[offset+width];
+					sigma2+=w*dvData[offset+width];
+				}
+				diag*=alpha;
+				double m11=a11[offset]+diag,m12=a12[offset],m22=a22[offset]+diag;
+				double r1=b1Data[offset]+alpha*sigma1,r2=b2Data[offset]+alpha*sigma2;
+				double det=m11*m22-m12*m12;
+				duData[offset]+=omega*((m22*r1-m12*r2)/det-duData[offset]);
+				dvData[offset]+=omega*((m11*r2-m12*r1)/det-dvData[offset]);
+			}
+	}
+};
+
+template <class T>
+void OpticalFlow::RedBlackSOR(Image<T> &du, Image<T> &dv, const Image<T> &A11, const Image<T> &A12, const Image<T> &A22, const Image<T> &b1, const Image<T> &b2,
+													const Image<T> &weight, double alpha, int nIterations, double omega)
+{
+	ThreadPool pool(1);
+	RedBlackSOR(du,dv,A11,A12,A22,b1,b2,weight,alpha,nIterations,omega,pool);
+}
+
+// the bands of rows of one color are updated in parallel
+template <class T>
+void OpticalFlow::RedBlackSOR(Image<T> &du, Image<T> &dv, const Image<T> &A11, const Image<T> &A12, const Image<T> &A22, const Image<T> &b1, const Image<T> &b2,
+													const Image<T> &weight, double alpha, int nIterations, double omega, ThreadPool& pool)
+{
+	RedBlackSORKernel<T> kernel;
+	kernel.width=du.width();
+	kernel.height=du.height();
+	kernel.duData=du.data();
+	kernel.dvData=dv.data();
+	kernel.a11=A11.data();
+	kernel.a12=A12.data();
+	kernel.a22=A22.data();
+	kernel.b1Data=b1.data();
+	kernel.b2Data=b2.data();
+	kernel.weightData=weight.data();
+	kernel.alpha=alpha;
+	kernel.omega=omega;
+
+	for(int count=0;count<nIterations;count++)
+		for(int color=0;color<2;color++)
+		{
+			kernel.color=color;
+			pool.run(kernel,kernel.height);
+		}
+}
+
+//--------------------------------------------------------------------------------------------------------
+// weighted Laplacian of one or two images with the same weight (e.g. the two components of
+// the flow field), in one pass over the rows
+//--------------------------------------------------------------------------------------------------------
+template <class T>
+class LaplacianKernel
+{
+public:
+	enum{maxImages=2};
+	const T* inputData[maxImages];
+	T* outputData[maxImages];
+	const T* weightData;
+	int nImages,width,height;
+	void operator()(int rowStart,int rowEnd,int)
+	{
+		for(int i=rowStart;i<rowEnd;i++)
+		{
+			int offset=i*width;
+			int up=i>0?offset-width:offset,down=i<height-1?offset+width:offset;
+			for(int k=0;k<nImages;k++)
+			{
+				const T* input=inputData[k];
+				weightedLaplacianRow(outputData[k]+offset,input+offset,input+up,input+down,weightData+offset,weightData+up,i,width,height);
+			}
+		}
+	}
+};
+
+template <class T>
+void OpticalFlow::Laplacian(Image<T> &output, const Image<T> &input, const Image<T>& weight)
+{
+	ThreadPool pool(1);
+	Laplacian(output,input,weight,pool);
+}
+
+template <class T>
+void OpticalFlow::Laplacian(Image<T> &output, const Image<T> &input, const Image<T>& weight, ThreadPool& pool)
 {
 	if(output.matchDimension(input)==false)
 		output.allocate(input);
-	output.reset();
 
 	if(input.matchDimension(weight)==false)
 	{
@@ -363,44 +1063,40 @@ void OpticalFlow::Laplacian(DImage &output, const DImage &input, const DImage& w
 		return;
 	}
 	
-	const double *inputData=input.data(),*weightData=weight.data();
-	int width=input.width(),height=input.height();
-	DImage foo(width,height);
-	double *fooData=foo.data(),*outputData=output.data();
-
-	// horizontal filtering
-	for(int i=0;i<height;i++)
-		for(int j=0;j<width-1;j++)
-		{
-			int offset=i*width+j;
-			fooData[offset]=(inputData[offset+1]-inputData[offset])*weightData[offset];
-		}
-	for(int i=0;i<height;i++)
-		for(int j=0;j<width;j++)
-		{
-			int offset=i*width+j;
-			if(j<width-1)
-				outputData[offset]-=fooData[offset];
-			if(j>0)
-				outputData[offset]+=fooData[offset-1];
-		}
-	foo.reset();
-	// vertical filtering
-	for(int i=0;i<height-1;i++)
-		for(int j=0;j<width;j++)
-		{
-			int offset=i*width+j;
-			fooData[offset]=(inputData[offset+width]-inputData[offset])*weightData[offset];
-		}
-	for(int i=0;i<height;i++)
-		for(int j=0;j<width;j++)
-		{
-			int offset=i*width+j;
-			if(i<height-1)
-				outputData[offset]-=fooData[offset];
-			if(i>0)
-				outputData[offset]+=fooData[offset-width];
-		}
+	LaplacianKernel<T> kernel;
+	kernel.inputData[0]=input.data();
+	kernel.outputData[0]=output.data();
+	kernel.nImages=1;
+	kernel.weightData=weight.data();
+	kernel.width=input.width();
+	kernel.height=input.height();
+	pool.run(kernel,kernel.height);
+}
+
+template <class T>
+void OpticalFlow::Laplacian(Image<T> &output1, Image<T> &output2, const Image<T> &input1, const Image<T> &input2, const Image<T>& weight, ThreadPool& pool)
+{
+	if(output1.matchDimension(input1)==false)
+		output1.allocate(input1);
+	if(output2.matchDimension(input2)==false)
+		output2.allocate(input2);
+
+	if(input1.matchDimension(weight)==false || input2.matchDimension(weight)==false)
+	{
+		cout<<"Error in image dimension matching OpticalFlow::Laplacian()!"<<endl;
+		return;
+	}
+
+	LaplacianKernel<T> kernel;
+	kernel.inputData[0]=input1.data();
+	kernel.inputData[1]=input2.data();
+	kernel.outputData[0]=output1.data();
+	kernel.outputData[1]=output2.data();
+	kernel.nImages=2;
+	kernel.weightData=weight.data();
+	kernel.width=input1.width();
+	kernel.height=input1.height();
+	pool.run(kernel,kernel.height);
 }
 
 void OpticalFlow::testLaplacian(int dim)
@@ -438,72 +1134,338 @@ void OpticalFlow::testLaplacian(int dim)
 //--------------------------------------------------------------------------------------
 // function to perfomr coarse to fine optical flow estimation
 //--------------------------------------------------------------------------------------
-void OpticalFlow::Coarse2FineFlow(DImage &vx, DImage &vy, DImage &warpI2,const DImage &Im1, const DImage &Im2, double alpha, double ratio, int minWidth, 
-																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations)
+template <class T>
+void OpticalFlow::Coarse2FineFlow(Image<T> &vx, Image<T> &vy, Image<T> &warpI2,const Image<T> &Im1, const Image<T> &Im2, double alpha, double ratio, int minWidth, 
+																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para)
 {
+	Coarse2FineFlow<T>(vx,vy,warpI2,Im1,Im2,NULL,NULL,alpha,ratio,minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations,para);
+}
+
+template <class T>
+void OpticalFlow::Coarse2FineFlow(Image<T> &vx, Image<T> &vy, Image<T> &warpI2,const Image<T> &Im1, const Image<T> &Im2, const Image<T> *pInitVx, const Image<T> *pInitVy,
+																	 double alpha, double ratio, int minWidth, int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para)
+{
+	// the worker threads are shared by the pyramids and all the levels, and are kept with the
+	// pyramids, the features and the workspaces in the cache of the calling thread
+	FlowCache<T>& cache=FlowCache<T>::get();
+	ThreadPool& pool=cache.pool(para.nThreads);
+
 	// first build the pyramid of the two images
-	GaussianPyramid GPyramid1;
-	GaussianPyramid GPyramid2;
+	GaussianPyramid<T>& GPyramid1=cache.Pyramids[0];
+	GaussianPyramid<T>& GPyramid2=cache.Pyramids[1];
+	FlowProbe probe(para.pProfile);
 	if(IsDisplay)
 		cout<<"Constructing pyramid...";
-	GPyramid1.ConstructPyramid(Im1,ratio,minWidth);
-	GPyramid2.ConstructPyramid(Im2,ratio,minWidth);
+	probe.start();
+	GaussianPyramid<T>::ConstructPyramids(GPyramid1,GPyramid2,Im1,Im2,ratio,minWidth,pool);
+	probe.stop(FlowProfile::Pyramid);
+	probe.start();
+	Image<T>* Features1=cache.features(0,GPyramid1.nlevels());
+	Image<T>* Features2=cache.features(1,GPyramid2.nlevels());
+	im2feature(Features1,GPyramid1,&cache.FeatureBuffer);
+	im2feature(Features2,GPyramid2,&cache.FeatureBuffer);
+	probe.stop(FlowProfile::Features);
 	if(IsDisplay)
 		cout<<"done!"<<endl;
-	
+
+	Coarse2FineFlow(vx,vy,warpI2,GPyramid1,GPyramid2,Features1,Features2,alpha,ratio,nOuterFPIterations,nInnerFPIterations,nCGIterations,para,pool,pInitVx,pInitVy,
+						  cache.workspaces(GPyramid1.nlevels()));
+}
+
+//--------------------------------------------------------------------------------------
+// the coarse to fine iterations, from the pyramids and their features
+// the level 0 of the pyramids are the original images
+// with a prior flow, the iterations start from the prior downsampled to the top level,
+// para.nWarmSkipLevels levels below the coarsest one
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlow::Coarse2FineFlow(Image<T> &vx, Image<T> &vy, Image<T> &warpI2, GaussianPyramid<T> &GPyramid1, GaussianPyramid<T> &GPyramid2,
+																	 const Image<T> *Features1, const Image<T> *Features2, double alpha, double ratio,
+																	 int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para, ThreadPool& pool,
+																	 const Image<T> *pInitVx, const Image<T> *pInitVy, FlowWorkspace<T>* workspaces)
+{
+	// a prior whose two components differ in size is ignored
+	bool IsWarmStart=(pInitVx!=NULL && pInitVy!=NULL && pInitVx->matchDimension(*pInitVy));
+	int topLevel=GPyramid1.nlevels()-1;
+	if(IsWarmStart)
+	{
+		topLevel=__max(topLevel-para.nWarmSkipLevels,0);
+		if(para.nWarmOuterFPIterations>0)
+			nOuterFPIterations=para.nWarmOuterFPIterations;
+	}
+
+	FlowWorkspace<T>* pTempWorkspaces=NULL;
+	if(workspaces==NULL)
+		workspaces=pTempWorkspaces=new FlowWorkspace<T>[GPyramid1.nlevels()];
+
 	// now iterate from the top level to the bottom
-	DImage Image1,Image2,WarpImage2;
+	// the flow and the warped image of each level are kept in its workspace, and the flow of a
+	// level is upsampled from the one of the coarser level
+	// the outer iterations of the current level
+	int nLevelOuterFPIterations=nOuterFPIterations;
+	FlowProbe probe(para.pProfile);
 
-	for(int k=GPyramid1.nlevels()-1;k>=0;k--)
+	for(int k=topLevel;k>=0;k--)
 	{
 		if(IsDisplay)
 			cout<<"Pyramid level "<<k;
 		int width=GPyramid1.Image(k).width();
 		int height=GPyramid1.Image(k).height();
-		im2feature(Image1,GPyramid1.Image(k));
-		im2feature(Image2,GPyramid2.Image(k));
+		const Image<T>& Image1=Features1[k];
+		const Image<T>& Image2=Features2[k];
+		Image<T>& levelVx=workspaces[k].vx;
+		Image<T>& levelVy=workspaces[k].vy;
+		Image<T>& WarpImage2=workspaces[k].warpIm2;
+		if(probe.enabled())
+			probe.profile().beginLevel(k,width,height);
 
-		if(k==GPyramid1.nlevels()-1) // if at the top level
+		if(k==topLevel && IsWarmStart)
 		{
-			vx.allocate(width,height);
-			vy.allocate(width,height);
+			// the prior flow, resized to the level and scaled accordingly
+			probe.start();
+			// each component is scaled along its own axis, as the prior may have another aspect ratio
+			pInitVx->imresize(levelVx,width,height,workspaces[k].flowPlan);
+			levelVx.Multiplywith((double)width/pInitVx->width());
+			pInitVy->imresize(levelVy,width,height,workspaces[k].flowPlan);
+			levelVy.Multiplywith((double)height/pInitVy->height());
+			probe.stop(FlowProfile::Upsampling);
+			probe.start();
+			warpFL(WarpImage2,Image1,Image2,levelVx,levelVy);
+			probe.stop(FlowProfile::Warping);
+		}
+		else if(k==topLevel) // if at the top level
+		{
+			Image<T>* flows[2]={&levelVx,&levelVy};
+			for(int l=0;l<2;l++)
+				if(flows[l]->width()!=width || flows[l]->height()!=height || flows[l]->nchannels()!=1)
+					flows[l]->allocate(width,height);
+				else
+					flows[l]->reset();
 			//warpI2.copyData(Image2);
 			WarpImage2.copyData(Image2);
 		}
 		else
 		{
-
-			vx.imresize(width,height);
-			vx.Multiplywith(1/ratio);
-			vy.imresize(width,height);
-			vy.Multiplywith(1/ratio);
+			probe.start();
+			workspaces[k+1].vx.imresize(levelVx,width,height,workspaces[k].flowPlan);
+			levelVx.Multiplywith(1/ratio);
+			workspaces[k+1].vy.imresize(levelVy,width,height,workspaces[k].flowPlan);
+			levelVy.Multiplywith(1/ratio);
+			probe.stop(FlowProfile::Upsampling);
 			//warpFL(warpI2,GPyramid1.Image(k),GPyramid2.Image(k),vx,vy);
-			warpFL(WarpImage2,Image1,Image2,vx,vy);
+			probe.start();
+			warpFL(WarpImage2,Image1,Image2,levelVx,levelVy);
+			probe.stop(FlowProfile::Warping);
 		}
 		//SmoothFlowPDE(GPyramid1.Image(k),GPyramid2.Image(k),warpI2,vx,vy,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations);
 		//SmoothFlowPDE(Image1,Image2,WarpImage2,vx,vy,alpha*pow((1/ratio),k),nOuterFPIterations,nInnerFPIterations,nCGIterations);
-		SmoothFlowPDE(Image1,Image2,WarpImage2,vx,vy,alpha,nOuterFPIterations,nInnerFPIterations,nCGIterations);
+		int nIterations=SmoothFlowPDE(Image1,Image2,WarpImage2,levelVx,levelVy,alpha,nLevelOuterFPIterations,nInnerFPIterations,nCGIterations,para,pool,workspaces[k]);
+		if(para.IsAdaptiveBudget)
+			nLevelOuterFPIterations=__min(nIterations+1,nOuterFPIterations);
 		if(IsDisplay)
 			cout<<endl;
 	}
-	warpFL(warpI2,Im1,Im2,vx,vy);
+	vx.copyData(workspaces[0].vx);
+	vy.copyData(workspaces[0].vy);
+	probe.start();
+	warpFL(warpI2,GPyramid1.Image(0),GPyramid2.Image(0),vx,vy);
+	probe.stop(FlowProfile::Warping);
+	if(pTempWorkspaces!=NULL)
+		delete []pTempWorkspaces;
+}
+
+//--------------------------------------------------------------------------------------
+// the flow of one pair of a batch, run as a task of the thread pool
+//--------------------------------------------------------------------------------------
+template <class T>
+class FlowBatchKernel
+{
+public:
+	Image<T> *vx,*vy,*warpI2;
+	const Image<T> *Im1,*Im2;
+	double alpha,ratio;
+	int minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations;
+	SolverPara para;
+	void operator()(int task,int)
+	{
+		OpticalFlow::Coarse2FineFlow(vx[task],vy[task],warpI2[task],Im1[task],Im2[task],alpha,ratio,minWidth,
+												  nOuterFPIterations,nInnerFPIterations,nCGIterations,para);
+	}
+};
+
+//--------------------------------------------------------------------------------------
+// function to perform coarse to fine optical flow estimation on a batch of image pairs
+// the pairs are scheduled with work stealing, as their cost varies with the image size
+// and with the convergence of the solver
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlow::Coarse2FineFlowBatch(Image<T> *vx, Image<T> *vy, Image<T> *warpI2, const Image<T> *Im1, const Image<T> *Im2, int nPairs, double alpha, double ratio, int minWidth, 
+																			int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para)
+{
+	FlowBatchKernel<T> kernel;
+	kernel.vx=vx;
+	kernel.vy=vy;
+	kernel.warpI2=warpI2;
+	kernel.Im1=Im1;
+	kernel.Im2=Im2;
+	kernel.alpha=alpha;
+	kernel.ratio=ratio;
+	kernel.minWidth=minWidth;
+	kernel.nOuterFPIterations=nOuterFPIterations;
+	kernel.nInnerFPIterations=nInnerFPIterations;
+	kernel.nCGIterations=nCGIterations;
+	// the threads are used across the pairs, each pair is computed by one thread
+	// the pairs run concurrently, so they are not profiled
+	kernel.para=para;
+	kernel.para.nThreads=1;
+	kernel.para.pProfile=NULL;
+
+	ThreadPool pool(__min(para.nThreads<=0?ThreadPool::ncores():para.nThreads,__max(nPairs,1)));
+	pool.runTasks(kernel,nPairs);
+}
+
+//--------------------------------------------------------------------------------------
+// the features of the levels of two pyramids, run as tasks of the thread pool
+//--------------------------------------------------------------------------------------
+template <class T>
+class PyramidFeatureKernel
+{
+public:
+	GaussianPyramid<T>* pyramids[2];
+	Image<T>* features[2];
+	// the tasks are the levels from the largest, each for the two pyramids
+	void operator()(int task,int)
+	{
+		int level=task/2;
+		GaussianPyramid<T>* pyramid=pyramids[task%2];
+		if(level<pyramid->nlevels())
+			OpticalFlow::im2feature(features[task%2][level],pyramid->Image(level));
+	}
+};
+
+//--------------------------------------------------------------------------------------
+// one direction of a bidirectional flow, run as a task of the thread pool, from the
+// pyramid and the features of the image task to the ones of the other image, with the
+// pool and the workspaces of the direction
+//--------------------------------------------------------------------------------------
+template <class T>
+class BidirectionalFlowKernel
+{
+public:
+	Image<T> *vx[2],*vy[2],*warpI2[2];
+	GaussianPyramid<T>* pyramids[2];
+	const Image<T>* features[2];
+	double alpha,ratio;
+	int nOuterFPIterations,nInnerFPIterations,nCGIterations;
+	SolverPara para[2];
+	ThreadPool* pools[2];
+	FlowWorkspace<T>* workspaces[2];
+	void operator()(int task,int)
+	{
+		int other=1-task;
+		OpticalFlow::Coarse2FineFlow(*vx[task],*vy[task],*warpI2[task],*pyramids[task],*pyramids[other],features[task],features[other],
+												  alpha,ratio,nOuterFPIterations,nInnerFPIterations,nCGIterations,para[task],*pools[task],
+												  (const Image<T>*)NULL,(const Image<T>*)NULL,workspaces[task]);
+	}
+};
+
+//--------------------------------------------------------------------------------------
+// function to perform coarse to fine optical flow estimation in both directions
+// each flow is the same as the one of Coarse2FineFlow() on its pair of images
+// the pools, the pyramids, the features and the workspaces are kept in the cache of the
+// calling thread, as by Coarse2FineFlow(); the pool of the pyramids and of the features
+// also runs the two directions, each with its own pool
+//--------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlow::Coarse2FineFlowBidirectional(Image<T> &vx, Image<T> &vy, Image<T> &warpI2, Image<T> &backVx, Image<T> &backVy, Image<T> &warpI1,
+																					const Image<T> &Im1, const Image<T> &Im2, double alpha, double ratio, int minWidth,
+																					int nOuterFPIterations, int nInnerFPIterations, int nCGIterations, const SolverPara& para)
+{
+	int nThreads=(para.nThreads<=0)?ThreadPool::ncores():para.nThreads;
+	FlowCache<T>& cache=FlowCache<T>::get();
+	ThreadPool& pool=cache.pool(nThreads);
+
+	// the pyramids and the features of the two images, shared by the two flows
+	GaussianPyramid<T>& GPyramid1=cache.Pyramids[0];
+	GaussianPyramid<T>& GPyramid2=cache.Pyramids[1];
+	FlowProbe probe(para.pProfile);
+	probe.start();
+	GaussianPyramid<T>::ConstructPyramids(GPyramid1,GPyramid2,Im1,Im2,ratio,minWidth,pool);
+	probe.stop(FlowProfile::Pyramid);
+	probe.start();
+	int nLevels=GPyramid1.nlevels();
+	PyramidFeatureKernel<T> featureKernel;
+	featureKernel.pyramids[0]=&GPyramid1;
+	featureKernel.pyramids[1]=&GPyramid2;
+	featureKernel.features[0]=cache.features(0,nLevels);
+	featureKernel.features[1]=cache.features(1,nLevels);
+	pool.runTasks(featureKernel,nLevels*2);
+	probe.stop(FlowProfile::Features);
+
+	BidirectionalFlowKernel<T> kernel;
+	kernel.vx[0]=&vx;
+	kernel.vy[0]=&vy;
+	kernel.warpI2[0]=&warpI2;
+	kernel.vx[1]=&backVx;
+	kernel.vy[1]=&backVy;
+	kernel.warpI2[1]=&warpI1;
+	kernel.pyramids[0]=&GPyramid1;
+	kernel.pyramids[1]=&GPyramid2;
+	kernel.features[0]=featureKernel.features[0];
+	kernel.features[1]=featureKernel.features[1];
+	kernel.alpha=alpha;
+	kernel.ratio=ratio;
+	kernel.nOuterFPIterations=nOuterFPIterations;
+	kernel.nInnerFPIterations=nInnerFPIterations;
+	kernel.nCGIterations=nCGIterations;
+	// the threads are split between the two directions, which run concurrently, so only the
+	// pyramids and the features are profiled
+	kernel.para[0]=kernel.para[1]=para;
+	kernel.para[0].nThreads=(nThreads+1)/2;
+	kernel.para[1].nThreads=__max(nThreads/2,1);
+	kernel.para[0].pProfile=kernel.para[1].pProfile=NULL;
+	for(int k=0;k<2;k++)
+	{
+		kernel.pools[k]=&cache.pool(kernel.para[k].nThreads,k+1);
+		kernel.workspaces[k]=cache.workspaces(nLevels,k);
+	}
+	pool.runTasks(kernel,2);
 }
 
 //---------------------------------------------------------------------------------------
 // function to convert image to feature image
+// the gray image and its derivatives are computed straight into the planes of a planar
+// feature image, and into pBuffer (3*width*height elements, temporary images if NULL)
+// for an interleaved one
 //---------------------------------------------------------------------------------------
-void OpticalFlow::im2feature(DImage &imfeature, const DImage &im)
+template <class T>
+void OpticalFlow::im2feature(Image<T> &imfeature, const Image<T> &im, T* pBuffer)
 {
 	int width=im.width();
 	int height=im.height();
 	int nchannels=im.nchannels();
 	if(nchannels==1)
 	{
-		imfeature.allocate(im.width(),im.height(),3);
-		DImage imdx,imdy;
+		imfeature.setPlanar(im.isPlanar());
+		if(imfeature.width()!=width || imfeature.height()!=height || imfeature.nchannels()!=3)
+			imfeature.allocate(width,height,3);
+		Image<T> imdx,imdy;
+		T* data=imfeature.data();
+		if(imfeature.isPlanar())
+		{
+			memcpy(imfeature.plane(0),im.data(),sizeof(T)*width*height);
+			imdx.attachPlanar(imfeature.plane(1),width,height,1);
+			imdy.attachPlanar(imfeature.plane(2),width,height,1);
+		}
+		else if(pBuffer!=NULL)
+		{
+			imdx.attachPlanar(pBuffer,width,height,1);
+			imdy.attachPlanar(pBuffer+width*height,width,height,1);
+		}
 		im.dx(imdx,true);
 		im.dy(imdy,true);
-		double* data=imfeature.data();
+		if(imfeature.isPlanar())
+			return;
 		for(int i=0;i<height;i++)
 			for(int j=0;j<width;j++)
 			{
@@ -515,14 +1477,37 @@ void OpticalFlow::im2feature(DImage &imfeature, const DImage &im)
 	}
 	else if(nchannels==3)
 	{
-		DImage grayImage;
+		imfeature.setPlanar(im.isPlanar());
+		if(imfeature.width()!=width || imfeature.height()!=height || imfeature.nchannels()!=5)
+			imfeature.allocate(width,height,5);
+		Image<T> grayImage,imdx,imdy;
+		T* data=imfeature.data();
+		if(imfeature.isPlanar())
+		{
+			grayImage.attachPlanar(imfeature.plane(0),width,height,1);
+			imdx.attachPlanar(imfeature.plane(1),width,height,1);
+			imdy.attachPlanar(imfeature.plane(2),width,height,1);
+		}
+		else if(pBuffer!=NULL)
+		{
+			grayImage.attachPlanar(pBuffer,width,height,1);
+			imdx.attachPlanar(pBuffer+width*height,width,height,1);
+			imdy.attachPlanar(pBuffer+width*height*2,width,height,1);
+		}
 		im.desaturate(grayImage);
-
-		imfeature.allocate(im.width(),im.height(),5);
-		DImage imdx,imdy;
 		grayImage.dx(imdx,true);
 		grayImage.dy(imdy,true);
-		double* data=imfeature.data();
+		if(imfeature.isPlanar())
+		{
+			const T *pR=im.plane(0),*pG=im.plane(1),*pB=im.plane(2);
+			T *pDiff1=imfeature.plane(3),*pDiff2=imfeature.plane(4);
+			for(int i=0;i<width*height;i++)
+			{
+				pDiff1[i]=pG[i]-pR[i];
+				pDiff2[i]=pG[i]-pB[i];
+			}
+			return;
+		}
 		for(int i=0;i<height;i++)
 			for(int j=0;j<width;j++)
 			{
@@ -537,3 +1522,23 @@ void OpticalFlow::im2feature(DImage &imfeature, const DImage &im)
 	else
 		imfeature.copyData(im);
 }
+
+//---------------------------------------------------------------------------------------
+// function to convert the levels of a pyramid to feature images
+// the temporary images of interleaved levels are views of buffer, which is only
+// reallocated when it is too small for the level 0
+//---------------------------------------------------------------------------------------
+template <class T>
+void OpticalFlow::im2feature(Image<T> *features, GaussianPyramid<T> &pyramid, Image<T>* buffer)
+{
+	T* pBuffer=NULL;
+	if(buffer!=NULL && !pyramid.Image(0).isPlanar())
+	{
+		int nPixels=pyramid.Image(0).npixels();
+		if(buffer->nelements()<nPixels*3)
+			buffer->allocate(pyramid.Image(0).width(),pyramid.Image(0).height(),3);
+		pBuffer=buffer->data();
+	}
+	for(int k=0;k<pyramid.nlevels();k++)
+		im2feature(features[k],pyramid.Image(k),pBuffer);
+}
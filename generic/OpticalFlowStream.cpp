@@ -0,0 +1,97 @@
+#include "OpticalFlowStream.h"
+
+template <class T>
+OpticalFlowStream<T>::OpticalFlowStream(double _alpha, double _ratio, int _minWidth, int _nOuterFPIterations, int _nInnerFPIterations, int _nCGIterations,
+																		const SolverPara& _para)
+{
+	alpha=_alpha;
+	ratio=_ratio;
+	minWidth=_minWidth;
+	nOuterFPIterations=_nOuterFPIterations;
+	nInnerFPIterations=_nInnerFPIterations;
+	nCGIterations=_nCGIterations;
+	para=_para;
+	pPool=new ThreadPool(para.nThreads);
+	pFeatures[0]=pFeatures[1]=NULL;
+	nFeatures[0]=nFeatures[1]=0;
+	pWorkspaces=NULL;
+	nWorkspaces=0;
+	current=0;
+	IsEmpty=true;
+	IsWarmStart=HasLastFlow=false;
+}
+
+template <class T>
+OpticalFlowStream<T>::~OpticalFlowStream(void)
+{
+	clearSlot(0);
+	clearSlot(1);
+	if(pWorkspaces!=NULL)
+		delete []pWorkspaces;
+	delete pPool;
+}
+
+template <class T>
+void OpticalFlowStream<T>::clearSlot(int slot)
+{
+	if(pFeatures[slot]!=NULL)
+		delete []pFeatures[slot];
+	pFeatures[slot]=NULL;
+	nFeatures[slot]=0;
+}
+
+template <class T>
+void OpticalFlowStream<T>::reset(void)
+{
+	IsEmpty=true;
+	HasLastFlow=false;
+}
+
+template <class T>
+bool OpticalFlowStream<T>::addFrame(const Image<T>& frame, Image<T>& vx, Image<T>& vy, Image<T>& warpI2)
+{
+	// build the pyramid and the features of the new frame in the free slot
+	int last=current;
+	current=1-current;
+	FlowProbe probe(para.pProfile);
+	probe.start();
+	Pyramids[current].ConstructPyramid(frame,ratio,minWidth,*pPool);
+	probe.stop(FlowProfile::Pyramid);
+	probe.start();
+	if(nFeatures[current]!=Pyramids[current].nlevels())
+	{
+		clearSlot(current);
+		nFeatures[current]=Pyramids[current].nlevels();
+		pFeatures[current]=new Image<T>[nFeatures[current]];
+	}
+	OpticalFlow::im2feature(pFeatures[current],Pyramids[current],&FeatureBuffer);
+	probe.stop(FlowProfile::Features);
+
+	bool IsFirst=IsEmpty || frame.matchDimension(Pyramids[last].Image(0))==false;
+	IsEmpty=false;
+	if(IsFirst)
+	{
+		HasLastFlow=false;
+		return false;
+	}
+
+	if(nWorkspaces!=Pyramids[current].nlevels())
+	{
+		if(pWorkspaces!=NULL)
+			delete []pWorkspaces;
+		nWorkspaces=Pyramids[current].nlevels();
+		pWorkspaces=new FlowWorkspace<T>[nWorkspaces];
+	}
+
+	bool IsWarm=IsWarmStart && HasLastFlow;
+	OpticalFlow::Coarse2FineFlow(vx,vy,warpI2,Pyramids[last],Pyramids[current],pFeatures[last],pFeatures[current],alpha,ratio,
+											   nOuterFPIterations,nInnerFPIterations,nCGIterations,para,*pPool,
+											   IsWarm?&LastVx:NULL,IsWarm?&LastVy:NULL,pWorkspaces);
+	if(IsWarmStart)
+	{
+		LastVx.copyData(vx);
+		LastVy.copyData(vy);
+		HasLastFlow=true;
+	}
+	return true;
+}
@@ -0,0 +1,61 @@
+#ifndef _OpticalFlowStream_h
+#define _OpticalFlowStream_h
+
+#include "OpticalFlow.h"
+
+//---------------------------------------------------------------------------------------
+// optical flow of a video, frame by frame
+// The pyramid and the feature images of the last frame are kept, so that when the next
+// frame is added only the pyramid of the new frame is built, and the flow from the last
+// frame to the new one is computed. With warm start, the flow of the last pair is used
+// as the initial flow of the next one (see SolverPara::nWarmSkipLevels and
+// nWarmOuterFPIterations). The workspaces of the solver are kept as well, one per level,
+// so that the frames of the same size are processed without reallocating them.
+// T is the type of the pixels (float or double).
+//---------------------------------------------------------------------------------------
+template <class T>
+class OpticalFlowStream
+{
+private:
+	double alpha,ratio;
+	int minWidth,nOuterFPIterations,nInnerFPIterations,nCGIterations;
+	SolverPara para;
+	ThreadPool* pPool;
+
+	// two slots, the last frame and the new one, swapped after each frame
+	GaussianPyramid<T> Pyramids[2];
+	// the features of the levels, kept while the number of levels does not change
+	Image<T>* pFeatures[2];
+	int nFeatures[2];
+	Image<T> FeatureBuffer;
+	int current;
+	bool IsEmpty;
+
+	// the flow of the last pair, for the warm start
+	bool IsWarmStart,HasLastFlow;
+	Image<T> LastVx,LastVy;
+
+	// the workspaces of the levels of the pyramids
+	FlowWorkspace<T>* pWorkspaces;
+	int nWorkspaces;
+
+	void clearSlot(int slot);
+	// not copyable
+	OpticalFlowStream(const OpticalFlowStream<T>& other);
+	OpticalFlowStream<T>& operator=(const OpticalFlowStream<T>& other);
+public:
+	OpticalFlowStream(double alpha=0.01,double ratio=0.75,int minWidth=30,int nOuterFPIterations=15,int nInnerFPIterations=1,int nCGIterations=40,
+								const SolverPara& para=SolverPara());
+	~OpticalFlowStream(void);
+
+	// add the next frame, and compute the flow from the last frame to it
+	// returns false (and computes nothing) for the first frame of a sequence; a frame whose
+	// size differs from the last frame starts a new sequence
+	bool addFrame(const Image<T>& frame,Image<T>& vx,Image<T>& vy,Image<T>& warpI2);
+	// forget the last frame
+	void reset(void);
+	inline bool hasFrame() const {return !IsEmpty;};
+	inline void setWarmStart(bool isWarmStart=true) {IsWarmStart=isWarmStart;};
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef _ResizePlan_h
+#define _ResizePlan_h
+
+//---------------------------------------------------------------------------------------
+// the sampling of the bilinear resizing of ImageProcessing::ResizeImage(): for every
+// column (row) of the destination, the two columns (rows) of the source and their weights
+// The plan only depends on the sizes, so a plan kept by the caller is reused as long as
+// the sizes do not change (e.g. for every frame of a video) and resize() only does the
+// weighted sums.
+//---------------------------------------------------------------------------------------
+class ResizePlan
+{
+private:
+	int SrcWidth,SrcHeight,DstWidth,DstHeight;
+	double xRatio,yRatio;
+	int *pColumns,*pRows;
+	double *pxWeights,*pyWeights;
+	// the working rows of ImageProcessing::smoothResize(), in bytes
+	mutable double* pRowBuffer;
+	mutable size_t nRowBuffer;
+	static inline void sample(int dstSize,int srcSize,double ratio,int* pIndices,double* pWeights);
+	// not copyable
+	ResizePlan(const ResizePlan& other);
+	ResizePlan& operator=(const ResizePlan& other);
+public:
+	inline ResizePlan(void) {SrcWidth=SrcHeight=DstWidth=DstHeight=-1;xRatio=yRatio=0;pColumns=pRows=NULL;pxWeights=pyWeights=NULL;pRowBuffer=NULL;nRowBuffer=0;};
+	inline ~ResizePlan(void) {clear();if(pRowBuffer!=NULL) delete []pRowBuffer;};
+	inline void clear(void);
+	// the plan of ResizeImage(...,Ratio) and of ResizeImage(...,DstWidth,DstHeight)
+	inline void prepare(int srcWidth,int srcHeight,double ratio);
+	inline void prepare(int srcWidth,int srcHeight,int dstWidth,int dstHeight);
+	inline void prepare(int srcWidth,int srcHeight,int dstWidth,int dstHeight,double xratio,double yratio);
+
+	inline int dstwidth() const {return DstWidth;};
+	inline int dstheight() const {return DstHeight;};
+	// the columns u[2*j],u[2*j+1] of the source sampled by the column j, with the weights w[2*j],w[2*j+1]
+	inline const int* columns() const {return pColumns;};
+	inline const double* xweights() const {return pxWeights;};
+	inline const int* rows() const {return pRows;};
+	inline const double* yweights() const {return pyWeights;};
+	// a buffer of nElements elements for the rows of ImageProcessing::smoothResize(), kept with the
+	// plan so that a plan that is reused does not allocate it again (a plan is used by one thread at a time)
+	template <class T2>
+	inline T2* rowBuffer(int nElements) const;
+
+	// the same as ResizeImage()
+	template <class T1,class T2>
+	void resize(const T1* pSrcImage,T2* pDstImage,int nChannels) const;
+	// the row i of the destination, from the rows rows()[2*i] and rows()[2*i+1] of the source
+	template <class T1,class T2>
+	inline void resizeRow(const T1* pSrcRow0,const T1* pSrcRow1,T2* pDstRow,int i,int nChannels) const;
+};
+
+inline void ResizePlan::clear(void)
+{
+	if(pColumns!=NULL)
+		delete []pColumns;
+	if(pRows!=NULL)
+		delete []pRows;
+	if(pxWeights!=NULL)
+		delete []pxWeights;
+	if(pyWeights!=NULL)
+		delete []pyWeights;
+	pColumns=pRows=NULL;
+	pxWeights=pyWeights=NULL;
+	SrcWidth=SrcHeight=DstWidth=DstHeight=-1;
+}
+
+inline void ResizePlan::prepare(int srcWidth,int srcHeight,double ratio)
+{
+	int dstWidth=(double)srcWidth*ratio;
+	int dstHeight=(double)srcHeight*ratio;
+	prepare(srcWidth,srcHeight,dstWidth,dstHeight,ratio,ratio);
+}
+
+inline void ResizePlan::prepare(int srcWidth,int srcHeight,int dstWidth,int dstHeight)
+{
+	prepare(srcWidth,srcHeight,dstWidth,dstHeight,(double)dstWidth/srcWidth,(double)dstHeight/srcHeight);
+}
+
+inline void ResizePlan::prepare(int srcWidth,int srcHeight,int dstWidth,int dstHeight,double xratio,double yratio)
+{
+	if(srcWidth==SrcWidth && srcHeight==SrcHeight && dstWidth==DstWidth && dstHeight==DstHeight && xratio==xRatio && yratio==yRatio)
+		return;
+	clear();
+	SrcWidth=srcWidth;
+	SrcHeight=srcHeight;
+	DstWidth=dstWidth;
+	DstHeight=dstHeight;
+	xRatio=xratio;
+	yRatio=yratio;
+	pColumns=new int[DstWidth*2];
+	pxWeights=new double[DstWidth*2];
+	pRows=new int[DstHeight*2];
+	pyWeights=new double[DstHeight*2];
+	sample(DstWidth,SrcWidth,xRatio,pColumns,pxWeights);
+	sample(DstHeight,SrcHeight,yRatio,pRows,pyWeights);
+}
+
+template <class T2>
+inline T2* ResizePlan::rowBuffer(int nElements) const
+{
+	size_t nBytes=sizeof(T2)*nElements;
+	if(nRowBuffer<nBytes)
+	{
+		if(pRowBuffer!=NULL)
+			delete []pRowBuffer;
+		pRowBuffer=new double[(nBytes+sizeof(double)-1)/sizeof(double)];
+		nRowBuffer=nBytes;
+	}
+	return (T2*)pRowBuffer;
+}
+
+//---------------------------------------------------------------------------------------
+// the positions and the weights of BilinearInterpolate() along one axis
+//---------------------------------------------------------------------------------------
+inline void ResizePlan::sample(int dstSize,int srcSize,double ratio,int* pIndices,double* pWeights)
+{
+	for(int j=0;j<dstSize;j++)
+	{
+		double x=(double)(j+1)/ratio-1;
+		int xx=x;
+		double dx=__max(__min(x-xx,1),0);
+		for(int m=0;m<=1;m++)
+		{
+			pIndices[j*2+m]=ImageProcessing::EnforceRange(xx+m,srcSize);
+			pWeights[j*2+m]=fabs(1-m-dx);
+		}
+	}
+}
+
+template <class T1,class T2>
+void ResizePlan::resize(const T1* pSrcImage,T2* pDstImage,int nChannels) const
+{
+	for(int i=0;i<DstHeight;i++)
+		resizeRow(pSrcImage+pRows[i*2]*SrcWidth*nChannels,pSrcImage+pRows[i*2+1]*SrcWidth*nChannels,pDstImage+i*DstWidth*nChannels,i,nChannels);
+}
+
+//---------------------------------------------------------------------------------------
+// the weighted sum is done in the order of BilinearInterpolate()
+//---------------------------------------------------------------------------------------
+template <class T1,class T2>
+inline void ResizePlan::resizeRow(const T1* pSrcRow0,const T1* pSrcRow1,T2* pDstRow,int i,int nChannels) const
+{
+	double wy0=pyWeights[i*2],wy1=pyWeights[i*2+1];
+	if(nChannels==1)
+	{
+		for(int j=0;j<DstWidth;j++)
+		{
+			int u0=pColumns[j*2],u1=pColumns[j*2+1];
+			double wx0=pxWeights[j*2],wx1=pxWeights[j*2+1];
+			T2 value=0;
+			value+=pSrcRow0[u0]*(wx0*wy0);
+			value+=pSrcRow1[u0]*(wx0*wy1);
+			value+=pSrcRow0[u1]*(wx1*wy0);
+			value+=pSrcRow1[u1]*(wx1*wy1);
+			pDstRow[j]=value;
+		}
+		return;
+	}
+	for(int j=0;j<DstWidth;j++)
+	{
+		const T1* p00=pSrcRow0+pColumns[j*2]*nChannels;
+		const T1* p01=pSrcRow1+pColumns[j*2]*nChannels;
+		const T1* p10=pSrcRow0+pColumns[j*2+1]*nChannels;
+		const T1* p11=pSrcRow1+pColumns[j*2+1]*nChannels;
+		double s00=pxWeights[j*2]*wy0,s01=pxWeights[j*2]*wy1,s10=pxWeights[j*2+1]*wy0,s11=pxWeights[j*2+1]*wy1;
+		T2* result=pDstRow+j*nChannels;
+		for(int l=0;l<nChannels;l++)
+		{
+			T2 value=0;
+			value+=p00[l]*s00;
+			value+=p01[l]*s01;
+			value+=p10[l]*s10;
+			value+=p11[l]*s11;
+			result[l]=value;
+		}
+	}
+}
+
+#endif
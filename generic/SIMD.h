@@ -0,0 +1,43 @@
+#ifndef _SIMD_h
+#define _SIMD_h
+
+//---------------------------------------------------------------------------------------
+// runtime selection of the instruction set of the vectorized kernels
+// The kernels are compiled for their instruction set with the target attribute of GCC and
+// clang, so the rest of the library keeps the default flags, and they are called only if
+// the CPU supports it. Define NO_SIMD to build without them.
+//---------------------------------------------------------------------------------------
+#if !defined(NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define SIMD_X86
+	#include <immintrin.h>
+#endif
+
+class SIMD
+{
+public:
+	enum Level{None,AVX2,AVX512};
+private:
+	static inline Level& maxLevel() {static Level value=AVX512; return value;};
+	static inline Level cpuLevel()
+	{
+#ifdef SIMD_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx512f"))
+			return AVX512;
+		if(__builtin_cpu_supports("avx2"))
+			return AVX2;
+#endif
+		return None;
+	};
+public:
+	// the best instruction set supported by the CPU, and allowed by setMaxLevel()
+	static inline Level level()
+	{
+		static Level value=cpuLevel();
+		return value<maxLevel()?value:maxLevel();
+	};
+	// e.g. setMaxLevel(SIMD::None) to run the scalar code
+	static inline void setMaxLevel(Level level) {maxLevel()=level;};
+};
+
+#endif
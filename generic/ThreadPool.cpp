@@ -0,0 +1,191 @@
+#include "ThreadPool.h"
+#include "project.h"
+#include <unistd.h>
+
+ThreadPool::ThreadPool(int nthreads)
+{
+	if(nthreads<=0)
+		nthreads=ncores();
+	nThreads=nthreads;
+	pBandFunction=NULL;
+	pTaskFunction=NULL;
+	pKernel=NULL;
+	nRows=nItems=nextBand=nDoneItems=0;
+	generation=0;
+	IsBusy=IsExiting=false;
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&startCond,NULL);
+	pthread_cond_init(&doneCond,NULL);
+	pTaskBegin=new int[nThreads];
+	pTaskEnd=new int[nThreads];
+
+	// the calling thread is one of the workers
+	pThreads=NULL;
+	nStartedWorkers=1;
+	if(nThreads>1)
+	{
+		pThreads=new pthread_t[nThreads-1];
+		for(int i=0;i<nThreads-1;i++)
+			pthread_create(&pThreads[i],NULL,workerMain,this);
+	}
+}
+
+ThreadPool::~ThreadPool(void)
+{
+	pthread_mutex_lock(&mutex);
+	IsExiting=true;
+	pthread_cond_broadcast(&startCond);
+	pthread_mutex_unlock(&mutex);
+	for(int i=0;i<nThreads-1;i++)
+		pthread_join(pThreads[i],NULL);
+	if(pThreads!=NULL)
+		delete []pThreads;
+	delete []pTaskBegin;
+	delete []pTaskEnd;
+	pthread_cond_destroy(&doneCond);
+	pthread_cond_destroy(&startCond);
+	pthread_mutex_destroy(&mutex);
+}
+
+int ThreadPool::ncores(void)
+{
+	long n=sysconf(_SC_NPROCESSORS_ONLN);
+	return n>0?n:1;
+}
+
+//---------------------------------------------------------------------------------------
+// the next band, or the next task of the worker (stolen from another worker if its own
+// deque is empty), -1 if there is none left. The mutex must be held.
+//---------------------------------------------------------------------------------------
+int ThreadPool::nextItem(int worker)
+{
+	if(pBandFunction!=NULL)
+		return nextBand<nItems?nextBand++:-1;
+	if(pTaskBegin[worker]<pTaskEnd[worker])
+		return pTaskBegin[worker]++;
+	int victim=-1,nRemaining=0;
+	for(int i=0;i<nThreads;i++)
+		if(pTaskEnd[i]-pTaskBegin[i]>nRemaining)
+		{
+			nRemaining=pTaskEnd[i]-pTaskBegin[i];
+			victim=i;
+		}
+	if(victim<0)
+		return -1;
+	return --pTaskEnd[victim];
+}
+
+//---------------------------------------------------------------------------------------
+// process items until there is none left, the mutex is held on entry and exit
+//---------------------------------------------------------------------------------------
+void ThreadPool::process(int worker)
+{
+	int item;
+	while((item=nextItem(worker))>=0)
+	{
+		pthread_mutex_unlock(&mutex);
+		if(pBandFunction!=NULL)
+		{
+			int rowStart=item*nBandRows;
+			pBandFunction(pKernel,rowStart,__min(rowStart+nBandRows,nRows),item);
+		}
+		else
+			pTaskFunction(pKernel,item,worker);
+		pthread_mutex_lock(&mutex);
+		if(++nDoneItems==nItems)
+			pthread_cond_broadcast(&doneCond);
+	}
+}
+
+void* ThreadPool::workerMain(void* pool)
+{
+	ThreadPool& p=*(ThreadPool*)pool;
+	unsigned int seen=0;
+	pthread_mutex_lock(&p.mutex);
+	int worker=p.nStartedWorkers++;
+	while(true)
+	{
+		while(!p.IsExiting && p.generation==seen)
+			pthread_cond_wait(&p.startCond,&p.mutex);
+		if(p.IsExiting)
+			break;
+		seen=p.generation;
+		p.process(worker);
+	}
+	pthread_mutex_unlock(&p.mutex);
+	return NULL;
+}
+
+//---------------------------------------------------------------------------------------
+// start the job set by the caller and let the calling thread take part in it
+// the mutex is held on entry, and released when all the items are done
+//---------------------------------------------------------------------------------------
+void ThreadPool::runJob(int items)
+{
+	IsBusy=true;
+	nItems=items;
+	nextBand=nDoneItems=0;
+	generation++;
+	pthread_cond_broadcast(&startCond);
+	process(0);
+	while(nDoneItems<nItems)
+		pthread_cond_wait(&doneCond,&mutex);
+	IsBusy=false;
+	pthread_mutex_unlock(&mutex);
+}
+
+//---------------------------------------------------------------------------------------
+// run the kernel over the bands of [0,rows)
+// if the pool is already running a job (e.g. run() called from a task or from another
+// thread), the bands are processed serially by the caller
+//---------------------------------------------------------------------------------------
+void ThreadPool::run(BandFunction function,void* kernel,int rows)
+{
+	int bands=nbands(rows);
+	if(nThreads>1 && bands>1)
+	{
+		pthread_mutex_lock(&mutex);
+		if(!IsBusy)
+		{
+			pBandFunction=function;
+			pTaskFunction=NULL;
+			pKernel=kernel;
+			nRows=rows;
+			runJob(bands);
+			return;
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+	for(int band=0;band<bands;band++)
+	{
+		int rowStart=band*nBandRows;
+		function(kernel,rowStart,__min(rowStart+nBandRows,rows),band);
+	}
+}
+
+//---------------------------------------------------------------------------------------
+// run the tasks [0,nTasks), each worker starts with a contiguous share of them
+//---------------------------------------------------------------------------------------
+void ThreadPool::runTasks(TaskFunction function,void* kernel,int nTasks)
+{
+	if(nThreads>1 && nTasks>1)
+	{
+		pthread_mutex_lock(&mutex);
+		if(!IsBusy)
+		{
+			pBandFunction=NULL;
+			pTaskFunction=function;
+			pKernel=kernel;
+			for(int i=0;i<nThreads;i++)
+			{
+				pTaskBegin[i]=(long)nTasks*i/nThreads;
+				pTaskEnd[i]=(long)nTasks*(i+1)/nThreads;
+			}
+			runJob(nTasks);
+			return;
+		}
+		pthread_mutex_unlock(&mutex);
+	}
+	for(int task=0;task<nTasks;task++)
+		function(kernel,task,0);
+}
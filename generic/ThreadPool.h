@@ -0,0 +1,69 @@
+#ifndef _ThreadPool_h
+#define _ThreadPool_h
+
+#include <pthread.h>
+
+//---------------------------------------------------------------------------------------
+// pool of worker threads to run a kernel over the rows of an image
+// The rows are split into bands of nBandRows rows, the bands are handed out to the
+// workers and to the calling thread, and run() returns when all the bands are done.
+// The partition only depends on the number of rows, so a reduction that sums per-band
+// partial results in band order gives the same value for any number of threads.
+//
+// A kernel is any class with a member
+//		void operator()(int rowStart,int rowEnd,int band);
+//
+// runTasks() runs independent tasks of uneven cost (e.g. the flow of a batch of image
+// pairs) with work stealing: each worker owns a deque of contiguous task indices, takes
+// tasks from its front, and once it is empty steals from the back of the fullest deque.
+// A task kernel has a member
+//		void operator()(int task,int worker);
+//---------------------------------------------------------------------------------------
+class ThreadPool
+{
+public:
+	enum{nBandRows=8};
+	typedef void (*BandFunction)(void* kernel,int rowStart,int rowEnd,int band);
+	typedef void (*TaskFunction)(void* kernel,int task,int worker);
+private:
+	int nThreads;
+	pthread_t* pThreads;
+	pthread_mutex_t mutex;
+	pthread_cond_t startCond,doneCond;
+	int nStartedWorkers;
+	// the current job, either bands of rows or tasks
+	BandFunction pBandFunction;
+	TaskFunction pTaskFunction;
+	void* pKernel;
+	int nRows,nItems,nextBand,nDoneItems;
+	int *pTaskBegin,*pTaskEnd;		// the task deque of each worker
+	unsigned int generation;
+	bool IsBusy,IsExiting;
+
+	static void* workerMain(void* pool);
+	int nextItem(int worker);
+	void process(int worker);
+	void runJob(int items);
+	template <class Kernel>
+	static void invokeBand(void* kernel,int rowStart,int rowEnd,int band) {(*(Kernel*)kernel)(rowStart,rowEnd,band);};
+	template <class Kernel>
+	static void invokeTask(void* kernel,int task,int worker) {(*(Kernel*)kernel)(task,worker);};
+public:
+	// nthreads<=0 uses all the cores
+	ThreadPool(int nthreads=1);
+	~ThreadPool(void);
+	inline int nthreads() const {return nThreads;};
+	static int ncores(void);
+	static inline int nbands(int rows) {return (rows+nBandRows-1)/nBandRows;};
+
+	void run(BandFunction function,void* kernel,int rows);
+	template <class Kernel>
+	void run(Kernel& kernel,int rows) {run(&ThreadPool::invokeBand<Kernel>,&kernel,rows);};
+
+	// worker is in [0,nthreads()), the calling thread is worker 0
+	void runTasks(TaskFunction function,void* kernel,int nTasks);
+	template <class Kernel>
+	void runTasks(Kernel& kernel,int nTasks) {runTasks(&ThreadPool::invokeTask<Kernel>,&kernel,nTasks);};
+};
+
+#endif
@@ -18,117 +18,433 @@
 #include "project.h"
 #include "Image.h"
 #include "OpticalFlow.h"
+#include "OpticalFlowStream.h"
+#include "FlowFile.h"
+#include "FlowColor.h"
 #include <iostream>
+#include <string.h>
 
 using namespace std;
 
 // conversion functions
-static DImage *libceliu_(Main_tensor_to_image)(THTensor *tensor) {
-  // create output
-  int c = tensor->size[0];
-  int h = tensor->size[1]; 
-  int w = tensor->size[2];
-  DImage *img = new DImage(w,h,c);
-  // copy data
-  int i0,i1,i2;
-  double *dest = img->data();
-  int offset = 0;
-  for (i2=0; i2<h; i2++) {  
-    for (i1=0; i1<w; i1++) {
-      for (i0=0; i0<c; i0++) {
-        dest[offset++] = THTensor_(get3d)(tensor, i0, i2, i1);
-      }
-    }
+// the tensors are read and written through their strides, so that contiguous
+// and non-contiguous (e.g. narrowed or transposed) tensors are both supported
+static void libceliu_(Main_data_to_image)(Image<real> *img, real *data, long *size, long *stride) {
+  // the layout of a contiguous tensor is the planar layout of the images, so
+  // the image is a view of the tensor (size and stride are CxHxW)
+  if (stride[2] == 1 && stride[1] == size[2] && (size[0] == 1 || stride[0] == size[1]*size[2])) {
+    img->attachPlanar(data, size[2], size[1], size[0]);
+    return;
   }
+  // otherwise copy data, keeping the channel-major layout of the tensor
+  img->setPlanar();
+  img->importPlanar(data, size[2], size[1], size[0], stride[0], stride[1], stride[2]);
+}
 
+// the tensor is CxHxW, or HxW for one channel (see Main_check_image); the
+// image is only valid while the tensor is
+static Image<real> *libceliu_(Main_tensor_to_image)(THTensor *tensor) {
+  int dims = tensor->nDimension;
+  long size[3] = {1, 1, 1}, stride[3] = {0, 0, 0};
+  for (int i = 0; i < dims; i++) {
+    size[3-dims+i] = tensor->size[i];
+    stride[3-dims+i] = tensor->stride[i];
+  }
+  if (dims == 2)
+    stride[0] = size[1]*size[2];
+  // create output
+  Image<real> *img = new Image<real>;
+  libceliu_(Main_data_to_image)(img, THTensor_(data)(tensor), size, stride);
   return img;
 }
 
-static THTensor *libceliu_(Main_image_to_tensor)(DImage *img) {
+// checks that the tensor at idx is a CxHxW or HxW tensor, before any image is
+// created (luaL_error does not return)
+static THTensor *libceliu_(Main_check_image)(lua_State *L, int idx) {
+  THTensor *tensor = (THTensor *)luaT_checkudata(L, idx, torch_(Tensor_id));
+  if (tensor->nDimension < 2 || tensor->nDimension > 3)
+    luaL_error(L, "expected a CxHxW or HxW tensor");
+  return tensor;
+}
+
+// checks that the tensors at idx and idx+1 are two HxW or 1xHxW tensors of
+// the same size (e.g. the components of a flow), and gets their size
+static void libceliu_(Main_check_field)(lua_State *L, int idx, int *nchannels, int *height, int *width) {
+  THTensor *ten1 = (THTensor *)luaT_checkudata(L, idx, torch_(Tensor_id));
+  THTensor *ten2 = (THTensor *)luaT_checkudata(L, idx+1, torch_(Tensor_id));
+  int dims = ten1->nDimension, dims2 = ten2->nDimension;
+  if (dims < 2 || dims > 3 || (dims == 3 && ten1->size[0] != 1) ||
+      dims2 < 2 || dims2 > 3 || (dims2 == 3 && ten2->size[0] != 1) ||
+      ten1->size[dims-2] != ten2->size[dims2-2] || ten1->size[dims-1] != ten2->size[dims2-1])
+    luaL_error(L, "expected two HxW or 1xHxW tensors of the same size");
+  *nchannels = (dims == 3) ? 1 : 0;
+  *height = ten1->size[dims-2];
+  *width = ten1->size[dims-1];
+}
+
+// if tensor is NULL a new tensor is created, otherwise it is resized
+// (if needed) and the image is written into it
+static THTensor *libceliu_(Main_image_to_tensor)(Image<real> *img, THTensor *tensor) {
   // create output
-  THTensor *tensor = THTensor_(newWithSize3d)(img->nchannels(),
-					      img->height(),
-					      img->width());
+  if (tensor == NULL)
+    tensor = THTensor_(newWithSize3d)(img->nchannels(),
+                                      img->height(),
+                                      img->width());
+  else
+    THTensor_(resize3d)(tensor, img->nchannels(), img->height(), img->width());
   // copy data
-  int i0,i1,i2;
-  double *src = img->data();
-  int offset = 0;
-  for (i2=0; i2<img->height(); i2++) {  
-    for (i1=0; i1<img->width(); i1++) {
-      for (i0=0; i0<img->nchannels(); i0++) {
-        THTensor_(set3d)(tensor, i0, i2, i1, (real)src[offset++]);
-      }
-    }
+  img->exportPlanar(THTensor_(data)(tensor),
+                    tensor->stride[0], tensor->stride[1], tensor->stride[2]);
+
+  return tensor;
+}
+
+// pushes the result: the preallocated tensor at index idx if one was given,
+// a new tensor otherwise
+static void libceliu_(Main_push_result)(lua_State *L, Image<real> *img, int idx) {
+  THTensor *tensor = (THTensor *)luaT_toudata(L, idx, torch_(Tensor_id));
+  if (tensor) {
+    libceliu_(Main_image_to_tensor)(img, tensor);
+    lua_pushvalue(L, idx);
+  } else {
+    tensor = libceliu_(Main_image_to_tensor)(img, NULL);
+    luaT_pushudata(L, tensor, torch_(Tensor_id));
   }
+}
+
+// writes a batch of images into a NxCxHxW tensor (created if NULL)
+static THTensor *libceliu_(Main_images_to_tensor)(Image<real> *imgs, int n, THTensor *tensor) {
+  // create output
+  if (tensor == NULL)
+    tensor = THTensor_(newWithSize4d)(n, imgs[0].nchannels(),
+                                      imgs[0].height(),
+                                      imgs[0].width());
+  else
+    THTensor_(resize4d)(tensor, n, imgs[0].nchannels(), imgs[0].height(), imgs[0].width());
+  // copy data
+  real *data = THTensor_(data)(tensor);
+  for (int i = 0; i < n; i++)
+    imgs[i].exportPlanar(data + i*tensor->stride[0],
+                         tensor->stride[1], tensor->stride[2], tensor->stride[3]);
 
   return tensor;
 }
 
-int libceliu_(Main_optflow)(lua_State *L) {
+static void libceliu_(Main_push_batch_result)(lua_State *L, Image<real> *imgs, int n, int idx) {
+  THTensor *tensor = (THTensor *)luaT_toudata(L, idx, torch_(Tensor_id));
+  if (tensor) {
+    libceliu_(Main_images_to_tensor)(imgs, n, tensor);
+    lua_pushvalue(L, idx);
+  } else {
+    tensor = libceliu_(Main_images_to_tensor)(imgs, n, NULL);
+    luaT_pushudata(L, tensor, torch_(Tensor_id));
+  }
+}
+
+// the parameters of the flow, common to infer and inferBatch,
+// read from the stack starting at index idx
+struct libceliu_(Main_params) {
+  double alpha;
+  double ratio;
+  int minWidth;
+  int nOuterFPIterations;
+  int nInnerFPIterations;
+  int nCGIterations;
+  SolverPara para;
+};
+
+static void libceliu_(Main_read_params)(lua_State *L, int idx, libceliu_(Main_params) *p) {
   // defaults
-  double alpha=0.01;
-  double ratio=0.75;
-  int minWidth=30;
-  int nOuterFPIterations=15;
-  int nInnerFPIterations=1;
-  int nCGIterations=40;
+  p->alpha=0.01;
+  p->ratio=0.75;
+  p->minWidth=30;
+  p->nOuterFPIterations=15;
+  p->nInnerFPIterations=1;
+  p->nCGIterations=40;
+  SolverPara& para = p->para;
   // get args
-  THTensor *ten1 =  (THTensor *)luaT_checkudata(L, 1, torch_(Tensor_id));  
-  THTensor *ten2 =  (THTensor *)luaT_checkudata(L, 2, torch_(Tensor_id));  
-  if (lua_isnumber(L, 3)) alpha = lua_tonumber(L, 3);
-  if (lua_isnumber(L, 4)) ratio = lua_tonumber(L, 4);
-  if (lua_isnumber(L, 5)) minWidth = lua_tonumber(L, 5);
-  if (lua_isnumber(L, 6)) nOuterFPIterations = lua_tonumber(L, 6);
-  if (lua_isnumber(L, 7)) nInnerFPIterations = lua_tonumber(L, 7);
-  if (lua_isnumber(L, 8)) nCGIterations = lua_tonumber(L, 8);
+  if (lua_isnumber(L, idx)) p->alpha = lua_tonumber(L, idx);
+  if (lua_isnumber(L, idx+1)) p->ratio = lua_tonumber(L, idx+1);
+  if (lua_isnumber(L, idx+2)) p->minWidth = lua_tonumber(L, idx+2);
+  if (lua_isnumber(L, idx+3)) p->nOuterFPIterations = lua_tonumber(L, idx+3);
+  if (lua_isnumber(L, idx+4)) p->nInnerFPIterations = lua_tonumber(L, idx+4);
+  if (lua_isnumber(L, idx+5)) p->nCGIterations = lua_tonumber(L, idx+5);
+  if (lua_isstring(L, idx+6)) {
+    const char *solver = lua_tostring(L, idx+6);
+    if (strcmp(solver, "multigrid") == 0) para.solver = SolverPara::Multigrid;
+    else if (strcmp(solver, "fmg") == 0) {
+      para.solver = SolverPara::Multigrid;
+      para.IsFMG = true;
+    }
+    else if (strcmp(solver, "pcg") == 0) para.solver = SolverPara::PCG;
+    else if (strcmp(solver, "sor") == 0) para.solver = SolverPara::SOR;
+    else if (strcmp(solver, "cg") != 0) luaL_error(L, "unknown solver: %s", solver);
+  }
+  if (lua_isnumber(L, idx+7)) para.nCycles = lua_tonumber(L, idx+7);
+  if (lua_isnumber(L, idx+8)) para.tolerance = lua_tonumber(L, idx+8);
+  if (lua_isnumber(L, idx+9)) para.nSORIterations = lua_tonumber(L, idx+9);
+  if (lua_isnumber(L, idx+10)) para.omega = lua_tonumber(L, idx+10);
+  if (lua_isnumber(L, idx+11)) para.nThreads = lua_tonumber(L, idx+11);
+  if (lua_isnumber(L, idx+12)) para.nWarmSkipLevels = lua_tonumber(L, idx+12);
+  if (lua_isnumber(L, idx+13)) para.nWarmOuterFPIterations = lua_tonumber(L, idx+13);
+  if (lua_isnumber(L, idx+14)) para.outerTolerance = lua_tonumber(L, idx+14);
+  if (lua_isnumber(L, idx+15)) para.innerTolerance = lua_tonumber(L, idx+15);
+  para.IsAdaptiveBudget = lua_toboolean(L, idx+16);
+}
+
+// pushes the time (in seconds) and the number of calls of the stages of a
+// record, as the fields time and calls of the table on the top of the stack
+static void libceliu_(Main_push_stages)(lua_State *L, const FlowProfile::Record &rec) {
+  lua_newtable(L);
+  lua_newtable(L);
+  for (int i = 0; i < FlowProfile::nStages; i++) {
+    if (rec.calls[i] == 0) continue;
+    lua_pushnumber(L, rec.time[i]);
+    lua_setfield(L, -3, FlowProfile::stageName((FlowProfile::Stage)i));
+    lua_pushnumber(L, rec.calls[i]);
+    lua_setfield(L, -2, FlowProfile::stageName((FlowProfile::Stage)i));
+  }
+  lua_setfield(L, -3, "calls");
+  lua_setfield(L, -2, "time");
+  lua_pushnumber(L, rec.totalTime());
+  lua_setfield(L, -2, "total");
+}
+
+// pushes the profile as a table {total, setup, levels}, where levels[k+1]
+// is the record of the pyramid level k (1 is the finest level)
+static void libceliu_(Main_push_profile)(lua_State *L, const FlowProfile &profile) {
+  lua_newtable(L);
+  lua_pushnumber(L, profile.totalTime());
+  lua_setfield(L, -2, "total");
+  lua_newtable(L);
+  libceliu_(Main_push_stages)(L, profile.setup());
+  lua_setfield(L, -2, "setup");
+  lua_newtable(L);
+  for (int k = 0; k < profile.nlevels(); k++) {
+    const FlowProfile::Record &rec = profile.level(k);
+    lua_newtable(L);
+    libceliu_(Main_push_stages)(L, rec);
+    lua_pushnumber(L, rec.width);
+    lua_setfield(L, -2, "width");
+    lua_pushnumber(L, rec.height);
+    lua_setfield(L, -2, "height");
+    lua_pushnumber(L, rec.nOuterIterations);
+    lua_setfield(L, -2, "outerIterations");
+    lua_pushnumber(L, rec.nInnerIterations);
+    lua_setfield(L, -2, "innerIterations");
+    lua_pushnumber(L, rec.nSolverIterations);
+    lua_setfield(L, -2, "solverIterations");
+    if (rec.residual >= 0) {
+      lua_pushnumber(L, rec.residual);
+      lua_setfield(L, -2, "residual");
+    }
+    lua_rawseti(L, -2, k+1);
+  }
+  lua_setfield(L, -2, "levels");
+}
+
+int libceliu_(Main_optflow)(lua_State *L) {
+  // get args
+  THTensor *ten1 = libceliu_(Main_check_image)(L, 1);
+  THTensor *ten2 = libceliu_(Main_check_image)(L, 2);
+  libceliu_(Main_params) p;
+  libceliu_(Main_read_params)(L, 3, &p);
+  // optional prior flow (args 20-21), of any size, its two components of the
+  // same size
+  THTensor *ten_init_x = (THTensor *)luaT_toudata(L, 20, torch_(Tensor_id));
+  THTensor *ten_init_y = (THTensor *)luaT_toudata(L, 21, torch_(Tensor_id));
+  if (ten_init_x && ten_init_y) {
+    int nchannels, height, width;
+    libceliu_(Main_check_field)(L, 20, &nchannels, &height, &width);
+  }
+  // profile the stages (arg 25)
+  bool profiled = lua_toboolean(L, 25);
+  FlowProfile profile;
+  if (profiled) p.para.pProfile = &profile;
   
-// copy tensors to images
-  DImage *img1 =  libceliu_(Main_tensor_to_image)(ten1);
-  DImage *img2 =  libceliu_(Main_tensor_to_image)(ten2);
+// view or copy tensors as images
+  Image<real> *img1 =  libceliu_(Main_tensor_to_image)(ten1);
+  Image<real> *img2 =  libceliu_(Main_tensor_to_image)(ten2);
+  Image<real> *init_x = NULL, *init_y = NULL;
+  if (ten_init_x && ten_init_y) {
+    init_x = libceliu_(Main_tensor_to_image)(ten_init_x);
+    init_y = libceliu_(Main_tensor_to_image)(ten_init_y);
+  }
   
   // declare outputs, and process
-  DImage vx,vy,warpI2;
+  Image<real> vx,vy,warpI2;
   OpticalFlow::Coarse2FineFlow(vx,vy,warpI2,   // outputs
                                *img1,*img2,      // inputs
-                               alpha,ratio,minWidth,  // params...
-                               nOuterFPIterations,nInnerFPIterations,nCGIterations);
+                               init_x,init_y,    // prior flow
+                               p.alpha,p.ratio,p.minWidth,  // params...
+                               p.nOuterFPIterations,p.nInnerFPIterations,p.nCGIterations,
+                               p.para);
   
-  // return result
-  THTensor *ten_vx   = libceliu_(Main_image_to_tensor)(&vx);
-  THTensor *ten_vy   = libceliu_(Main_image_to_tensor)(&vy);
-  THTensor *ten_warp = libceliu_(Main_image_to_tensor)(&warpI2);
-  luaT_pushudata(L, ten_vx, torch_(Tensor_id));
-  luaT_pushudata(L, ten_vy, torch_(Tensor_id));;
-  luaT_pushudata(L, ten_warp, torch_(Tensor_id));
+  // return result (args 22-24 are optional preallocated outputs)
+  libceliu_(Main_push_result)(L, &vx, 22);
+  libceliu_(Main_push_result)(L, &vy, 23);
+  libceliu_(Main_push_result)(L, &warpI2, 24);
+  if (profiled)
+    libceliu_(Main_push_profile)(L, profile);
   
   // cleanup
   delete(img1);
   delete(img2);
+  delete(init_x);
+  delete(init_y);
+
+  return profiled ? 4 : 3;
+}
+
+// the pairs are either a Nx2xCxHxW tensor or a table of N {image1, image2}
+// CxHxW tensors, all of the same size; the flows and the warped images are
+// returned as Nx1xHxW and NxCxHxW tensors
+int libceliu_(Main_optflow_batch)(lua_State *L) {
+  // get args
+  THTensor *pairs = (THTensor *)luaT_toudata(L, 1, torch_(Tensor_id));
+  if (!pairs && !lua_istable(L, 1))
+    luaL_error(L, "the pairs must be a Nx2xCxHxW tensor or a table of pairs");
+  if (pairs && pairs->nDimension != 5)
+    luaL_error(L, "the pairs must be a Nx2xCxHxW tensor");
+  libceliu_(Main_params) p;
+  libceliu_(Main_read_params)(L, 2, &p);
+
+  // view or copy tensors as images
+  int n = pairs ? pairs->size[0] : lua_objlen(L, 1);
+  if (n == 0)
+    luaL_error(L, "the batch is empty");
+  Image<real> *img1 = new Image<real>[n];
+  Image<real> *img2 = new Image<real>[n];
+  bool ok = true;
+  if (pairs) {
+    real *data = THTensor_(data)(pairs);
+    for (int i = 0; i < n; i++) {
+      libceliu_(Main_data_to_image)(&img1[i], data + i*pairs->stride[0],
+                                    pairs->size + 2, pairs->stride + 2);
+      libceliu_(Main_data_to_image)(&img2[i], data + i*pairs->stride[0] + pairs->stride[1],
+                                    pairs->size + 2, pairs->stride + 2);
+    }
+  } else {
+    for (int i = 0; i < n && ok; i++) {
+      lua_rawgeti(L, 1, i+1);
+      lua_rawgeti(L, -1, 1);
+      lua_rawgeti(L, -2, 2);
+      THTensor *ten1 = (THTensor *)luaT_toudata(L, -2, torch_(Tensor_id));
+      THTensor *ten2 = (THTensor *)luaT_toudata(L, -1, torch_(Tensor_id));
+      ok = ten1 && ten2 && ten1->nDimension == 3 && ten2->nDimension == 3;
+      if (ok) {
+        libceliu_(Main_data_to_image)(&img1[i], THTensor_(data)(ten1), ten1->size, ten1->stride);
+        libceliu_(Main_data_to_image)(&img2[i], THTensor_(data)(ten2), ten2->size, ten2->stride);
+      }
+      lua_pop(L, 3);
+    }
+  }
+  // the results are stacked, so all the images must have the same size
+  for (int i = 0; i < n && ok; i++)
+    ok = img1[i].matchDimension(img1[0]) && img2[i].matchDimension(img1[0]);
+  if (!ok) {
+    delete [] img1;
+    delete [] img2;
+    luaL_error(L, "each pair must be two CxHxW tensors, of the same size for all the pairs");
+  }
+
+  // declare outputs, and process
+  Image<real> *vx = new Image<real>[n];
+  Image<real> *vy = new Image<real>[n];
+  Image<real> *warpI2 = new Image<real>[n];
+  OpticalFlow::Coarse2FineFlowBatch(vx,vy,warpI2,   // outputs
+                                    img1,img2,n,      // inputs
+                                    p.alpha,p.ratio,p.minWidth,  // params...
+                                    p.nOuterFPIterations,p.nInnerFPIterations,p.nCGIterations,
+                                    p.para);
+
+  // return result (args 19-21 are optional preallocated outputs)
+  libceliu_(Main_push_batch_result)(L, vx, n, 19);
+  libceliu_(Main_push_batch_result)(L, vy, n, 20);
+  libceliu_(Main_push_batch_result)(L, warpI2, n, 21);
+
+  // cleanup
+  delete [] img1;
+  delete [] img2;
+  delete [] vx;
+  delete [] vy;
+  delete [] warpI2;
 
   return 3;
 }
 
+// the flows from img1 to img2 and from img2 to img1, and the masks of the
+// pixels of img1 and img2 whose flows pass the forward-backward check
+int libceliu_(Main_optflow_bidirectional)(lua_State *L) {
+  // get args
+  THTensor *ten1 = libceliu_(Main_check_image)(L, 1);
+  THTensor *ten2 = libceliu_(Main_check_image)(L, 2);
+  libceliu_(Main_params) p;
+  libceliu_(Main_read_params)(L, 3, &p);
+  // tolerance of the consistency check (args 20-21)
+  double ratio = lua_isnumber(L, 20) ? lua_tonumber(L, 20) : 0.01;
+  double offset = lua_isnumber(L, 21) ? lua_tonumber(L, 21) : 0.5;
+
+  // view or copy tensors as images
+  Image<real> *img1 =  libceliu_(Main_tensor_to_image)(ten1);
+  Image<real> *img2 =  libceliu_(Main_tensor_to_image)(ten2);
+  if (!img1->matchDimension(*img2)) {
+    delete(img1);
+    delete(img2);
+    luaL_error(L, "the two images must have the same size");
+  }
+
+  // declare outputs, and process
+  Image<real> vx,vy,warpI2,backVx,backVy,warpI1,mask,backMask;
+  OpticalFlow::Coarse2FineFlowBidirectional(vx,vy,warpI2,backVx,backVy,warpI1,   // outputs
+                                            *img1,*img2,      // inputs
+                                            p.alpha,p.ratio,p.minWidth,  // params...
+                                            p.nOuterFPIterations,p.nInnerFPIterations,p.nCGIterations,
+                                            p.para);
+  // the masks run on the pool the flows ran on, kept by the calling thread
+  ThreadPool &pool = FlowCache<real>::get().pool(p.para.nThreads);
+  OpticalFlow::genConsistencyMask(mask,vx,vy,backVx,backVy,pool,ratio,offset);
+  OpticalFlow::genConsistencyMask(backMask,backVx,backVy,vx,vy,pool,ratio,offset);
+
+  // return result (args 22-29 are optional preallocated outputs)
+  libceliu_(Main_push_result)(L, &vx, 22);
+  libceliu_(Main_push_result)(L, &vy, 23);
+  libceliu_(Main_push_result)(L, &warpI2, 24);
+  libceliu_(Main_push_result)(L, &backVx, 25);
+  libceliu_(Main_push_result)(L, &backVy, 26);
+  libceliu_(Main_push_result)(L, &warpI1, 27);
+  libceliu_(Main_push_result)(L, &mask, 28);
+  libceliu_(Main_push_result)(L, &backMask, 29);
+
+  // cleanup
+  delete(img1);
+  delete(img2);
+
+  return 8;
+}
+
 int libceliu_(Main_warp)(lua_State *L) {
   // get args
-  THTensor * ten_inp = (THTensor *)luaT_checkudata(L, 1, torch_(Tensor_id));  
+  THTensor * ten_inp = libceliu_(Main_check_image)(L, 1);
   THTensor * ten_vx  =  (THTensor *)luaT_checkudata(L, 2, torch_(Tensor_id));  
   THTensor * ten_vy  =  (THTensor *)luaT_checkudata(L, 3, torch_(Tensor_id));  
+  int nchannels, height, width;
+  libceliu_(Main_check_field)(L, 2, &nchannels, &height, &width);
 
-  // copy tensors to images
-  DImage *input =  libceliu_(Main_tensor_to_image)(ten_inp);
-  DImage *vx    =  libceliu_(Main_tensor_to_image)(ten_vx);
-  DImage *vy    =  libceliu_(Main_tensor_to_image)(ten_vy);
+  // view or copy tensors as images
+  Image<real> *input =  libceliu_(Main_tensor_to_image)(ten_inp);
+  Image<real> *vx    =  libceliu_(Main_tensor_to_image)(ten_vx);
+  Image<real> *vy    =  libceliu_(Main_tensor_to_image)(ten_vy);
 
   // declare outputs, and process
-  DImage warpedInput;
+  Image<real> warpedInput;
   OpticalFlow::warpFL(warpedInput,   // warped input
                       *input,*input, // input
                       *vx, *vy       // flow
                       );
 
-  // return result
-  THTensor *ten_warp =  libceliu_(Main_image_to_tensor)(&warpedInput);
-  luaT_pushudata(L, ten_warp, torch_(Tensor_id));
+  // return result (arg 4 is an optional preallocated output)
+  libceliu_(Main_push_result)(L, &warpedInput, 4);
 
   // cleanup
   delete(input);
@@ -138,11 +454,231 @@ int libceliu_(Main_warp)(lua_State *L) {
   return 1;
 }
 
+// streaming flow: a userdata holding an OpticalFlowStream, which keeps the
+// pyramid of the last frame
+static OpticalFlowStream<real> **libceliu_(Main_check_stream)(lua_State *L, int idx) {
+  return (OpticalFlowStream<real> **)luaL_checkudata(L, idx, libceliu_string_(Stream));
+}
+
+static int libceliu_(Main_stream_gc)(lua_State *L) {
+  OpticalFlowStream<real> **stream = libceliu_(Main_check_stream)(L, 1);
+  delete *stream;
+  *stream = NULL;
+  return 0;
+}
+
+// the parameters are the ones of infer, from alpha to adaptiveBudget,
+// followed by the warm start flag
+int libceliu_(Main_stream_new)(lua_State *L) {
+  libceliu_(Main_params) p;
+  libceliu_(Main_read_params)(L, 1, &p);
+  bool warmStart = lua_toboolean(L, 18);
+
+  OpticalFlowStream<real> **stream = 
+    (OpticalFlowStream<real> **)lua_newuserdata(L, sizeof(OpticalFlowStream<real> *));
+  *stream = new OpticalFlowStream<real>(p.alpha, p.ratio, p.minWidth,
+                                        p.nOuterFPIterations, p.nInnerFPIterations, p.nCGIterations,
+                                        p.para);
+  (*stream)->setWarmStart(warmStart);
+  if (luaL_newmetatable(L, libceliu_string_(Stream))) {
+    lua_pushcfunction(L, libceliu_(Main_stream_gc));
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+// adds a frame, and returns the flow from the last frame to this one
+// (nil for the first frame); args 3-5 are optional preallocated outputs
+int libceliu_(Main_stream_add)(lua_State *L) {
+  // get args
+  OpticalFlowStream<real> **stream = libceliu_(Main_check_stream)(L, 1);
+  THTensor *ten = libceliu_(Main_check_image)(L, 2);
+
+  // view or copy tensor as image
+  Image<real> *frame = libceliu_(Main_tensor_to_image)(ten);
+
+  // declare outputs, and process
+  Image<real> vx,vy,warpI2;
+  bool hasFlow = (*stream)->addFrame(*frame, vx, vy, warpI2);
+  delete(frame);
+  if (!hasFlow) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  // return result
+  libceliu_(Main_push_result)(L, &vx, 3);
+  libceliu_(Main_push_result)(L, &vy, 4);
+  libceliu_(Main_push_result)(L, &warpI2, 5);
+  return 3;
+}
+
+int libceliu_(Main_stream_reset)(lua_State *L) {
+  OpticalFlowStream<real> **stream = libceliu_(Main_check_stream)(L, 1);
+  (*stream)->reset();
+  return 0;
+}
+
+// pushes the output at index idx, resized to nchannels x height x width (or
+// height x width if nchannels is 0): the preallocated tensor if one was given,
+// a new tensor otherwise
+static THTensor *libceliu_(Main_push_output)(lua_State *L, int idx, int nchannels, int height, int width) {
+  THTensor *tensor = (THTensor *)luaT_toudata(L, idx, torch_(Tensor_id));
+  if (tensor) {
+    lua_pushvalue(L, idx);
+  } else {
+    tensor = THTensor_(new)();
+    luaT_pushudata(L, tensor, torch_(Tensor_id));
+  }
+  if (nchannels > 0)
+    THTensor_(resize3d)(tensor, nchannels, height, width);
+  else
+    THTensor_(resize2d)(tensor, height, width);
+  return tensor;
+}
+
+// reads a .flo file into two 1xHxW tensors (args 3-4 are optional preallocated
+// outputs); arg 2 is the threshold above which the flow is out of band and set
+// to 0, or true for max(W,H)
+int libceliu_(Main_read_flo)(lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  FlowFile file;
+  if (!file.open(filename))
+    luaL_error(L, "cannot read %s as a .flo file", filename);
+  double maxFlow = 0;
+  if (lua_isnumber(L, 2)) maxFlow = lua_tonumber(L, 2);
+  else if (lua_toboolean(L, 2)) maxFlow = __max(file.width(), file.height());
+
+  THTensor *vx = libceliu_(Main_push_output)(L, 3, 1, file.height(), file.width());
+  THTensor *vy = libceliu_(Main_push_output)(L, 4, 1, file.height(), file.width());
+  // split straight into the tensors, unless they are not contiguous
+  if (THTensor_(isContiguous)(vx) && THTensor_(isContiguous)(vy)) {
+    file.split(THTensor_(data)(vx), THTensor_(data)(vy), maxFlow);
+  } else {
+    Image<real> imvx, imvy;
+    file.split(imvx, imvy, maxFlow);
+    libceliu_(Main_image_to_tensor)(&imvx, vx);
+    libceliu_(Main_image_to_tensor)(&imvy, vy);
+  }
+  return 2;
+}
+
+// writes two HxW (or 1xHxW) tensors to a .flo file
+int libceliu_(Main_write_flo)(lua_State *L) {
+  THTensor *ten_vx = (THTensor *)luaT_checkudata(L, 1, torch_(Tensor_id));
+  THTensor *ten_vy = (THTensor *)luaT_checkudata(L, 2, torch_(Tensor_id));
+  const char *filename = luaL_checkstring(L, 3);
+  int nchannels, height, width;
+  libceliu_(Main_check_field)(L, 1, &nchannels, &height, &width);
+  // the components are streamed from the tensors, copied only if not contiguous
+  THTensor *vx = THTensor_(newContiguous)(ten_vx);
+  THTensor *vy = THTensor_(newContiguous)(ten_vy);
+  bool written = FlowFile::write(filename, THTensor_(data)(vx), THTensor_(data)(vy), width, height);
+  THTensor_(free)(vx);
+  THTensor_(free)(vy);
+  if (!written)
+    luaL_error(L, "cannot write %s", filename);
+  return 0;
+}
+
+// the norm, the angle and the color-coded RGB image of a flow, computed in
+// the tensors themselves unless they are not contiguous (see FlowColor); if
+// vx and vy are NULL, the RGB image is computed from the norm and the angle
+static void libceliu_(Main_colorize)(THTensor *rgb, THTensor *norm, THTensor *angle,
+                                     THTensor *vx, THTensor *vy, double maxFlow, int nThreads) {
+  THTensor *tensors[5] = {rgb, norm, angle, vx, vy};
+  THTensor *contiguous[5];
+  real *data[5];
+  for (int k = 0; k < 5; k++) {
+    contiguous[k] = tensors[k] ? THTensor_(newContiguous)(tensors[k]) : NULL;
+    data[k] = tensors[k] ? THTensor_(data)(contiguous[k]) : NULL;
+  }
+  int dims = norm->nDimension;
+  ThreadPool &pool = FlowCache<real>::get().pool(nThreads);
+  FlowColor::colorize(data[1], data[2], data[0], data[3], data[4],
+                      norm->size[dims-1], norm->size[dims-2], maxFlow, pool);
+  // the outputs that were not contiguous are copied back
+  int nOutputs = vx ? 3 : 1;
+  for (int k = 0; k < 5; k++) {
+    if (!tensors[k])
+      continue;
+    if (k < nOutputs)
+      THTensor_(freeCopyTo)(contiguous[k], tensors[k]);
+    else
+      THTensor_(free)(contiguous[k]);
+  }
+}
+
+// as field2rgb, a given max saturates the colors, otherwise they are
+// normalized by the largest norm
+static double libceliu_(Main_read_max)(lua_State *L, int idx) {
+  return lua_isnumber(L, idx) ? __max(lua_tonumber(L, idx), 1e-2) : 0;
+}
+
+// the norm, the angle (in degrees) and the color-coded RGB image (3xHxW) of
+// the flow vx, vy (HxW or 1xHxW); args 3-4 are max and the number of threads
+// (0: all the cores), args 5-7 are optional preallocated outputs
+int libceliu_(Main_flow_color)(lua_State *L) {
+  int nchannels, height, width;
+  libceliu_(Main_check_field)(L, 1, &nchannels, &height, &width);
+  double maxFlow = libceliu_(Main_read_max)(L, 3);
+  int nThreads = lua_isnumber(L, 4) ? lua_tonumber(L, 4) : 0;
+  THTensor *rgb = libceliu_(Main_push_output)(L, 5, 3, height, width);
+  THTensor *norm = libceliu_(Main_push_output)(L, 6, nchannels, height, width);
+  THTensor *angle = libceliu_(Main_push_output)(L, 7, nchannels, height, width);
+  libceliu_(Main_colorize)(rgb, norm, angle,
+                           (THTensor *)luaT_toudata(L, 1, torch_(Tensor_id)),
+                           (THTensor *)luaT_toudata(L, 2, torch_(Tensor_id)),
+                           maxFlow, nThreads);
+  return 3;
+}
+
+// the norm and the angle of the flow vx, vy; arg 3 is the number of threads,
+// args 4-5 are optional preallocated outputs
+int libceliu_(Main_flow_polar)(lua_State *L) {
+  int nchannels, height, width;
+  libceliu_(Main_check_field)(L, 1, &nchannels, &height, &width);
+  int nThreads = lua_isnumber(L, 3) ? lua_tonumber(L, 3) : 0;
+  THTensor *norm = libceliu_(Main_push_output)(L, 4, nchannels, height, width);
+  THTensor *angle = libceliu_(Main_push_output)(L, 5, nchannels, height, width);
+  libceliu_(Main_colorize)(NULL, norm, angle,
+                           (THTensor *)luaT_toudata(L, 1, torch_(Tensor_id)),
+                           (THTensor *)luaT_toudata(L, 2, torch_(Tensor_id)),
+                           0, nThreads);
+  return 2;
+}
+
+// the color-coded RGB image of a flow given by its norm and angle; args 3-4
+// are max and the number of threads, arg 5 is an optional preallocated output
+int libceliu_(Main_polar_color)(lua_State *L) {
+  int nchannels, height, width;
+  libceliu_(Main_check_field)(L, 1, &nchannels, &height, &width);
+  double maxFlow = libceliu_(Main_read_max)(L, 3);
+  int nThreads = lua_isnumber(L, 4) ? lua_tonumber(L, 4) : 0;
+  THTensor *rgb = libceliu_(Main_push_output)(L, 5, 3, height, width);
+  libceliu_(Main_colorize)(rgb,
+                           (THTensor *)luaT_toudata(L, 1, torch_(Tensor_id)),
+                           (THTensor *)luaT_toudata(L, 2, torch_(Tensor_id)),
+                           NULL, NULL, maxFlow, nThreads);
+  return 1;
+}
+
 extern "C" {
   // Register functions in LUA
   static const struct luaL_reg libceliu_(Main__) [] = {
     {"infer", libceliu_(Main_optflow)},
+    {"inferBatch", libceliu_(Main_optflow_batch)},
+    {"inferBidirectional", libceliu_(Main_optflow_bidirectional)},
+    {"streamNew", libceliu_(Main_stream_new)},
+    {"streamAdd", libceliu_(Main_stream_add)},
+    {"streamReset", libceliu_(Main_stream_reset)},
     {"warp", libceliu_(Main_warp)},
+    {"readFlo", libceliu_(Main_read_flo)},
+    {"writeFlo", libceliu_(Main_write_flo)},
+    {"flowColor", libceliu_(Main_flow_color)},
+    {"flowPolar", libceliu_(Main_flow_polar)},
+    {"polarColor", libceliu_(Main_polar_color)},
     {NULL, NULL}  /* sentinel */
   };
   
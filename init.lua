@@ -46,6 +46,11 @@ require 'libceliu'
 -- The input images must be a NxHxW tensor, where N is the number
 -- of channels (colors).
 --
+-- With profile, a sixth result is returned: a table {total, setup, levels}
+-- where levels[k+1] has the time and the number of calls of the stages
+-- of the pyramid level k (level 0 is the finest), its size, and the
+-- numbers of outer, inner and solver iterations and the final residual.
+--
 -- @usage opticalflow.infer() -- prints online help
 --
 -- @param pair  a pair of images (2 NxHxW tensor) [type = table]
@@ -57,11 +62,32 @@ require 'libceliu'
 -- @param nOuterFPIterations  number of outer fixed-point iterations [default = 15] [type = number]
 -- @param nInnerFPIterations  number of inner fixed-point iterations [default = 1] [type = number]
 -- @param nCGIterations  number of CG iterations [default = 20] [type = number]
+-- @param solver  linear solver: cg | pcg | sor | multigrid | fmg [default = cg] [type = string]
+-- @param nMGCycles  number of V-cycles of the multigrid solver [default = 3] [type = number]
+-- @param tolerance  relative residual at which the linear solver stops [default = 0] [type = number]
+-- @param nSORIterations  number of red-black SOR iterations [default = 30] [type = number]
+-- @param omega  SOR relaxation factor [default = 1.8] [type = number]
+-- @param nThreads  number of threads, 0 for all the cores [default = 1] [type = number]
+-- @param init_x  prior flow (x) to start from, e.g. the flow of the previous frame [type = torch.Tensor]
+-- @param init_y  prior flow (y) to start from [type = torch.Tensor]
+-- @param nWarmSkipLevels  number of coarsest levels skipped when starting from a prior flow [default = 0] [type = number]
+-- @param nWarmOuterFPIterations  number of outer fixed-point iterations when starting from a prior flow, 0 for nOuterFPIterations [default = 0] [type = number]
+-- @param outerTolerance  stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) [default = 0] [type = number]
+-- @param innerTolerance  stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) [default = 0] [type = number]
+-- @param adaptiveBudget  limit the outer iterations of a level to one more than the coarser level needed [default = false] [type = boolean]
+-- @param flow_x  preallocated output for the x component of the flow [type = torch.Tensor]
+-- @param flow_y  preallocated output for the y component of the flow [type = torch.Tensor]
+-- @param warp  preallocated output for the warped image [type = torch.Tensor]
+-- @param profile  also return the time and the iteration counts of the stages, per pyramid level [default = false] [type = boolean]
 ------------------------------------------------------------
 function opticalflow.infer(...)
    -- check args
    local _, pair, img1, img2, alpha, ratio, minWidth, 
-           nOuterFPIterations, nInnerFPIterations, nCGIterations = 
+           nOuterFPIterations, nInnerFPIterations, nCGIterations,
+           solver, nMGCycles, tolerance, nSORIterations, omega, nThreads,
+           init_x, init_y, nWarmSkipLevels, nWarmOuterFPIterations,
+           outerTolerance, innerTolerance, adaptiveBudget,
+           flow_x, flow_y, warp, profile = 
       xlua.unpack(
               {...},
               'opticalflow.infer',
@@ -92,7 +118,41 @@ of channels (colors).]],
               {arg='nInnerFPIterations', type='number', 
 	       help='number of inner fixed-point iterations', default=1},
               {arg='nCGIterations', type='number', 
-	       help='number of CG iterations', default=20}
+	       help='number of CG iterations', default=20},
+              {arg='solver', type='string', 
+	       help='linear solver: cg | pcg (block-Jacobi preconditioned cg) | sor (red-black SOR) | multigrid | fmg (full multigrid)', default='cg'},
+              {arg='nMGCycles', type='number', 
+	       help='number of V-cycles of the multigrid solver', default=3},
+              {arg='tolerance', type='number', 
+	       help='relative residual at which the linear solver stops (0 = run all iterations)', default=0},
+              {arg='nSORIterations', type='number', 
+	       help='number of red-black SOR iterations', default=30},
+              {arg='omega', type='number', 
+	       help='SOR relaxation factor (between 1 and 2)', default=1.8},
+              {arg='nThreads', type='number', 
+	       help='number of threads (0 = all the cores)', default=1},
+              {arg='init_x', type='torch.Tensor', 
+	       help='prior flow (x) to start from, e.g. the flow of the previous frame (any size)'},
+              {arg='init_y', type='torch.Tensor', 
+	       help='prior flow (y) to start from'},
+              {arg='nWarmSkipLevels', type='number', 
+	       help='number of coarsest levels skipped when starting from a prior flow', default=0},
+              {arg='nWarmOuterFPIterations', type='number', 
+	       help='number of outer fixed-point iterations when starting from a prior flow (0 = nOuterFPIterations)', default=0},
+              {arg='outerTolerance', type='number', 
+	       help='stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) (0 = run all iterations)', default=0},
+              {arg='innerTolerance', type='number', 
+	       help='stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) (0 = run all iterations)', default=0},
+              {arg='adaptiveBudget', type='boolean', 
+	       help='limit the outer iterations of a level to one more than the coarser level needed', default=false},
+              {arg='flow_x', type='torch.Tensor', 
+	       help='preallocated output for the x component of the flow (resized if needed)'},
+              {arg='flow_y', type='torch.Tensor', 
+	       help='preallocated output for the y component of the flow (resized if needed)'},
+              {arg='warp', type='torch.Tensor', 
+	       help='preallocated output for the warped image (resized if needed)'},
+              {arg='profile', type='boolean', 
+	       help='also return a table with the time (in seconds) and the iteration counts of the stages, per pyramid level', default=false}
            )
 	   
    -- pair ?
@@ -107,21 +167,25 @@ of channels (colors).]],
    end
    
    -- compute flow
-   local flow_x, flow_y, warp =  
+   local report
+   flow_x, flow_y, warp, report =  
       img1.libceliu.infer(img1, img2, alpha, ratio, minWidth, 
 			  nOuterFPIterations, nInnerFPIterations,
-			  nCGIterations)
+			  nCGIterations, solver, nMGCycles, tolerance,
+			  nSORIterations, omega, nThreads,
+			  nWarmSkipLevels, nWarmOuterFPIterations,
+			  outerTolerance, innerTolerance, adaptiveBudget, init_x, init_y,
+			  flow_x, flow_y, warp, profile)
    
-   local flow_norm  = opticalflow.computeNorm(flow_x,flow_y)
-   local flow_angle = opticalflow.computeAngle(flow_x,flow_y)
+   local flow_norm, flow_angle = img1.libceliu.flowPolar(flow_x, flow_y, nThreads)
    
-   -- return results
-   return flow_norm, flow_angle, warp, flow_x, flow_y
+   -- return results (report is nil unless profile is set)
+   return flow_norm, flow_angle, warp, flow_x, flow_y, report
 end
 
 -- warper
 function opticalflow.warp (...)
-   local _, inp, vx, vy = xlua.unpack(
+   local _, inp, vx, vy, out = xlua.unpack(
       {...},
       'opticalflow.warp', 
       [[
@@ -133,12 +197,373 @@ if flow was computed from img1->img2, then warp(img2,vx,vy) will compute
 	 {arg='flow_x', type='torch.Tensor', 
 	  help='x component of flow field', req=true},
 	 {arg='flow_y', type='torch.Tensor', 
-	  help='y component of flow field', req=true}
+	  help='y component of flow field', req=true},
+	 {arg='output', type='torch.Tensor', 
+	  help='preallocated output (resized if needed)'}
       )
   if inp:nDimension() ~= 3 then
      xerror('image should be a NxHxW tensor',nil,args.usage)
   end
-  return image.libceliu.warp(inp, vx, vy)
+  return image.libceliu.warp(inp, vx, vy, out)
+end
+
+------------------------------------------------------------
+-- Computes the optical flow of a batch of image pairs, and returns
+-- the stacked flow fields and warped images.
+--
+-- The pairs are processed concurrently, one thread per pair, so that
+-- batches of small images use all the cores.
+--
+-- The pairs are either given as a table of pairs {image1, image2} of
+-- NxHxW tensors, or as a Bx2xNxHxW tensor. All the images must have
+-- the same size.
+--
+-- @usage opticalflow.inferBatch() -- prints online help
+--
+-- @param pairs  a table of B pairs of images (2 NxHxW tensor) [type = table]
+-- @param batch  B pairs of images (Bx2xNxHxW tensor) [type = torch.Tensor]
+-- @param alpha  regularization weight [default = 0.01] [type = number]
+-- @param ratio  downsample ratio [default = 0.75] [type = number]
+-- @param minWidth  width of the coarsest level [default = 30] [type = number]
+-- @param nOuterFPIterations  number of outer fixed-point iterations [default = 15] [type = number]
+-- @param nInnerFPIterations  number of inner fixed-point iterations [default = 1] [type = number]
+-- @param nCGIterations  number of CG iterations [default = 20] [type = number]
+-- @param solver  linear solver: cg | pcg | sor | multigrid | fmg [default = cg] [type = string]
+-- @param nMGCycles  number of V-cycles of the multigrid solver [default = 3] [type = number]
+-- @param tolerance  relative residual at which the linear solver stops [default = 0] [type = number]
+-- @param nSORIterations  number of red-black SOR iterations [default = 30] [type = number]
+-- @param omega  SOR relaxation factor [default = 1.8] [type = number]
+-- @param nThreads  number of threads, 0 for all the cores [default = 0] [type = number]
+-- @param outerTolerance  stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) [default = 0] [type = number]
+-- @param innerTolerance  stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) [default = 0] [type = number]
+-- @param adaptiveBudget  limit the outer iterations of a level to one more than the coarser level needed [default = false] [type = boolean]
+-- @param flow_x  preallocated output for the x components of the flows [type = torch.Tensor]
+-- @param flow_y  preallocated output for the y components of the flows [type = torch.Tensor]
+-- @param warp  preallocated output for the warped images [type = torch.Tensor]
+------------------------------------------------------------
+function opticalflow.inferBatch(...)
+   -- check args
+   local _, pairs, batch, alpha, ratio, minWidth, 
+           nOuterFPIterations, nInnerFPIterations, nCGIterations,
+           solver, nMGCycles, tolerance, nSORIterations, omega, nThreads,
+           outerTolerance, innerTolerance, adaptiveBudget,
+           flow_x, flow_y, warp = 
+      xlua.unpack(
+              {...},
+              'opticalflow.inferBatch',
+	      [[Computes the optical flow of a batch of image pairs, and returns
+the flow fields (Bx1xHxW tensors) and the warped second images (BxNxHxW tensor).
+
+The pairs are processed concurrently, one thread per pair.]],
+              {arg='pairs', type='table', 
+	       help='a table of pairs of images (2 NxHxW tensor)'},
+              {arg='batch', type='torch.Tensor', 
+	       help='pairs of images (Bx2xNxHxW tensor)'},
+              {arg='alpha', type='number', 
+	       help='regularization weight', default=0.01},
+              {arg='ratio', type='number', 
+	       help='downsample ratio', default=0.75},
+              {arg='minWidth', type='number', 
+	       help='width of the coarsest level', default=30},
+              {arg='nOuterFPIterations', type='number', 
+	       help='number of outer fixed-point iterations', default=15},
+              {arg='nInnerFPIterations', type='number', 
+	       help='number of inner fixed-point iterations', default=1},
+              {arg='nCGIterations', type='number', 
+	       help='number of CG iterations', default=20},
+              {arg='solver', type='string', 
+	       help='linear solver: cg | pcg | sor | multigrid | fmg', default='cg'},
+              {arg='nMGCycles', type='number', 
+	       help='number of V-cycles of the multigrid solver', default=3},
+              {arg='tolerance', type='number', 
+	       help='relative residual at which the linear solver stops (0 = run all iterations)', default=0},
+              {arg='nSORIterations', type='number', 
+	       help='number of red-black SOR iterations', default=30},
+              {arg='omega', type='number', 
+	       help='SOR relaxation factor (between 1 and 2)', default=1.8},
+              {arg='nThreads', type='number', 
+	       help='number of threads (0 = all the cores)', default=0},
+              {arg='outerTolerance', type='number', 
+	       help='stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) (0 = run all iterations)', default=0},
+              {arg='innerTolerance', type='number', 
+	       help='stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) (0 = run all iterations)', default=0},
+              {arg='adaptiveBudget', type='boolean', 
+	       help='limit the outer iterations of a level to one more than the coarser level needed', default=false},
+              {arg='flow_x', type='torch.Tensor', 
+	       help='preallocated output for the x components of the flows (resized if needed)'},
+              {arg='flow_y', type='torch.Tensor', 
+	       help='preallocated output for the y components of the flows (resized if needed)'},
+              {arg='warp', type='torch.Tensor', 
+	       help='preallocated output for the warped images (resized if needed)'}
+           )
+
+   local input = batch or pairs
+   if not input then
+      xerror('a table of pairs or a Bx2xNxHxW tensor is required',nil,args.usage)
+   end
+   local lib = batch and batch.libceliu or pairs[1][1].libceliu
+
+   -- compute flows
+   flow_x, flow_y, warp = 
+      lib.inferBatch(input, alpha, ratio, minWidth, 
+		     nOuterFPIterations, nInnerFPIterations,
+		     nCGIterations, solver, nMGCycles, tolerance,
+		     nSORIterations, omega, nThreads, nil, nil,
+		     outerTolerance, innerTolerance, adaptiveBudget,
+		     flow_x, flow_y, warp)
+
+   -- return results
+   return flow_x, flow_y, warp
+end
+
+------------------------------------------------------------
+-- Computes the optical flows of a pair of images in both directions,
+-- from image1 to image2 and from image2 to image1, and the masks of
+-- the pixels whose forward and backward flows are consistent.
+--
+-- The pyramids and the features of the two images are built once,
+-- and the two flows are then computed concurrently, each with half
+-- of the threads.
+--
+-- A pixel is consistent if the backward flow where it moves to
+-- brings it back, within an error of consistencyRatio times the
+-- squared lengths of the two flows, plus consistencyOffset (in
+-- squared pixels). Occluded pixels and pixels that move out of
+-- the image are not.
+--
+-- @usage opticalflow.inferBidirectional() -- prints online help
+--
+-- @param pair  a pair of images (2 NxHxW tensor) [type = table]
+-- @param image1  the first image (NxHxW tensor) [type = torch.Tensor]
+-- @param image2  the second image (NxHxW tensor) [type = torch.Tensor]
+-- @param alpha  regularization weight [default = 0.01] [type = number]
+-- @param ratio  downsample ratio [default = 0.75] [type = number]
+-- @param minWidth  width of the coarsest level [default = 30] [type = number]
+-- @param nOuterFPIterations  number of outer fixed-point iterations [default = 15] [type = number]
+-- @param nInnerFPIterations  number of inner fixed-point iterations [default = 1] [type = number]
+-- @param nCGIterations  number of CG iterations [default = 20] [type = number]
+-- @param solver  linear solver: cg | pcg | sor | multigrid | fmg [default = cg] [type = string]
+-- @param nMGCycles  number of V-cycles of the multigrid solver [default = 3] [type = number]
+-- @param tolerance  relative residual at which the linear solver stops [default = 0] [type = number]
+-- @param nSORIterations  number of red-black SOR iterations [default = 30] [type = number]
+-- @param omega  SOR relaxation factor [default = 1.8] [type = number]
+-- @param nThreads  number of threads, 0 for all the cores [default = 2] [type = number]
+-- @param outerTolerance  stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) [default = 0] [type = number]
+-- @param innerTolerance  stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) [default = 0] [type = number]
+-- @param adaptiveBudget  limit the outer iterations of a level to one more than the coarser level needed [default = false] [type = boolean]
+-- @param consistencyRatio  tolerance of the consistency check, relative to the squared lengths of the flows [default = 0.01] [type = number]
+-- @param consistencyOffset  tolerance of the consistency check, in squared pixels [default = 0.5] [type = number]
+-- @param flow_x  preallocated output for the x component of the forward flow [type = torch.Tensor]
+-- @param flow_y  preallocated output for the y component of the forward flow [type = torch.Tensor]
+-- @param warp  preallocated output for the second image warped by the forward flow [type = torch.Tensor]
+-- @param back_x  preallocated output for the x component of the backward flow [type = torch.Tensor]
+-- @param back_y  preallocated output for the y component of the backward flow [type = torch.Tensor]
+-- @param back_warp  preallocated output for the first image warped by the backward flow [type = torch.Tensor]
+-- @param mask  preallocated output for the consistency mask of the first image [type = torch.Tensor]
+-- @param back_mask  preallocated output for the consistency mask of the second image [type = torch.Tensor]
+------------------------------------------------------------
+function opticalflow.inferBidirectional(...)
+   -- check args
+   local _, pair, img1, img2, alpha, ratio, minWidth, 
+           nOuterFPIterations, nInnerFPIterations, nCGIterations,
+           solver, nMGCycles, tolerance, nSORIterations, omega, nThreads,
+           outerTolerance, innerTolerance, adaptiveBudget,
+           consistencyRatio, consistencyOffset,
+           flow_x, flow_y, warp, back_x, back_y, back_warp, mask, back_mask = 
+      xlua.unpack(
+              {...},
+              'opticalflow.inferBidirectional',
+	      [[Computes the optical flows of a pair of images in both directions, and
+returns the forward flow (flow_x, flow_y) with the second image warped by it, the
+backward flow (back_x, back_y) with the first image warped by it, and the masks
+(1xHxW tensors) of the pixels of the first and the second images whose forward
+and backward flows are consistent (1) or not (0).
+
+The pyramids are built once, and the two flows are computed concurrently.]],
+              {arg='pair', type='table', 
+	       help='a pair of images (2 NxHxW tensor)'},
+              {arg='image1', type='torch.Tensor', 
+	       help='the first image (NxHxW tensor)'},
+              {arg='image2', type='torch.Tensor', 
+	       help='the second image (NxHxW tensor)'},
+              {arg='alpha', type='number', 
+	       help='regularization weight', default=0.01},
+              {arg='ratio', type='number', 
+	       help='downsample ratio', default=0.75},
+              {arg='minWidth', type='number', 
+	       help='width of the coarsest level', default=30},
+              {arg='nOuterFPIterations', type='number', 
+	       help='number of outer fixed-point iterations', default=15},
+              {arg='nInnerFPIterations', type='number', 
+	       help='number of inner fixed-point iterations', default=1},
+              {arg='nCGIterations', type='number', 
+	       help='number of CG iterations', default=20},
+              {arg='solver', type='string', 
+	       help='linear solver: cg | pcg | sor | multigrid | fmg', default='cg'},
+              {arg='nMGCycles', type='number', 
+	       help='number of V-cycles of the multigrid solver', default=3},
+              {arg='tolerance', type='number', 
+	       help='relative residual at which the linear solver stops (0 = run all iterations)', default=0},
+              {arg='nSORIterations', type='number', 
+	       help='number of red-black SOR iterations', default=30},
+              {arg='omega', type='number', 
+	       help='SOR relaxation factor (between 1 and 2)', default=1.8},
+              {arg='nThreads', type='number', 
+	       help='number of threads, split between the two directions (0 = all the cores)', default=2},
+              {arg='outerTolerance', type='number', 
+	       help='stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) (0 = run all iterations)', default=0},
+              {arg='innerTolerance', type='number', 
+	       help='stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) (0 = run all iterations)', default=0},
+              {arg='adaptiveBudget', type='boolean', 
+	       help='limit the outer iterations of a level to one more than the coarser level needed', default=false},
+              {arg='consistencyRatio', type='number', 
+	       help='tolerance of the consistency check, relative to the squared lengths of the flows', default=0.01},
+              {arg='consistencyOffset', type='number', 
+	       help='tolerance of the consistency check, in squared pixels', default=0.5},
+              {arg='flow_x', type='torch.Tensor', 
+	       help='preallocated output for the x component of the forward flow (resized if needed)'},
+              {arg='flow_y', type='torch.Tensor', 
+	       help='preallocated output for the y component of the forward flow (resized if needed)'},
+              {arg='warp', type='torch.Tensor', 
+	       help='preallocated output for the warped second image (resized if needed)'},
+              {arg='back_x', type='torch.Tensor', 
+	       help='preallocated output for the x component of the backward flow (resized if needed)'},
+              {arg='back_y', type='torch.Tensor', 
+	       help='preallocated output for the y component of the backward flow (resized if needed)'},
+              {arg='back_warp', type='torch.Tensor', 
+	       help='preallocated output for the warped first image (resized if needed)'},
+              {arg='mask', type='torch.Tensor', 
+	       help='preallocated output for the consistency mask of the first image (resized if needed)'},
+              {arg='back_mask', type='torch.Tensor', 
+	       help='preallocated output for the consistency mask of the second image (resized if needed)'}
+           )
+
+   -- pair ?
+   if pair then 
+      img1 = pair[1]
+      img2 = pair[2]
+   end
+   
+   -- check dims
+   if img1:nDimension() ~= 3 then
+      xerror('image should be a NxHxW tensor',nil,args.usage)
+   end
+
+   -- compute flows and masks
+   flow_x, flow_y, warp, back_x, back_y, back_warp, mask, back_mask = 
+      img1.libceliu.inferBidirectional(img1, img2, alpha, ratio, minWidth, 
+				       nOuterFPIterations, nInnerFPIterations,
+				       nCGIterations, solver, nMGCycles, tolerance,
+				       nSORIterations, omega, nThreads, nil, nil,
+				       outerTolerance, innerTolerance, adaptiveBudget,
+				       consistencyRatio, consistencyOffset,
+				       flow_x, flow_y, warp, back_x, back_y, back_warp,
+				       mask, back_mask)
+
+   -- return results
+   return flow_x, flow_y, warp, back_x, back_y, back_warp, mask, back_mask
+end
+
+------------------------------------------------------------
+-- Creates a stream, to compute the optical flow of a video frame
+-- by frame. The stream keeps the pyramid of the last frame, so each
+-- new frame costs one pyramid construction instead of two.
+--
+-- stream:add(frame) returns the flow from the last frame to the new
+-- one (flow_x, flow_y, warp), or nil for the first frame.
+-- stream:reset() starts a new sequence.
+-- The frames must be NxHxW tensors of the default tensor type.
+--
+-- @usage opticalflow.newStream() -- prints online help
+--
+-- @param alpha  regularization weight [default = 0.01] [type = number]
+-- @param ratio  downsample ratio [default = 0.75] [type = number]
+-- @param minWidth  width of the coarsest level [default = 30] [type = number]
+-- @param nOuterFPIterations  number of outer fixed-point iterations [default = 15] [type = number]
+-- @param nInnerFPIterations  number of inner fixed-point iterations [default = 1] [type = number]
+-- @param nCGIterations  number of CG iterations [default = 20] [type = number]
+-- @param solver  linear solver: cg | pcg | sor | multigrid | fmg [default = cg] [type = string]
+-- @param nMGCycles  number of V-cycles of the multigrid solver [default = 3] [type = number]
+-- @param tolerance  relative residual at which the linear solver stops [default = 0] [type = number]
+-- @param nSORIterations  number of red-black SOR iterations [default = 30] [type = number]
+-- @param omega  SOR relaxation factor [default = 1.8] [type = number]
+-- @param nThreads  number of threads, 0 for all the cores [default = 1] [type = number]
+-- @param warmStart  start each pair from the flow of the last pair [default = false] [type = boolean]
+-- @param nWarmSkipLevels  number of coarsest levels skipped with warmStart [default = 0] [type = number]
+-- @param nWarmOuterFPIterations  number of outer fixed-point iterations with warmStart, 0 for nOuterFPIterations [default = 0] [type = number]
+-- @param outerTolerance  stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) [default = 0] [type = number]
+-- @param innerTolerance  stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) [default = 0] [type = number]
+-- @param adaptiveBudget  limit the outer iterations of a level to one more than the coarser level needed [default = false] [type = boolean]
+------------------------------------------------------------
+function opticalflow.newStream(...)
+   -- check args
+   local _, alpha, ratio, minWidth, 
+           nOuterFPIterations, nInnerFPIterations, nCGIterations,
+           solver, nMGCycles, tolerance, nSORIterations, omega, nThreads,
+           warmStart, nWarmSkipLevels, nWarmOuterFPIterations,
+           outerTolerance, innerTolerance, adaptiveBudget = 
+      xlua.unpack(
+              {...},
+              'opticalflow.newStream',
+	      [[Creates a stream to compute the optical flow of a video, frame by frame:
+stream:add(frame) returns flow_x, flow_y, warp from the last frame to the new one
+(nil for the first frame), stream:reset() starts a new sequence.]],
+              {arg='alpha', type='number', 
+	       help='regularization weight', default=0.01},
+              {arg='ratio', type='number', 
+	       help='downsample ratio', default=0.75},
+              {arg='minWidth', type='number', 
+	       help='width of the coarsest level', default=30},
+              {arg='nOuterFPIterations', type='number', 
+	       help='number of outer fixed-point iterations', default=15},
+              {arg='nInnerFPIterations', type='number', 
+	       help='number of inner fixed-point iterations', default=1},
+              {arg='nCGIterations', type='number', 
+	       help='number of CG iterations', default=20},
+              {arg='solver', type='string', 
+	       help='linear solver: cg | pcg | sor | multigrid | fmg', default='cg'},
+              {arg='nMGCycles', type='number', 
+	       help='number of V-cycles of the multigrid solver', default=3},
+              {arg='tolerance', type='number', 
+	       help='relative residual at which the linear solver stops (0 = run all iterations)', default=0},
+              {arg='nSORIterations', type='number', 
+	       help='number of red-black SOR iterations', default=30},
+              {arg='omega', type='number', 
+	       help='SOR relaxation factor (between 1 and 2)', default=1.8},
+              {arg='nThreads', type='number', 
+	       help='number of threads (0 = all the cores)', default=1},
+              {arg='warmStart', type='boolean', 
+	       help='start each pair from the flow of the last pair', default=false},
+              {arg='nWarmSkipLevels', type='number', 
+	       help='number of coarsest levels skipped with warmStart', default=0},
+              {arg='nWarmOuterFPIterations', type='number', 
+	       help='number of outer fixed-point iterations with warmStart (0 = nOuterFPIterations)', default=0},
+              {arg='outerTolerance', type='number', 
+	       help='stop the outer iterations of a level when the RMS flow update is below outerTolerance*(1+RMS flow) (0 = run all iterations)', default=0},
+              {arg='innerTolerance', type='number', 
+	       help='stop the inner iterations when the RMS change of the update is below innerTolerance*(RMS update) (0 = run all iterations)', default=0},
+              {arg='adaptiveBudget', type='boolean', 
+	       help='limit the outer iterations of a level to one more than the coarser level needed', default=false}
+           )
+
+   local lib = torch.Tensor().libceliu
+   local stream = {}
+   stream.handle = lib.streamNew(alpha, ratio, minWidth, 
+				 nOuterFPIterations, nInnerFPIterations,
+				 nCGIterations, solver, nMGCycles, tolerance,
+				 nSORIterations, omega, nThreads,
+				 nWarmSkipLevels, nWarmOuterFPIterations,
+				 outerTolerance, innerTolerance, adaptiveBudget, warmStart)
+   function stream:add(frame, flow_x, flow_y, warp)
+      if frame:nDimension() ~= 3 then
+	 xerror('frame should be a NxHxW tensor')
+      end
+      return lib.streamAdd(self.handle, frame, flow_x, flow_y, warp)
+   end
+   function stream:reset()
+      lib.streamReset(self.handle)
+   end
+   return stream
 end
 
 ------------------------------------------------------------
@@ -188,9 +613,7 @@ function opticalflow.computeNorm(...)
       {arg='flow_x', type='torch.Tensor', help='flow field (x), (WxH)', req=true},
       {arg='flow_y', type='torch.Tensor', help='flow field (y), (WxH)', req=true}
    )
-   local flow_norm = torch.Tensor()
-   local x_squared = torch.Tensor():resizeAs(flow_x):copy(flow_x):cmul(flow_x)
-   flow_norm:resizeAs(flow_y):copy(flow_y):cmul(flow_y):add(x_squared):sqrt()
+   local flow_norm = flow_x.libceliu.flowPolar(flow_x, flow_y)
    return flow_norm
 end
 
@@ -211,23 +634,7 @@ function opticalflow.computeAngle(...)
       {arg='flow_x', type='torch.Tensor', help='flow field (x), (WxH)', req=true},
       {arg='flow_y', type='torch.Tensor', help='flow field (y), (WxH)', req=true}
    )
-   local flow_angle = torch.Tensor()
-   flow_angle:resizeAs(flow_y):copy(flow_y):cdiv(flow_x):abs():atan():mul(180/math.pi)
-   flow_angle:map2(flow_x, flow_y, function(h,x,y)
-				      if x == 0 and y >= 0 then
-					 return 90
-				      elseif x == 0 and y <= 0 then
-					 return 270
-				      elseif x >= 0 and y >= 0 then
-					 -- all good
-				      elseif x >= 0 and y < 0 then
-					 return 360 - h
-				      elseif x < 0 and y >= 0 then
-					 return 180 - h
-				      elseif x < 0 and y < 0 then
-					 return 180 + h
-				      end
-				   end)
+   local _, flow_angle = flow_x.libceliu.flowPolar(flow_x, flow_y)
    return flow_angle
 end
 
@@ -241,10 +648,11 @@ end
 -- @param angle  flow field (angle), (WxH) [required] [type = torch.Tensor]
 -- @param max  if not provided, norm:max() is used [type = number]
 -- @param legend  prints a legend on the image [type = boolean]
+-- @param nThreads  number of threads, 0 for all the cores [default = 0] [type = number]
 ------------------------------------------------------------
 function opticalflow.field2rgb(...)
    -- check args
-   local _, norm, angle, max, legend = xlua.unpack(
+   local _, norm, angle, max, legend, nThreads = xlua.unpack(
       {...},
       'opticalflow.field2rgb',
       'merges Norm and Angle flow fields into a single RGB image,\n'
@@ -252,34 +660,21 @@ function opticalflow.field2rgb(...)
       {arg='norm', type='torch.Tensor', help='flow field (norm), (WxH)', req=true},
       {arg='angle', type='torch.Tensor', help='flow field (angle), (WxH)', req=true},
       {arg='max', type='number', help='if not provided, norm:max() is used'},
-      {arg='legend', type='boolean', help='prints a legend on the image', default=false}
+      {arg='legend', type='boolean', help='prints a legend on the image', default=false},
+      {arg='nThreads', type='number', help='number of threads (0 = all the cores)', default=0}
    )
    
-   -- max
-   local saturate = false
-   if max then saturate = true end
-   max = math.max(max or norm:max(), 1e-2)
-   
-   -- merge them into an HSL image
-   local hsl = torch.Tensor(3,norm:size(2), norm:size(3))
-   -- hue = angle:
-   hsl:select(1,1):copy(angle):div(360)
-   -- saturation = normalized intensity:
-   hsl:select(1,2):copy(norm):div(max)
-   if saturate then hsl:select(1,2):tanh() end
-   -- light varies inversely from saturation (null flow = white):
-   hsl:select(1,3):copy(hsl:select(1,2)):mul(-0.5):add(1)
-   
-   -- convert HSL to RGB
-   local rgb = image.hsl2rgb(hsl)
+   -- hue = angle, saturation = normalized intensity, and light varies
+   -- inversely from saturation (null flow = white), converted to RGB
+   local rgb = norm.libceliu.polarColor(norm, angle, max, nThreads)
    
    -- legend
    if legend then
       _legend_ = _legend_
 	 or image.load(paths.concat(paths.install_lua_path, 'opticalflow/legend.png'),3)
-      legend = torch.Tensor(3,hsl:size(2)/8, hsl:size(2)/8)
+      legend = torch.Tensor(3,rgb:size(2)/8, rgb:size(2)/8)
       image.scale(_legend_, legend, 'bilinear')
-      rgb:narrow(1,1,legend:size(2)):narrow(2,hsl:size(2)-legend:size(2)+1,legend:size(2)):copy(legend)
+      rgb:narrow(1,1,legend:size(2)):narrow(2,rgb:size(2)-legend:size(2)+1,legend:size(2)):copy(legend)
    end
    
    -- done
@@ -294,22 +689,25 @@ end
 --
 -- @param x  flow field (x), (WxH) [required] [type = torch.Tensor]
 -- @param y  flow field (y), (WxH) [required] [type = torch.Tensor]
+-- @param max  if not provided, norm:max() is used [type = number]
+-- @param nThreads  number of threads, 0 for all the cores [default = 0] [type = number]
 ------------------------------------------------------------
 function opticalflow.xy2rgb(...)
    -- check args
-   local _, x, y, max = xlua.unpack(
+   local _, x, y, max, nThreads = xlua.unpack(
       {...},
       'opticalflow.xy2rgb',
       'merges x and y flow fields into a single RGB image,\n'
 	 .. 'where saturation=intensity, and hue=direction',
       {arg='x', type='torch.Tensor', help='flow field (norm), (WxH)', req=true},
       {arg='y', type='torch.Tensor', help='flow field (angle), (WxH)', req=true},
-      {arg='max', type='number', help='if not provided, norm:max() is used'}
+      {arg='max', type='number', help='if not provided, norm:max() is used'},
+      {arg='nThreads', type='number', help='number of threads (0 = all the cores)', default=0}
    )
    
-   local norm = opticalflow.computeNorm(x,y)
-   local angle = opticalflow.computeAngle(x,y)
-   return opticalflow.field2rgb(norm,angle,max)
+   -- the norm, the angle and the colors in a single pass
+   local rgb = x.libceliu.flowColor(x, y, max, nThreads)
+   return rgb
 end
 
 function opticalflow.imgL()
@@ -414,6 +812,54 @@ function opticalflow.writeflo(...)
    return 1
 end
 
+------------------------------------------------------------
+-- Native .flo reader: the file is memory-mapped and split into
+-- the two components of the flow, in the layout of infer
+-- (1xHxW tensors)
+------------------------------------------------------------
+function opticalflow.loadflo(...)
+   local _, filename, setoutofband, maxFlow, flow_x, flow_y = xlua.unpack(
+      {...},
+      'opticalflow.loadflo',
+      'read a .flo file from middlebury, returns flow_x, flow_y (1xHxW)',
+      {arg='filename',type='string', help='filename to be read',
+       req=true},
+      {arg='setoutofband',type='boolean',
+       help='reset the pixels whose flow is larger than max(W,H) to 0',default=false},
+      {arg='maxFlow',type='number',
+       help='reset the pixels whose flow is larger than maxFlow to 0 (overrides setoutofband)'},
+      {arg='flow_x', type='torch.Tensor', 
+       help='preallocated output for the x component of the flow (resized if needed)'},
+      {arg='flow_y', type='torch.Tensor', 
+       help='preallocated output for the y component of the flow (resized if needed)'}
+   )
+   local lib = (flow_x or torch.Tensor()).libceliu
+   return lib.readFlo(filename, maxFlow or setoutofband, flow_x, flow_y)
+end
+
+------------------------------------------------------------
+-- Native .flo writer, streams the flow from the two
+-- components (HxW or 1xHxW tensors)
+------------------------------------------------------------
+function opticalflow.saveflo(...)
+   local _, flow_x, flow_y, filename = xlua.unpack(
+      {...},
+      'opticalflow.saveflo',
+      'write the flow flow_x, flow_y (HxW or 1xHxW) to a .flo file',
+      {arg='flow_x',type='torch.Tensor',
+       help='x component of the flow',req=true},
+      {arg='flow_y',type='torch.Tensor',
+       help='y component of the flow',req=true},
+      {arg='filename',type='string', 
+       help='filename to be written',req=true}
+   )
+   if not filename:match('.flo$') then
+      filename = filename..'.flo'
+   end
+   flow_x.libceliu.writeFlo(flow_x, flow_y, filename)
+   return 1
+end
+
    ------------------------------------------------------------
    -- Function to test .flo IO code for files from middlebury
    ------------------------------------------------------------